@@ -2,18 +2,74 @@
 // https://github.com/vedantk/gcrypt-example/blob/master/gcry.cc
 
 #include <gcrypt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "crypto.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_NETWORK
 
 #define GCRY_CIPHER GCRY_CIPHER_AES128   // Pick the cipher here
 #define GCRY_C_MODE GCRY_CIPHER_MODE_ECB // Pick the cipher mode here
 
-gcry_error_t gcry_error_handle;
-gcry_cipher_hd_t gcry_cipher_hd;
+// AEAD mode, the key is derived from the shared key so that its full length is used
+#define GCRY_AEAD_CIPHER GCRY_CIPHER_AES256
+#define GCRY_AEAD_MODE GCRY_CIPHER_MODE_GCM
+#define GCRY_AEAD_KEY_MD GCRY_MD_SHA256
+
+// Two keys are active while the mesh is rekeyed, slot 0 encrypts outgoing messages
+#define CRYPTO_KEY_SLOTS 2
+
+struct crypto_key_s {
+    int valid;
+    uint8_t id;
+    char key[16];
+    char iv[16];
+    unsigned char aead_key[32];
+};
+
+// Protected by crypto_mutex, crypto_generation changes with every new set of keys
+static struct crypto_key_s crypto_keys[CRYPTO_KEY_SLOTS];
+static unsigned int crypto_generation;
+static pthread_mutex_t crypto_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Cipher handles keep state between calls, so each thread uses handles of its own
+struct crypto_thread_s {
+    unsigned int generation;
+    int valid[CRYPTO_KEY_SLOTS];
+    uint8_t id[CRYPTO_KEY_SLOTS];
+    gcry_cipher_hd_t ecb[CRYPTO_KEY_SLOTS];
+    gcry_cipher_hd_t aead[CRYPTO_KEY_SLOTS];
+};
+
+static pthread_key_t crypto_thread_key;
+static pthread_once_t crypto_thread_once = PTHREAD_ONCE_INIT;
+
+// AEAD nonces are the key id, a random part and a message counter.  The key is shared
+// by the whole mesh and survives restarts, so the random part has to be long enough
+// that no two senders ever draw the same one.  A new one is drawn whenever the
+// counter starts over, which includes the first message.
+#define AEAD_NONCE_RANDOM_LEN 7
+#define AEAD_NONCE_COUNTER_LEN (GCRYPT_AEAD_NONCE_LEN - 1 - AEAD_NONCE_RANDOM_LEN)
+
+static unsigned char aead_nonce_random[AEAD_NONCE_RANDOM_LEN];
+static uint32_t aead_nonce_counter;
+static pthread_mutex_t aead_nonce_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void crypto_thread_free(void *ptr);
+
+static void crypto_thread_key_create();
+
+static struct crypto_thread_s *crypto_thread_get();
+
+static void crypto_key_fill(struct crypto_key_s *slot, int key_id, const char *key, const char *iv);
 
 void gcrypt_init() {
     if (!gcry_check_version(GCRYPT_VERSION)) {
-        fprintf(stderr, "gcrypt: library version mismatch");
+        dawn_log_error("gcrypt: library version mismatch\n");
     }
     gcry_error_t err = 0;
     err = gcry_control(GCRYCTL_SUSPEND_SECMEM_WARN);
@@ -22,58 +78,150 @@ void gcrypt_init() {
     err |= gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
 
     if (err) {
-        fprintf(stderr, "gcrypt: failed initialization");
+        dawn_log_error("gcrypt: failed initialization\n");
     }
 }
 
-void gcrypt_set_key_and_iv(const char *key, const char *iv) {
-    size_t keylen = gcry_cipher_get_algo_keylen(GCRY_CIPHER);
-    size_t blklen = gcry_cipher_get_algo_blklen(GCRY_CIPHER);
-
-    gcry_error_handle = gcry_cipher_open(
-            &gcry_cipher_hd, // gcry_cipher_hd_t *
-            GCRY_CIPHER,   // int
-            GCRY_C_MODE,   // int
-            0);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_open failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        return;
+static void crypto_thread_free(void *ptr) {
+    struct crypto_thread_s *ctx = ptr;
+
+    for (int i = 0; i < CRYPTO_KEY_SLOTS; i++) {
+        gcry_cipher_close(ctx->ecb[i]);
+        gcry_cipher_close(ctx->aead[i]);
     }
+    free(ctx);
+}
 
-    gcry_error_handle = gcry_cipher_setkey(gcry_cipher_hd, key, keylen);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_setkey failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        return;
+static void crypto_thread_key_create() {
+    pthread_key_create(&crypto_thread_key, crypto_thread_free);
+}
+
+// Returns the handles of the calling thread, rekeyed if the keys changed since their last use
+static struct crypto_thread_s *crypto_thread_get() {
+    struct crypto_thread_s *ctx;
+    gcry_error_t err = 0;
+
+    pthread_once(&crypto_thread_once, crypto_thread_key_create);
+
+    ctx = pthread_getspecific(crypto_thread_key);
+    if (!ctx) {
+        ctx = calloc(1, sizeof(*ctx));
+        if (!ctx) {
+            dawn_log_error("gcrypt error: not enought memory\n");
+            return NULL;
+        }
+
+        for (int i = 0; i < CRYPTO_KEY_SLOTS && !err; i++) {
+            err = gcry_cipher_open(&ctx->ecb[i], GCRY_CIPHER, GCRY_C_MODE, 0);
+            if (!err)
+                err = gcry_cipher_open(&ctx->aead[i], GCRY_AEAD_CIPHER, GCRY_AEAD_MODE, 0);
+        }
+        if (err) {
+            dawn_log_error("gcry_cipher_open failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+            crypto_thread_free(ctx);
+            return NULL;
+        }
+
+        ctx->generation = ~__atomic_load_n(&crypto_generation, __ATOMIC_ACQUIRE);
+        pthread_setspecific(crypto_thread_key, ctx);
+    }
+
+    if (ctx->generation == __atomic_load_n(&crypto_generation, __ATOMIC_ACQUIRE))
+        return ctx;
+
+    pthread_mutex_lock(&crypto_mutex);
+    for (int i = 0; i < CRYPTO_KEY_SLOTS; i++) {
+        struct crypto_key_s *slot = &crypto_keys[i];
+
+        ctx->valid[i] = 0;
+        if (!slot->valid)
+            continue;
+
+        err = gcry_cipher_setkey(ctx->ecb[i], slot->key, gcry_cipher_get_algo_keylen(GCRY_CIPHER));
+        if (!err)
+            err = gcry_cipher_setiv(ctx->ecb[i], slot->iv, gcry_cipher_get_algo_blklen(GCRY_CIPHER));
+        if (!err)
+            err = gcry_cipher_setkey(ctx->aead[i], slot->aead_key, gcry_cipher_get_algo_keylen(GCRY_AEAD_CIPHER));
+        if (err) {
+            dawn_log_error("gcry_cipher_setkey failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+            continue;
+        }
+
+        ctx->valid[i] = 1;
+        ctx->id[i] = slot->id;
     }
+    ctx->generation = crypto_generation;
+    pthread_mutex_unlock(&crypto_mutex);
+
+    return ctx;
+}
+
+// The cipher reads a whole key and iv, shorter strings are padded with zeros
+static void crypto_key_fill(struct crypto_key_s *slot, int key_id, const char *key, const char *iv) {
+    memset(slot, 0, sizeof(*slot));
 
-    gcry_error_handle = gcry_cipher_setiv(gcry_cipher_hd, iv, blklen);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_setiv failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
+    if (key_id < 0 || !key || !*key)
         return;
+
+    slot->valid = 1;
+    slot->id = key_id;
+    strncpy(slot->key, key, sizeof(slot->key));
+    if (iv)
+        strncpy(slot->iv, iv, sizeof(slot->iv));
+    gcry_md_hash_buffer(GCRY_AEAD_KEY_MD, slot->aead_key, key, strlen(key));
+}
+
+void gcrypt_set_key_and_iv(const char *key, const char *iv) {
+    gcrypt_set_keys(0, key, iv, -1, NULL);
+}
+
+int gcrypt_set_keys(int key_id, const char *key, const char *iv, int next_key_id, const char *next_key) {
+    if (key_id < 0)
+        key_id = 0;
+
+    if (key_id > 0xff || next_key_id > 0xff || key_id == next_key_id) {
+        dawn_log_error("gcrypt: invalid key ids %d and %d\n", key_id, next_key_id);
+        return -1;
     }
+
+    pthread_mutex_lock(&crypto_mutex);
+    crypto_key_fill(&crypto_keys[0], key_id, key, iv);
+    crypto_key_fill(&crypto_keys[1], next_key_id, next_key, iv);
+    __atomic_add_fetch(&crypto_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&crypto_mutex);
+
+    return 0;
 }
 
 // free out buffer after using!
 char *gcrypt_encrypt_msg(char *msg, size_t msg_length, int *out_length) {
-    if (0U != (msg_length & 0xfU))
-        msg_length += 0x10U - (msg_length & 0xfU);
+    struct crypto_thread_s *ctx = crypto_thread_get();
+    gcry_error_t err;
+
+    if (!ctx || !ctx->valid[0]) {
+        dawn_log_error("gcry_cipher_encrypt error: no key\n");
+        return NULL;
+    }
+
+    size_t padded_length = msg_length;
+    if (0U != (padded_length & 0xfU))
+        padded_length += 0x10U - (padded_length & 0xfU);
 
-    char *out = malloc(msg_length);
+    // padded with zeros, msg itself may end before the block does
+    char *out = calloc(1, padded_length);
     if (!out){
-        fprintf(stderr, "gcry_cipher_encrypt error: not enought memory\n");
+        dawn_log_error("gcry_cipher_encrypt error: not enought memory\n");
         return NULL;
     }
-    gcry_error_handle = gcry_cipher_encrypt(gcry_cipher_hd, out, msg_length, msg, msg_length);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_encrypt failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
+    memcpy(out, msg, msg_length);
+    msg_length = padded_length;
+
+    uint64_t start = dawn_stats_now_us();
+    err = gcry_cipher_encrypt(ctx->ecb[0], out, msg_length, NULL, 0);
+    dawn_histogram_add_since(&dawn_stats.encrypt, start);
+    if (err) {
+        dawn_log_error("gcry_cipher_encrypt failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+        free(out);
         return NULL;
     }
     *out_length = msg_length;
@@ -81,31 +229,120 @@ char *gcrypt_encrypt_msg(char *msg, size_t msg_length, int *out_length) {
 }
 
 // free out buffer after using!
-char *gcrypt_decrypt_msg(char *msg, size_t msg_length) {
-    if (0U != (msg_length & 0xfU))
-        msg_length += 0x10U - (msg_length & 0xfU);
+char *gcrypt_decrypt_buf(char *msg, size_t msg_length, int *out_length) {
+    struct crypto_thread_s *ctx = crypto_thread_get();
+    gcry_error_t err;
+
+    if (!ctx || !ctx->valid[0]) {
+        dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_ERROR, "gcry_cipher_decrypt error: no key\n");
+        return NULL;
+    }
+
+    size_t padded_length = msg_length;
+    if (0U != (padded_length & 0xfU))
+        padded_length += 0x10U - (padded_length & 0xfU);
 
-    char *out_buffer = malloc(msg_length);
+    char *out_buffer = calloc(1, padded_length);
     if (!out_buffer){
-        fprintf(stderr, "gcry_cipher_decrypt error: not enought memory\n");
+        dawn_log_error("gcry_cipher_decrypt error: not enought memory\n");
         return NULL;
     }
-    gcry_error_handle = gcry_cipher_decrypt(gcry_cipher_hd, out_buffer, msg_length, msg, msg_length);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_decrypt failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
+    memcpy(out_buffer, msg, msg_length);
+    msg_length = padded_length;
+
+    uint64_t start = dawn_stats_now_us();
+    err = gcry_cipher_decrypt(ctx->ecb[0], out_buffer, msg_length, NULL, 0);
+    dawn_histogram_add_since(&dawn_stats.decrypt, start);
+    if (err) {
+        dawn_log_error("gcry_cipher_decrypt failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
         free(out_buffer);
         return NULL;
     }
-    char *out = malloc(strlen(out_buffer) + 1);
+    *out_length = msg_length;
+    return out_buffer;
+}
+
+// free out buffer after using!
+char *gcrypt_decrypt_msg(char *msg, size_t msg_length) {
+    int out_length;
+    char *out_buffer = gcrypt_decrypt_buf(msg, msg_length, &out_length);
+    if (!out_buffer)
+        return NULL;
+
+    char *out = strndup(out_buffer, out_length);
+    free(out_buffer);
     if (!out){
-        free(out_buffer);
-        fprintf(stderr, "gcry_cipher_decrypt error: not enought memory\n");
+        dawn_log_error("gcry_cipher_decrypt error: not enought memory\n");
         return NULL;
     }
-    strcpy(out, out_buffer);
-    free(out_buffer);
     return out;
 }
 
+int gcrypt_aead_seal(char *buf, size_t msg_length) {
+    struct crypto_thread_s *ctx = crypto_thread_get();
+    unsigned char *nonce = (unsigned char *) buf;
+    unsigned char *data = nonce + GCRYPT_AEAD_NONCE_LEN;
+    gcry_error_t err;
+
+    if (!ctx || !ctx->valid[0]) {
+        dawn_log_error("gcry_cipher_encrypt error: no key\n");
+        return -1;
+    }
+
+    nonce[0] = ctx->id[0];
+
+    pthread_mutex_lock(&aead_nonce_mutex);
+    if (aead_nonce_counter == 0)
+        gcry_create_nonce(aead_nonce_random, sizeof(aead_nonce_random));
+    memcpy(nonce + 1, aead_nonce_random, AEAD_NONCE_RANDOM_LEN);
+    uint32_t counter = aead_nonce_counter++;
+    pthread_mutex_unlock(&aead_nonce_mutex);
+
+    for (int i = 0; i < AEAD_NONCE_COUNTER_LEN; i++)
+        nonce[1 + AEAD_NONCE_RANDOM_LEN + i] = counter >> (8 * i);
+
+    uint64_t start = dawn_stats_now_us();
+    err = gcry_cipher_setiv(ctx->aead[0], nonce, GCRYPT_AEAD_NONCE_LEN);
+    if (!err)
+        err = gcry_cipher_encrypt(ctx->aead[0], data, msg_length, NULL, 0);
+    if (!err)
+        err = gcry_cipher_gettag(ctx->aead[0], data + msg_length, GCRYPT_AEAD_TAG_LEN);
+    dawn_histogram_add_since(&dawn_stats.encrypt, start);
+    if (err) {
+        dawn_log_error("gcry_cipher_encrypt failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+int gcrypt_aead_open(char *buf, size_t length) {
+    struct crypto_thread_s *ctx = crypto_thread_get();
+    unsigned char *nonce = (unsigned char *) buf;
+    unsigned char *data = nonce + GCRYPT_AEAD_NONCE_LEN;
+    gcry_error_t err;
+    int slot;
+
+    if (!ctx || length < GCRYPT_AEAD_OVERHEAD)
+        return -1;
+
+    for (slot = 0; slot < CRYPTO_KEY_SLOTS; slot++) {
+        if (ctx->valid[slot] && ctx->id[slot] == nonce[0])
+            break;
+    }
+    // anybody on the network can send these, the callers report the drop rate limited
+    if (slot == CRYPTO_KEY_SLOTS)
+        return -1;
+
+    size_t msg_length = length - GCRYPT_AEAD_OVERHEAD;
+
+    uint64_t start = dawn_stats_now_us();
+    err = gcry_cipher_setiv(ctx->aead[slot], nonce, GCRYPT_AEAD_NONCE_LEN);
+    if (!err)
+        err = gcry_cipher_decrypt(ctx->aead[slot], data, msg_length, NULL, 0);
+    if (!err)
+        err = gcry_cipher_checktag(ctx->aead[slot], data + msg_length, GCRYPT_AEAD_TAG_LEN);
+    dawn_histogram_add_since(&dawn_stats.decrypt, start);
+    if (err)
+        return -1;
+    return msg_length;
+}
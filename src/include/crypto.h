@@ -3,6 +3,17 @@
 
 #include <stddef.h>
 
+// Values of network_config.use_symm_enc
+#define CRYPTO_MODE_NONE 0
+#define CRYPTO_MODE_ECB 1 // AES-128-ECB, base64 encoded on UDP
+#define CRYPTO_MODE_AEAD 2 // AES-256-GCM, binary on UDP and TCP
+
+// An AEAD message is the nonce, the ciphertext and the tag.
+// The first byte of the nonce is the id of the key the message was sealed with.
+#define GCRYPT_AEAD_NONCE_LEN 12
+#define GCRYPT_AEAD_TAG_LEN 16
+#define GCRYPT_AEAD_OVERHEAD (GCRYPT_AEAD_NONCE_LEN + GCRYPT_AEAD_TAG_LEN)
+
 /**
  * Initialize gcrypt.
  * Has to be called before using the other functions!
@@ -11,13 +22,32 @@ void gcrypt_init();
 
 /**
  * Set the Key and the iv.
+ * The key of the AEAD mode is derived from the same shared key.
+ * Same as gcrypt_set_keys() with key id 0 and no second key.
  * @param key
  * @param iv
  */
 void gcrypt_set_key_and_iv(const char *key, const char *iv);
 
+/**
+ * Replace the active keys, may be called at any time from any thread.
+ * Messages are encrypted with key, AEAD messages sealed with either key are
+ * accepted. To rekey the mesh, first give every AP the new key as next_key,
+ * then make it the key on every AP and keep the old one as next_key until
+ * all of them switched. The ECB mode has no key id and only uses key.
+ * @param key_id - 0 to 255, a negative id selects 0.
+ * @param key
+ * @param iv
+ * @param next_key_id - 0 to 255, a negative id disables the second key.
+ * @param next_key - may be NULL.
+ * @return 0 on success, -1 on invalid key ids.
+ */
+int gcrypt_set_keys(int key_id, const char *key, const char *iv, int next_key_id, const char *next_key);
+
 /**
  * Function that encrypts the message.
+ * Each thread uses cipher handles of its own, so the crypto functions may be
+ * called from several threads at once.
  * Free the string after using it!
  * @param msg
  * @param msg_length
@@ -26,6 +56,18 @@ void gcrypt_set_key_and_iv(const char *key, const char *iv);
  */
 char *gcrypt_encrypt_msg(char *msg, size_t msg_length, int *out_length);
 
+/**
+ * Function that decrypts a binary message.
+ * Unlike gcrypt_decrypt_msg() the plaintext is returned as is, including
+ * embedded NUL bytes and the block padding.
+ * Free the buffer after using it!
+ * @param msg
+ * @param msg_length
+ * @param out_length - gets the length of the decrypted buffer.
+ * @return the decrypted buffer.
+ */
+char *gcrypt_decrypt_buf(char *msg, size_t msg_length, int *out_length);
+
 /**
  * FUnction that decrypts a message.
  * Free the string after using it!
@@ -35,4 +77,25 @@ char *gcrypt_encrypt_msg(char *msg, size_t msg_length, int *out_length);
  */
 char *gcrypt_decrypt_msg(char *msg, size_t msg_length);
 
+/**
+ * Encrypt and authenticate a message in place.
+ * The buffer holds GCRYPT_AEAD_NONCE_LEN bytes of room for the nonce, the
+ * plaintext and GCRYPT_AEAD_TAG_LEN bytes of room for the tag. Each call
+ * uses a fresh nonce.
+ * @param buf
+ * @param msg_length - length of the plaintext.
+ * @return 0 on success, -1 on error.
+ */
+int gcrypt_aead_seal(char *buf, size_t msg_length);
+
+/**
+ * Verify and decrypt a message sealed by gcrypt_aead_seal() in place.
+ * On success the plaintext starts at buf + GCRYPT_AEAD_NONCE_LEN.
+ * Failures are not logged, anybody on the network can cause them.
+ * @param buf
+ * @param length - length of the whole message, including nonce and tag.
+ * @return length of the plaintext, -1 if the message is corrupt or forged.
+ */
+int gcrypt_aead_open(char *buf, size_t length);
+
 #endif //DAWN_CRYPTO_H
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <time.h>
 #include <limits.h>
+#include <libubox/list.h>
 
 #include "mac_utils.h"
 #include "utils.h"
@@ -74,6 +75,8 @@ struct time_config_s {
     time_t denied_req_threshold;
     time_t update_chan_util;
     time_t update_beacon_reports;
+    time_t probe_batch_window; // ms to collect probe updates before sending, <= 0 sends each at once
+    time_t full_sync_interval; // send only client changes in between full dumps, <= 0 always sends full dumps
 };
 
 #define MAX_IP_LENGTH 46
@@ -86,14 +89,38 @@ struct network_config_s {
     int network_option;
     char shared_key[MAX_KEY_LENGTH];
     char iv[MAX_KEY_LENGTH];
+    int key_id;
+    char next_shared_key[MAX_KEY_LENGTH]; // also accepted while the mesh is rekeyed
+    int next_key_id;
     int use_symm_enc;
     int collision_domain;
     int bandwidth;
 };
 
+// Soft limits for the number of entries in each table.  When a table is full the least
+// recently updated entry is evicted.  -1 selects the built in default, 0 means unlimited.
+struct storage_config_s {
+    int probe_limit;
+    int client_limit;
+    int ap_limit;
+    int denied_req_limit;
+};
+
 extern struct network_config_s network_config;
 extern struct time_config_s timeout_config;
 extern struct probe_metric_s dawn_metric;
+extern struct storage_config_s storage_config;
+
+// Bump whenever dawn_metric or network_config change, so cached probe scores are recalculated
+extern uint32_t dawn_metric_generation;
+
+/**
+ * Effective soft limit of a table.
+ * @param limit - from storage_config.
+ * @param default_limit - the table's built in default.
+ * @return the limit, 0 if the table is unlimited.
+ */
+int storage_limit(int limit, int default_limit);
 
 /*** Core DAWN data structures for tracking network devices and status ***/
 // Define this to remove printing / reporing of fields, and hence observe
@@ -107,6 +134,13 @@ extern struct probe_metric_s dawn_metric;
 /* Probe, Auth, Assoc */
 
 // ---------------- Structs ----------------
+// Last result of eval_probe_metric(), valid while both generations still match
+struct probe_score_s {
+    int score;
+    uint32_t metric_generation; // dawn_metric_generation, 0 if not calculated yet
+    uint32_t ap_generation; // generation of the AP entry, 0 if there was none
+};
+
 typedef struct probe_entry_s {
     uint8_t bssid_addr[ETH_ALEN];
     uint8_t client_addr[ETH_ALEN];
@@ -124,8 +158,23 @@ typedef struct probe_entry_s {
 #endif
     uint32_t rcpi;
     uint32_t rsni;
+    struct probe_score_s score_cache; // eval_probe_metric()
+    struct probe_entry_s* next_hash; // probe table bucket chain
+    struct list_head lru; // probe_lru_list, ordered by time
+    struct probe_entry_s* next_client_probe; // next BSSID heard by the same client, see probe_client
 } probe_entry;
 
+// Secondary index of the probe table: all probe entries of one client, ordered by sort_string
+typedef struct probe_client_s {
+    struct list_head list; // probe_client_list
+    struct probe_client_s* next_hash;
+    uint8_t client_addr[ETH_ALEN];
+    struct probe_entry_s* probes;
+    struct probe_entry_s* best; // highest scoring probe with a known AP, see better_ap_available()
+    int best_count; // number of probes with a known AP sharing the best score
+    struct probe_score_s best_score; // generations the best candidate was chosen with
+} probe_client;
+
 typedef struct auth_entry_s {
     uint8_t bssid_addr[ETH_ALEN];
     uint8_t client_addr[ETH_ALEN];
@@ -144,19 +193,23 @@ typedef struct hostapd_notify_entry_s {
 typedef struct auth_entry_s assoc_entry;
 
 // ---------------- Defines ----------------
-#define DENY_REQ_ARRAY_LEN 100
-#define PROBE_ARRAY_LEN 1000
+// Default soft limits, see struct storage_config_s
+#define DENY_REQ_ARRAY_LEN 1000
+#define PROBE_ARRAY_LEN 10000
+#define PROBE_HASH_SIZE 256 // Initial size, needs to be a power of two
+#define PROBE_CLIENT_HASH_SIZE 64 // Initial size, needs to be a power of two
 
 #define SSID_MAX_LEN 32
 #define NEIGHBOR_REPORT_LEN 200
 
 // ---------------- Global variables ----------------
-extern struct auth_entry_s denied_req_array[];
+extern struct auth_entry_s* denied_req_array;
 extern int denied_req_last;
 extern pthread_mutex_t denied_array_mutex;
 
-extern struct probe_entry_s probe_array[];
-extern int probe_entry_last;
+extern struct list_head probe_client_list;
+extern struct list_head probe_lru_list;
+extern int probe_entry_count;
 extern pthread_mutex_t probe_array_mutex;
 
 // ---------------- Functions ----------------
@@ -164,22 +217,63 @@ probe_entry insert_to_array(probe_entry entry, int inc_counter, int save_80211k,
 
 void probe_array_insert(probe_entry entry);
 
-probe_entry probe_array_delete(probe_entry entry);
-
-probe_entry probe_array_get_entry(uint8_t bssid_addr[], uint8_t client_addr[]);
-
-void remove_old_probe_entries(time_t current_time, long long int threshold);
+/**
+ * Remove a probe entry.  Caller must hold probe_array_mutex.
+ * @param entry - only the BSSID and client address are used to find the entry.
+ * @return 1 if an entry was removed, else 0.
+ */
+int probe_array_delete(const probe_entry* entry);
+
+/**
+ * Find a probe entry.  Caller must hold probe_array_mutex.
+ * @param bssid_addr
+ * @param client_addr
+ * @return the stored entry or NULL.  It stays valid until the mutex is released.
+ */
+probe_entry* probe_array_get_entry(const uint8_t bssid_addr[], const uint8_t client_addr[]);
+
+/**
+ * Find all probe entries of a client.  Caller must hold probe_array_mutex.
+ * @param client_addr
+ * @return the client's entry in the secondary index or NULL.
+ */
+probe_client* probe_array_get_client(const uint8_t client_addr[]);
+
+/**
+ * Remove all probe entries older than threshold that do not belong to a connected client.
+ * @param current_time
+ * @param threshold
+ * @return number of removed entries.
+ */
+int remove_old_probe_entries(time_t current_time, long long int threshold);
 
 void print_probe_array();
 
-void print_probe_entry(probe_entry entry);
+void print_probe_entry(const probe_entry* entry);
 
-int eval_probe_metric(struct probe_entry_s probe_entry);
+/**
+ * Score how well an AP suits a client.  The score is cached in the probe entry and only
+ * recalculated once the probe, its AP or the metric changed.
+ * Caller must hold probe_array_mutex, the AP is taken from the current snapshot.
+ * @param probe_entry
+ * @return the score.
+ */
+int eval_probe_metric(probe_entry* probe_entry);
 
 void denied_req_array_insert(auth_entry entry);
 
 auth_entry denied_req_array_delete(auth_entry entry);
 
+/**
+ * Remove all denied requests older than threshold in one pass, the others keep their order.
+ * Caller must hold denied_array_mutex.
+ * @param current_time
+ * @param threshold
+ * @param expired - called for each entry before it is removed, may be NULL.
+ * @return number of removed entries.
+ */
+int remove_old_denied_req_entries(time_t current_time, long long int threshold, void (*expired)(const auth_entry* entry));
+
 auth_entry insert_to_denied_req_array(auth_entry entry, int inc_counter);
 
 void print_auth_entry(auth_entry entry);
@@ -191,6 +285,11 @@ void print_auth_entry(auth_entry entry);
 
 // ---------------- Structs ----------------
 typedef struct client_s {
+    struct list_head list; // client_entry_list, ordered by time
+    struct list_head bssid_list; // client_bssid.clients
+    struct client_bssid_s* bssid; // group of bssid_addr
+    struct client_s* next_hash; // client table bucket chain, keyed by BSSID and client address
+    struct client_s* next_client_hash; // bucket chain keyed by client address only
     uint8_t bssid_addr[ETH_ALEN];
     uint8_t client_addr[ETH_ALEN];
     char signature[SIGNATURE_LEN]; // TODO: Never evaluated?
@@ -213,7 +312,17 @@ typedef struct client_s {
     uint8_t rrm_enabled_capa; //the first byte is enough
 } client;
 
+// Secondary index of the client table: all client entries associated with one BSSID
+typedef struct client_bssid_s {
+    struct client_bssid_s* next_hash;
+    uint8_t bssid_addr[ETH_ALEN];
+    struct list_head clients; // client.bssid_list, in order of insertion
+    int client_count;
+} client_bssid;
+
 typedef struct ap_s {
+    struct list_head list;
+    struct list_head expiry; // ap_expiry_list, ordered by time
     uint8_t bssid_addr[ETH_ALEN];
     uint32_t freq; // TODO: Never evaluated?
     uint8_t ht_support; // eval_probe_metric()
@@ -228,24 +337,38 @@ typedef struct ap_s {
     uint32_t ap_weight; // eval_probe_metric()
     char iface[MAX_INTERFACE_NAME];
     char hostname[HOST_NAME_MAX];
+    uint32_t generation; // changes with the SSID and the fields used by eval_probe_metric()
+    uint32_t sync_seq; // sequence number of the last client update from this AP's owner
 } ap;
 
+// Immutable copy of the AP table for readers that do not hold ap_array_mutex, ordered by BSSID.
+// The list heads in the copied entries are not valid.  It is only replaced when an AP is added
+// or removed or one of the fields the readers use changes, the time and sync_seq may be stale.
+typedef struct ap_snapshot_s {
+    int refs; // readers plus one while it is the published version
+    uint32_t generation; // changes whenever an AP is added, removed or changes its generation
+    int count;
+    ap entries[];
+} ap_snapshot;
+
 // ---------------- Defines ----------------
-#define ARRAY_AP_LEN 50
+#define ARRAY_AP_LEN 250
 #define TIME_THRESHOLD_AP 30
 
-#define ARRAY_CLIENT_LEN 1000
+#define ARRAY_CLIENT_LEN 2000
+#define CLIENT_HASH_SIZE 64 // Initial size, needs to be a power of two
+#define CLIENT_BSSID_HASH_SIZE 64 // needs to be a power of two
 #define TIME_THRESHOLD_CLIENT 30
 #define TIME_THRESHOLD_CLIENT_UPDATE 10
 #define TIME_THRESHOLD_CLIENT_KICK 60
 
 // ---------------- Global variables ----------------
-extern struct ap_s ap_array[];
-extern int ap_entry_last;
+extern struct list_head ap_entry_list;
+extern int ap_entry_count;
 extern pthread_mutex_t ap_array_mutex;
 
-extern struct client_s client_array[];
-extern int client_entry_last;
+extern struct list_head client_entry_list;
+extern int client_entry_count;
 extern pthread_mutex_t client_array_mutex;
 
 // ---------------- Functions ----------------
@@ -254,40 +377,128 @@ int probe_array_update_rssi(uint8_t bssid_addr[], uint8_t client_addr[], uint32_
 
 int probe_array_update_rcpi_rsni(uint8_t bssid_addr[], uint8_t client_addr[], uint32_t rcpi, uint32_t rsni, int send_network);
 
-void remove_old_client_entries(time_t current_time, long long int threshold);
+/**
+ * Remove all client entries older than threshold.  Caller must hold client_array_mutex.
+ * @param current_time
+ * @param threshold
+ * @return number of removed entries.
+ */
+int remove_old_client_entries(time_t current_time, long long int threshold);
 
-void insert_client_to_array(client entry);
+void insert_client_to_array(const client* entry);
 
 int kick_clients(uint8_t bssid[], uint32_t id);
 
 void update_iw_info(uint8_t bssid[]);
 
-void client_array_insert(client entry);
-
-client client_array_get_client(const uint8_t* client_addr);
-
-client client_array_delete(client entry);
+/**
+ * Store a copy of a client entry.  Caller must hold client_array_mutex.
+ * @param entry
+ * @return the stored entry or NULL if it was dropped.
+ */
+client* client_array_insert(const client* entry);
+
+/**
+ * Find the client entry of a BSSID and client address.  Caller must hold client_array_mutex.
+ * @param bssid_addr
+ * @param client_addr
+ * @return the stored entry or NULL.  It stays valid until the mutex is released.
+ */
+client* client_array_find(const uint8_t bssid_addr[], const uint8_t client_addr[]);
+
+/**
+ * Find a client entry for a client address.  Caller must hold client_array_mutex.
+ * @param client_addr
+ * @return the stored entry or NULL.  It stays valid until the mutex is released.
+ */
+client* client_array_get_client(const uint8_t* client_addr);
+
+/**
+ * Find all client entries of a BSSID.  Caller must hold client_array_mutex.
+ * @param bssid_addr
+ * @return the BSSID's entry in the secondary index or NULL.  It may have no clients left.
+ */
+client_bssid* client_array_get_bssid(const uint8_t bssid_addr[]);
+
+/**
+ * Remove a client entry.  Caller must hold client_array_mutex.
+ * @param entry - only the BSSID and client address are used to find the entry.
+ * @return 1 if an entry was removed, else 0.
+ */
+int client_array_delete(const client* entry);
+
+/**
+ * Mark all client entries of a BSSID as seen at the given time.
+ * A delta update only names the clients that changed, the others are still there.
+ * Caller must hold client_array_mutex.
+ * @param bssid_addr
+ * @param time
+ * @return number of refreshed entries.
+ */
+int client_array_touch_bssid(const uint8_t bssid_addr[], time_t time);
+
+/**
+ * Remove the client entries of a BSSID that were not seen since the given time.
+ * Used after a full resync to drop clients whose removal was missed.
+ * Caller must hold client_array_mutex.
+ * @param bssid_addr
+ * @param time
+ * @return number of removed entries.
+ */
+int client_array_remove_stale_bssid(const uint8_t bssid_addr[], time_t time);
 
 void print_client_array();
 
-void print_client_entry(client entry);
+void print_client_entry(const client* entry);
 
 int is_connected_somehwere(uint8_t client_addr[]);
 
-ap insert_to_ap_array(ap entry);
+void insert_to_ap_array(const ap* entry);
 
-void remove_old_ap_entries(time_t current_time, long long int threshold);
+/**
+ * Remove all AP entries older than threshold.  Caller must hold ap_array_mutex.
+ * @param current_time
+ * @param threshold
+ * @return number of removed entries.
+ */
+int remove_old_ap_entries(time_t current_time, long long int threshold);
 
 void print_ap_array();
 
-ap ap_array_get_ap(uint8_t bssid_addr[]);
+/**
+ * Find an AP entry.  Caller must hold ap_array_mutex.
+ * @param bssid_addr
+ * @return the stored entry or NULL.  It stays valid until the mutex is released.
+ */
+ap* ap_array_get_ap(const uint8_t bssid_addr[]);
 
 int probe_array_set_all_probe_count(uint8_t client_addr[], uint32_t probe_count);
 
 #ifndef DAWN_NO_OUTPUT
+// Caller must hold ap_array_mutex
 int ap_get_collision_count(int col_domain);
 #endif
 
+/**
+ * Take a reference to the current AP snapshot.  Does not block, even while the AP table is updated.
+ * @return the snapshot, release it with ap_snapshot_put().
+ */
+const ap_snapshot* ap_snapshot_get();
+
+/**
+ * Release a snapshot taken with ap_snapshot_get().
+ * @param snapshot
+ */
+void ap_snapshot_put(const ap_snapshot* snapshot);
+
+/**
+ * Find an AP in a snapshot.
+ * @param snapshot
+ * @param bssid_addr
+ * @return the entry or NULL.  It stays valid until the snapshot is released.
+ */
+const ap* ap_snapshot_get_ap(const ap_snapshot* snapshot, const uint8_t bssid_addr[]);
+
 void send_beacon_reports(uint8_t bssid[], int id);
 
 /* Utils */
@@ -295,6 +506,7 @@ void send_beacon_reports(uint8_t bssid[], int id);
 extern char sort_string[];
 
 // ---------------- Functions -------------------
+// Caller must hold probe_array_mutex
 int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neighbor_report, int automatic_kick);
 
 // All users of datastorage should call init_ / destroy_mutex at initialisation and termination respectively
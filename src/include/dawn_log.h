@@ -0,0 +1,102 @@
+#ifndef DAWN_LOG_H
+#define DAWN_LOG_H
+
+#include <time.h>
+
+// A message is written if its level is at most the level set for its category
+#define DAWN_LOG_ERROR 0
+#define DAWN_LOG_WARN 1
+#define DAWN_LOG_INFO 2
+#define DAWN_LOG_DEBUG 3
+
+// Messages above this level are compiled out, e.g. -DDAWN_LOG_MAX_LEVEL=DAWN_LOG_INFO
+#ifndef DAWN_LOG_MAX_LEVEL
+#define DAWN_LOG_MAX_LEVEL DAWN_LOG_DEBUG
+#endif
+
+// Level of categories that are not configured
+#define DAWN_LOG_DEFAULT_LEVEL DAWN_LOG_INFO
+
+// Rate limited call sites write at most DAWN_LOG_BURST messages per DAWN_LOG_INTERVAL seconds
+#define DAWN_LOG_BURST 10
+#define DAWN_LOG_INTERVAL 5
+
+enum dawn_log_category {
+    DAWN_LOG_STORAGE,
+    DAWN_LOG_UBUS,
+    DAWN_LOG_MSG,
+    DAWN_LOG_NETWORK,
+    __DAWN_LOG_CATEGORY_MAX
+};
+
+extern int dawn_log_level[__DAWN_LOG_CATEGORY_MAX];
+
+struct dawn_log_ratelimit {
+    time_t window_start;
+    int count;
+    int suppressed;
+};
+
+#define dawn_log_enabled(category, level) \
+    ((level) <= DAWN_LOG_MAX_LEVEL && (level) <= dawn_log_level[category])
+
+// The arguments are only evaluated if the message is written
+#define dawn_log(category, level, ...) do { \
+        if (dawn_log_enabled(category, level)) \
+            dawn_log_write(category, level, __VA_ARGS__); \
+    } while (0)
+
+#define dawn_log_ratelimited(category, level, ...) do { \
+        static struct dawn_log_ratelimit _dawn_log_rl; \
+        if (dawn_log_enabled(category, level) && dawn_log_ratelimit_pass(&_dawn_log_rl, category, level)) \
+            dawn_log_write(category, level, __VA_ARGS__); \
+    } while (0)
+
+// Shorthands for files that define DAWN_LOG_CATEGORY
+#define dawn_log_error(...) dawn_log(DAWN_LOG_CATEGORY, DAWN_LOG_ERROR, __VA_ARGS__)
+#define dawn_log_warn(...) dawn_log(DAWN_LOG_CATEGORY, DAWN_LOG_WARN, __VA_ARGS__)
+#define dawn_log_info(...) dawn_log(DAWN_LOG_CATEGORY, DAWN_LOG_INFO, __VA_ARGS__)
+#define dawn_log_debug(...) dawn_log(DAWN_LOG_CATEGORY, DAWN_LOG_DEBUG, __VA_ARGS__)
+#define dawn_log_debug_enabled() dawn_log_enabled(DAWN_LOG_CATEGORY, DAWN_LOG_DEBUG)
+
+/**
+ * Write a log message, use the dawn_log() macros instead.
+ * Errors and warnings go to stderr, the rest to stdout.
+ * @param category
+ * @param level
+ * @param format
+ */
+void dawn_log_write(int category, int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * Account a message of a rate limited call site.
+ * Reports how many messages were suppressed once the call site may write again.
+ * @param rl
+ * @param category
+ * @param level
+ * @return 1 if the message may be written.
+ */
+int dawn_log_ratelimit_pass(struct dawn_log_ratelimit *rl, int category, int level);
+
+/**
+ * Set the level of a category.
+ * @param category - category, or -1 for all of them.
+ * @param level
+ */
+void dawn_log_set_level(int category, int level);
+
+/**
+ * Parse a level given as name ("error", "warn", "info", "debug") or number.
+ * @param name
+ * @return the level, -1 if it is not valid.
+ */
+int dawn_log_parse_level(const char *name);
+
+/**
+ * Look up a category by its name ("storage", "ubus", "msg", "network").
+ * @param name
+ * @return the category, -1 if there is none.
+ */
+int dawn_log_parse_category(const char *name);
+
+#endif //DAWN_LOG_H
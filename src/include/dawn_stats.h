@@ -0,0 +1,211 @@
+#ifndef DAWN_STATS_H
+#define DAWN_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Latencies in microseconds are counted in HDR style buckets: every power of two range
+// is split into DAWN_HISTOGRAM_SUB_BUCKETS equal buckets, so a bucket is at most 1/8
+// of its values wide.  Values below 2^DAWN_HISTOGRAM_MAX_BITS (about 4 seconds) have
+// their own bucket, the last one also holds everything above.
+#define DAWN_HISTOGRAM_SUB_BITS 3
+#define DAWN_HISTOGRAM_SUB_BUCKETS (1 << DAWN_HISTOGRAM_SUB_BITS)
+#define DAWN_HISTOGRAM_MAX_BITS 22
+#define DAWN_HISTOGRAM_BUCKETS ((DAWN_HISTOGRAM_MAX_BITS - DAWN_HISTOGRAM_SUB_BITS + 1) * DAWN_HISTOGRAM_SUB_BUCKETS)
+
+// hostapd holds the request until hostapd_notify() returns, slower answers are counted
+#define DAWN_NOTIFY_BUDGET_US 1000
+
+// Event rates are averaged over windows of this many seconds
+#define DAWN_STATS_RATE_INTERVAL 10
+
+struct dawn_histogram {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[DAWN_HISTOGRAM_BUCKETS];
+};
+
+struct dawn_rate {
+    uint64_t total;
+    time_t window_start;
+    uint32_t window_count; // events in the current window
+    uint32_t last_count; // events in the last complete window
+};
+
+enum dawn_stats_event {
+    DAWN_STATS_EVENT_PROBE,
+    DAWN_STATS_EVENT_AUTH,
+    DAWN_STATS_EVENT_ASSOC,
+    __DAWN_STATS_EVENT_MAX
+};
+
+enum dawn_stats_table {
+    DAWN_STATS_TABLE_PROBE,
+    DAWN_STATS_TABLE_CLIENT,
+    DAWN_STATS_TABLE_AP,
+    DAWN_STATS_TABLE_DENIED_REQ,
+    __DAWN_STATS_TABLE_MAX
+};
+
+// Methods hostapd notifies us about
+enum dawn_stats_notify {
+    DAWN_STATS_NOTIFY_PROBE,
+    DAWN_STATS_NOTIFY_AUTH,
+    DAWN_STATS_NOTIFY_ASSOC,
+    DAWN_STATS_NOTIFY_DEAUTH,
+    DAWN_STATS_NOTIFY_BEACON_REPORT,
+    __DAWN_STATS_NOTIFY_MAX
+};
+
+// Methods of the messages exchanged with the other nodes
+enum dawn_stats_msg {
+    DAWN_STATS_MSG_PROBE,
+    DAWN_STATS_MSG_BATCH_PROBE,
+    DAWN_STATS_MSG_CLIENTS,
+    DAWN_STATS_MSG_DELTA_CLIENTS,
+    DAWN_STATS_MSG_DEAUTH,
+    DAWN_STATS_MSG_SETPROBE,
+    DAWN_STATS_MSG_ADDMAC,
+    DAWN_STATS_MSG_MACFILE,
+    DAWN_STATS_MSG_UCI,
+    DAWN_STATS_MSG_BEACON_REPORT,
+    DAWN_STATS_MSG_UNKNOWN, // also messages that could not be decrypted or parsed
+    __DAWN_STATS_MSG_MAX
+};
+
+struct dawn_msg_stats {
+    uint64_t sent; // once per message, no matter to how many peers
+    uint64_t received;
+    uint64_t dropped; // received but not handled, or not delivered to a peer
+};
+
+// Only updated on the uloop thread, so plain 64 bit counters are fine.  Atomics on
+// them would need libatomic on 32 bit targets.
+struct dawn_stats_s {
+    time_t start;
+
+    struct dawn_rate events[__DAWN_STATS_EVENT_MAX];
+    uint64_t denied[__DAWN_STATS_EVENT_MAX];
+    struct dawn_histogram decision; // decide_function()
+
+    struct dawn_histogram notify[__DAWN_STATS_NOTIFY_MAX]; // hostapd_notify(), entry to return
+    uint64_t notify_over_budget[__DAWN_STATS_NOTIFY_MAX];
+
+    uint64_t evictions[__DAWN_STATS_TABLE_MAX]; // entries dropped because the table was full
+    uint64_t expired[__DAWN_STATS_TABLE_MAX]; // entries removed by the periodic sweeps
+    struct dawn_histogram sweep[__DAWN_STATS_TABLE_MAX];
+
+    struct dawn_msg_stats msgs[__DAWN_STATS_MSG_MAX];
+
+    struct dawn_histogram encrypt;
+    struct dawn_histogram decrypt;
+};
+
+extern struct dawn_stats_s dawn_stats;
+
+/**
+ * Reset all statistics.
+ */
+void dawn_stats_init();
+
+/**
+ * Microseconds of the monotonic clock, for measuring durations.
+ * @return
+ */
+uint64_t dawn_stats_now_us();
+
+/**
+ * Add a latency sample.
+ * @param h
+ * @param us
+ */
+void dawn_histogram_add(struct dawn_histogram *h, uint64_t us);
+
+/**
+ * Add the time since start to a histogram.
+ * @param h
+ * @param start - from dawn_stats_now_us().
+ */
+void dawn_histogram_add_since(struct dawn_histogram *h, uint64_t start);
+
+/**
+ * Upper bound of a histogram bucket.
+ * @param bucket
+ * @return the bound in microseconds, 0 for the last bucket, which has none.
+ */
+uint64_t dawn_histogram_bucket_limit(int bucket);
+
+/**
+ * Estimate a percentile of a histogram.
+ * @param h
+ * @param percentile - 0 to 100.
+ * @return the highest value of the bucket the percentile falls into, at most the maximum.
+ */
+uint64_t dawn_histogram_percentile(const struct dawn_histogram *h, double percentile);
+
+/**
+ * Write a histogram as percentile distribution in the text format of HdrHistogram.
+ * @param f
+ * @param name - written as comment before the distribution.
+ * @param h
+ */
+void dawn_histogram_write(FILE *f, const char *name, const struct dawn_histogram *h);
+
+/**
+ * Account the time hostapd waited for an answer.
+ * @param notify
+ * @param start - from dawn_stats_now_us(), taken when the notification came in.
+ */
+void dawn_stats_notify_done(int notify, uint64_t start);
+
+/**
+ * Count an event.
+ * @param r
+ */
+void dawn_rate_inc(struct dawn_rate *r);
+
+/**
+ * Events per second in the last complete window.
+ * @param r
+ * @return
+ */
+double dawn_rate_get(struct dawn_rate *r);
+
+/**
+ * Look up the statistics slot of a network message method.
+ * @param method
+ * @return the slot, DAWN_STATS_MSG_UNKNOWN if the method is not known.
+ */
+int dawn_stats_msg_lookup(const char *method);
+
+/**
+ * Name of a hostapd notification method.
+ * @param notify
+ * @return
+ */
+const char *dawn_stats_notify_name(int notify);
+
+/**
+ * Name of a network message method.
+ * @param msg
+ * @return
+ */
+const char *dawn_stats_msg_name(int msg);
+
+/**
+ * Name of a storage table.
+ * @param table
+ * @return
+ */
+const char *dawn_stats_table_name(int table);
+
+/**
+ * Name of an event.
+ * @param event
+ * @return
+ */
+const char *dawn_stats_event_name(int event);
+
+#endif //DAWN_STATS_H
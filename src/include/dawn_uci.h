@@ -34,6 +34,12 @@ struct time_config_s uci_get_time_config();
  */
 struct network_config_s uci_get_dawn_network();
 
+/**
+ * Function that returns the soft limits of the storage tables.
+ * @return the storage config values.
+ */
+struct storage_config_s uci_get_dawn_storage();
+
 /**
  * Function that returns the hostapd directory reading from the config file.
  * @return the hostapd directory.
@@ -46,6 +52,14 @@ bool uci_get_dawn_hostapd_dir();
  */
 bool uci_get_dawn_sort_order();
 
+/**
+ * Function that sets the log levels from the config file.
+ * "level" sets all categories, an option named after a category overrides it.
+ * Categories that are not configured log at DAWN_LOG_DEFAULT_LEVEL.
+ * @return if a log section was found.
+ */
+bool uci_get_dawn_log();
+
 int uci_set_network(char* uci_cmd);
 
 /**
@@ -40,4 +40,15 @@ int mac_is_equal(const uint8_t addr1[], const uint8_t addr2[]);
 
 int mac_is_greater(const uint8_t addr1[], const uint8_t addr2[]);
 
+#define MAC_HASH_INIT 2166136261u
+
+/**
+ * Hash a mac address (FNV-1a).
+ * Pass MAC_HASH_INIT as hash, or the result of a previous call to combine several addresses into one key.
+ * @param addr
+ * @param hash
+ * @return
+ */
+uint32_t mac_hash(const uint8_t addr[], uint32_t hash);
+
 #endif
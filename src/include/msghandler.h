@@ -22,6 +22,27 @@ int parse_to_probe_req(struct blob_attr* msg, probe_entry* prob_req);
  */
 int parse_to_clients(struct blob_attr* msg, int do_kick, uint32_t id);
 
+/**
+ * Dump the reply of a local hostapd get_clients call into the database.
+ * Unlike parse_to_clients() the AP fields come from the caller, so the reply
+ * can be used as is.
+ * @param msg - get_clients reply.
+ * @param ap_entry - AP of the interface; freq, station_count and time are filled in.
+ * @param do_kick - use the automatic kick function when updating the clients.
+ * @param id - ubus id.
+ * @return
+ */
+int parse_local_clients(struct blob_attr* msg, ap* ap_entry, int do_kick, uint32_t id);
+
+/**
+ * Apply a client delta from a peer.
+ * It carries the AP summary, the clients that were added or changed and the
+ * addresses of the clients that left. The AP's other clients are refreshed.
+ * @param msg - message to parse.
+ * @return
+ */
+int parse_to_clients_delta(struct blob_attr* msg);
+
 /**
  * Parse to hostapd notify.
  * Notify are such notifications like:
@@ -34,12 +55,42 @@ int parse_to_clients(struct blob_attr* msg, int do_kick, uint32_t id);
  */
 int parse_to_hostapd_notify(struct blob_attr* msg, hostapd_notify_entry* notify_req);
 
+// Binary inter-AP messages start with a NUL byte, which can never begin a
+// JSON envelope, followed by "DA" and the wire version. The rest is the raw
+// blob of the {method, data} envelope.
+#define NETWORK_WIRE_MAGIC 0x00
+#define NETWORK_WIRE_VERSION 1
+#define NETWORK_WIRE_HEADER_LEN 4
+
 /**
  * Handle network messages.
+ * Accepts both the binary wire format and the legacy JSON envelope.
  * @param msg
- * @return
+ * @param len - number of valid bytes in msg.
+ * @return the wire version the sender speaks (0 for JSON only) or -1 on error.
+ */
+int handle_network_msg(char* msg, int len);
+
+/**
+ * Build the legacy JSON envelope for a network message.
+ * Free the string after using it!
+ * @param msg - blobmsg table with the payload.
+ * @param method
+ * @return the JSON string or NULL.
+ */
+char* network_msg_format_json(struct blob_attr* msg, const char* method);
+
+/**
+ * Build the binary envelope for a network message.
+ * The buffer is zero padded to the cipher block size.
+ * Free the buffer after using it!
+ * @param msg - blobmsg table with the payload.
+ * @param method
+ * @param len - gets the number of meaningful bytes.
+ * @param padded_len - gets the allocated (padded) length.
+ * @return the buffer or NULL.
  */
-int handle_network_msg(char* msg);
+char* network_msg_format_wire(struct blob_attr* msg, const char* method, int* len, int* padded_len);
 
 
 int handle_deauth_req(struct blob_attr* msg);
@@ -2,6 +2,17 @@
 #define __DAWN_NETWORKSOCKET_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct recv_queue_stats_s {
+    uint64_t received;  // datagrams put into the receive queue
+    uint64_t dropped;   // datagrams dropped because the queue was full or they were too long
+    uint64_t processed; // datagrams handled on the uloop thread
+    unsigned int high_watermark; // most datagrams waiting at once
+};
+
+extern struct recv_queue_stats_s recv_queue_stats;
 
 /**
  * Init a socket using the runopts.
@@ -12,6 +23,12 @@
  */
 int init_socket_runopts(const char *_ip, int _port, int _multicast_socket);
 
+/**
+ * Start handling received messages on the uloop.
+ * Has to be called after uloop_init(), messages are queued until then.
+ */
+void receive_queue_add_uloop();
+
 /**
  * Send message via network.
  * @param msg
@@ -26,6 +43,12 @@ int send_string(char *msg);
  */
 int send_string_enc(char *msg);
 
+/**
+ * Longest message the other APs can receive in one datagram.
+ * @return the length of the longest string send_string() or send_string_enc() can send.
+ */
+size_t send_string_max_len();
+
 /**
  * Close socket.
  */
@@ -0,0 +1,46 @@
+#ifndef __DAWN_SLAB_H
+#define __DAWN_SLAB_H
+
+#include <stddef.h>
+#include <libubox/list.h>
+
+// ---------------- Defines -------------------
+#define SLAB_CHUNK_SIZE 16384 // Needs to be a power of two
+
+#define SLAB_INIT(name, type) { \
+        .entry_size = sizeof(type), \
+        .partial = LIST_HEAD_INIT(name.partial), \
+        .full = LIST_HEAD_INIT(name.full) \
+    }
+
+// ---------------- Structs ----------------
+/*
+ * Fixed size allocator for storage entries.  Entries are carved from aligned chunks and never move
+ * until they are freed, so pointers to them can be handed out as stable handles.
+ */
+struct slab {
+    size_t entry_size;
+    int entries_per_chunk;
+    struct list_head partial; // chunks with free entries
+    struct list_head full;
+    int chunk_count;
+    int entry_count;
+};
+
+// ---------------- Functions ----------------
+
+/**
+ * Allocate an uninitialised entry.
+ * @param s
+ * @return the entry or NULL if out of memory.
+ */
+void* slab_alloc(struct slab* s);
+
+/**
+ * Return an entry to its slab.  Chunks are released once they are empty.
+ * @param s
+ * @param entry
+ */
+void slab_free(struct slab* s, void* entry);
+
+#endif
@@ -1,11 +1,18 @@
 #ifndef DAWN_TCPSOCKET_H
 #define DAWN_TCPSOCKET_H
 
+#include <libubox/blob.h>
 #include <libubox/ustream.h>
 #include <netinet/in.h>
+#include <time.h>
 
 #define ARRAY_NETWORK_LEN 50
 
+// Frames queued per peer, the oldest one is dropped when a slow peer falls further behind
+#define TCP_SEND_QUEUE_LEN 16
+
+struct tcp_frame;
+
 struct network_con_s {
     struct list_head list;
 
@@ -13,10 +20,33 @@ struct network_con_s {
     struct ustream_fd stream;
     struct sockaddr_in sock_addr;
     int connected;
+    int connecting;
+    int wire_version; // highest binary wire version the peer has announced, 0 = JSON only
+
+    // reconnection scheduling, in seconds of the monotonic clock
+    time_t last_seen; // last announced via umdns
+    time_t next_attempt;
+    time_t since; // start of the pending connect or of the established connection
+    int failures; // consecutive, each one doubles the backoff
+
+    uint32_t rtt_us; // smoothed round trip time as reported by the kernel
+    uint32_t connects;
+    uint32_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t bytes_received; // over the peer's connection to us
+
+    // frames not yet handed to the socket, oldest first
+    struct tcp_frame *send_queue[TCP_SEND_QUEUE_LEN];
+    int send_head;
+    int send_count;
+    uint32_t send_dropped;
 };
 
 /**
  * Add tcp connection.
+ * Registers a peer announced via umdns. The connection itself is opened by
+ * the connection manager, which retries failed peers with exponential
+ * backoff and limits the number of concurrent connects.
  * @param ipv4
  * @param port
  * @return
@@ -32,9 +62,25 @@ int run_server(int port);
 
 /**
  * Send message via tcp to all other hosts.
+ * Each peer gets the binary envelope if it announced support for it and the
+ * JSON envelope otherwise. Both are built at most once per call and shared by
+ * the send queues of all peers.
  * @param msg
+ * @param method
+ */
+void send_tcp(struct blob_attr *msg, const char *method);
+
+/**
+ * Number of established connections to other hosts.
+ * @return
+ */
+int tcp_connection_count();
+
+/**
+ * Add the state and traffic of every peer to a blob as array "peers".
+ * @param b
  */
-void send_tcp(char *msg);
+void tcp_add_stats(struct blob_buf *b);
 
 /**
  * Debug message.
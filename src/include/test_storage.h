@@ -7,8 +7,8 @@
 ** Contains declerations, etc needed across datastorage and its test harness,
 ** but not more widely.
 */
-void ap_array_insert(ap entry);
+ap* ap_array_insert(const ap* entry);
 
-ap ap_array_delete(ap entry);
+int ap_array_delete(const ap* entry);
 
 #endif
@@ -85,14 +85,34 @@ int build_hearing_map_sort_client(struct blob_buf* b);
 
 int build_network_overview(struct blob_buf* b);
 
+/**
+ * Build the reply of get_stats: request rates, hostapd notify and decision latency, table
+ * occupancy, network traffic per method and per peer, crypto and sweep times.
+ * @param b
+ * @return
+ */
+int build_stats(struct blob_buf* b);
+
 int ap_get_nr(struct blob_buf* b, uint8_t own_bssid_addr[]);
 
 int parse_add_mac_to_file(struct blob_attr* msg);
 
 int handle_auth_req(struct blob_attr* msg);
 
+struct probe_batch_stats_s {
+    uint64_t queued;    // updates collected while batching is enabled
+    uint64_t coalesced; // updates that replaced a pending one for the same client and AP
+    uint64_t batches;   // "batch-probe" messages sent
+    uint64_t sent;      // probes carried by those messages
+};
+
+extern struct probe_batch_stats_s probe_batch_stats;
+
 /**
  * Send probe message via the network.
+ * If timeout_config.probe_batch_window is set the update is held back for
+ * that many milliseconds, or until the batch is full, and sent together with
+ * the other pending updates. Only the newest update per client and AP is kept.
  * @param probe_entry
  * @return
  */
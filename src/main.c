@@ -11,6 +11,7 @@
 #include "dawn_iwinfo.h"
 #include "tcpsocket.h"
 #include "crypto.h"
+#include "dawn_stats.h"
 
 void daemon_shutdown();
 
@@ -59,19 +60,30 @@ int main(int argc, char **argv) {
     sigaction(SIGTERM, &signal_action, NULL);
     sigaction(SIGINT, &signal_action, NULL);
 
+    dawn_stats_init();
+
     uci_init();
+    uci_get_dawn_log();
+
     // TODO: Why the extra loacl struct to retuen into?
     struct network_config_s net_config = uci_get_dawn_network();
     network_config = net_config;
 
     // init crypto
     gcrypt_init();
-    gcrypt_set_key_and_iv(net_config.shared_key, net_config.iv);
+    if (gcrypt_set_keys(net_config.key_id, net_config.shared_key, net_config.iv,
+                        net_config.next_key_id, net_config.next_shared_key)) {
+        // without a key every message would be dropped
+        uci_clear();
+        exit(EXIT_FAILURE);
+    }
 
     // TODO: Why the extra loacl struct to retuen into?
     struct time_config_s time_config = uci_get_time_config();
     timeout_config = time_config; // TODO: Refactor...
 
+    storage_config = uci_get_dawn_storage();
+
     uci_get_dawn_hostapd_dir();
     uci_get_dawn_sort_order();
 
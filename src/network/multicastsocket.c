@@ -1,8 +1,12 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "multicastsocket.h"
+#include "dawn_log.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_NETWORK
 
 // based on: http://openbook.rheinwerk-verlag.de/linux_unix_programmierung/Kap11-018.htm
 
@@ -18,7 +22,7 @@ int setup_multicast_socket(const char *_multicast_ip, unsigned short _multicast_
     addr->sin_port = htons (_multicast_port);
 
     if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
-        perror("socket()");
+        dawn_log_error("socket(): %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -28,13 +32,13 @@ int setup_multicast_socket(const char *_multicast_ip, unsigned short _multicast_
                    SOL_SOCKET,
                    SO_REUSEADDR,
                    &loop, sizeof(loop)) < 0) {
-        perror("setsockopt:SO_REUSEADDR");
+        dawn_log_error("setsockopt:SO_REUSEADDR: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
     if (bind(sock,
              (struct sockaddr *) addr,
              sizeof(*addr)) < 0) {
-        perror("bind");
+        dawn_log_error("bind: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -44,7 +48,7 @@ int setup_multicast_socket(const char *_multicast_ip, unsigned short _multicast_
                    IPPROTO_IP,
                    IP_MULTICAST_LOOP,
                    &loop, sizeof(loop)) < 0) {
-        perror("setsockopt:IP_MULTICAST_LOOP");
+        dawn_log_error("setsockopt:IP_MULTICAST_LOOP: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -52,14 +56,14 @@ int setup_multicast_socket(const char *_multicast_ip, unsigned short _multicast_
     command.imr_multiaddr.s_addr = inet_addr(_multicast_ip);
     command.imr_interface.s_addr = htonl (INADDR_ANY);
     if (command.imr_multiaddr.s_addr == -1) {
-        perror("Wrong multicast address!\n");
+        dawn_log_error("Wrong multicast address!\n");
         exit(EXIT_FAILURE);
     }
     if (setsockopt(sock,
                    IPPROTO_IP,
                    IP_ADD_MEMBERSHIP,
                    &command, sizeof(command)) < 0) {
-        perror("setsockopt:IP_ADD_MEMBERSHIP");
+        dawn_log_error("setsockopt:IP_ADD_MEMBERSHIP: %s\n", strerror(errno));
     }
     return sock;
 }
@@ -69,7 +73,7 @@ int remove_multicast_socket(int socket) {
                    IPPROTO_IP,
                    IP_DROP_MEMBERSHIP,
                    &command, sizeof(command)) < 0) {
-        perror("setsockopt:IP_DROP_MEMBERSHIP");
+        dawn_log_error("setsockopt:IP_DROP_MEMBERSHIP: %s\n", strerror(errno));
         return -1;
     }
     return 0;
@@ -1,7 +1,14 @@
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <libubox/blobmsg_json.h>
+#include <libubox/uloop.h>
 
 #include "multicastsocket.h"
 #include "broadcastsocket.h"
@@ -9,25 +16,65 @@
 #include "crypto.h"
 #include "datastorage.h"
 #include "networksocket.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_NETWORK
 
 
 /* Network Defines */
 #define MAX_RECV_STRING 2048
+// Datagrams waiting for the uloop thread, a power of two
+#define RECV_QUEUE_LEN 32
+// Most datagrams read or written with one system call
+#define RECV_BATCH_LEN 8
+#define SEND_BATCH_LEN 16
 
 /* Network Attributes */
 static int sock;
 static struct sockaddr_in addr;
 static const char *ip;
 static unsigned short port;
-static char recv_string[MAX_RECV_STRING + 1];
-static int recv_string_len;
 static int multicast_socket;
 
 static pthread_mutex_t send_mutex;
 
-void *receive_msg(void *args);
+// The receive thread only reads datagrams into this queue, they are decoded and
+// applied on the uloop thread like everything else that touches the storage.
+struct recv_slot {
+    int len;
+    char data[MAX_RECV_STRING + 1];
+};
+
+static struct recv_slot recv_queue[RECV_QUEUE_LEN];
+static unsigned int recv_queue_head = 0; // next slot to process
+static unsigned int recv_queue_tail = 0; // next slot to fill
+static char recv_discard[MAX_RECV_STRING + 1]; // datagrams that do not fit into the queue
+static int recv_queue_wake[2] = {-1, -1};
+static struct uloop_fd recv_queue_fd;
+
+struct recv_queue_stats_s recv_queue_stats;
+
+static void *receive_msg(void *args);
+
+static void handle_received_msg(char *msg, int len);
 
-void *receive_msg_enc(void *args);
+static void receive_queue_cb(struct uloop_fd *fd, unsigned int events);
+
+// Messages sent during one uloop iteration go out together
+static struct iovec send_iov[SEND_BATCH_LEN];
+static struct mmsghdr send_msgs[SEND_BATCH_LEN];
+static int send_batch_len = 0;
+
+static void send_batch_flush();
+
+static void send_batch_add(char *data, size_t len);
+
+static void send_batch_cb(struct uloop_timeout *t);
+
+static struct uloop_timeout send_batch_timer = {
+        .cb = send_batch_cb
+};
 
 int init_socket_runopts(const char *_ip, int _port, int _multicast_socket) {
 
@@ -36,103 +83,266 @@ int init_socket_runopts(const char *_ip, int _port, int _multicast_socket) {
     multicast_socket = _multicast_socket;
 
     if (multicast_socket) {
-        printf("Settingup multicastsocket!\n");
+        dawn_log_info("Settingup multicastsocket!\n");
         sock = setup_multicast_socket(ip, port, &addr);
     } else {
         sock = setup_broadcast_socket(ip, port, &addr);
     }
 
+    if (pipe(recv_queue_wake) < 0) {
+        dawn_log_error("pipe(): %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(recv_queue_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(recv_queue_wake[1], F_SETFL, O_NONBLOCK);
+
     pthread_t sniffer_thread;
-    if (network_config.use_symm_enc) {
-        if (pthread_create(&sniffer_thread, NULL, receive_msg_enc, NULL)) {
-            fprintf(stderr, "Could not create receiving thread!\n");
-            return -1;
-        }
-    } else {
-        if (pthread_create(&sniffer_thread, NULL, receive_msg, NULL)) {
-            fprintf(stderr, "Could not create receiving thread!\n");
-            return -1;
-        }
+    if (pthread_create(&sniffer_thread, NULL, receive_msg, NULL)) {
+        dawn_log_error("Could not create receiving thread!\n");
+        return -1;
     }
 
-    fprintf(stdout, "Connected to %s:%d\n", ip, port);
+    dawn_log_info("Connected to %s:%d\n", ip, port);
 
     return 0;
 }
 
-void *receive_msg(void *args) {
+// Only the receive thread writes the tail and only the uloop thread the head.
+static void *receive_msg(void *args) {
+    struct mmsghdr msgs[RECV_BATCH_LEN];
+    struct iovec iov[RECV_BATCH_LEN];
+
     while (1) {
-        if ((recv_string_len =
-                     recvfrom(sock, recv_string, MAX_RECV_STRING, 0, NULL, 0)) < 0) {
-            fprintf(stderr, "Could not receive message!");
-            continue;
-        }
+        unsigned int tail = recv_queue_tail;
+        unsigned int head = __atomic_load_n(&recv_queue_head, __ATOMIC_SEQ_CST);
+        unsigned int space = RECV_QUEUE_LEN - (tail - head);
+        int n, len;
 
-        if (recv_string == NULL) {
-            return 0;
-        }
+        if (space == 0) {
+            if ((len = recvfrom(sock, recv_discard, MAX_RECV_STRING, MSG_TRUNC, NULL, 0)) < 0) {
+                dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_ERROR, "Could not receive message!\n");
+                continue;
+            }
+
+            // with MSG_TRUNC the full length is returned, a cut off message cannot be parsed
+            if (len > MAX_RECV_STRING) {
+                recv_queue_stats.dropped++;
+                continue;
+            }
 
-        if (strlen(recv_string) <= 0) {
-            return 0;
+            // the queue may have drained while we were waiting for the datagram
+            head = __atomic_load_n(&recv_queue_head, __ATOMIC_SEQ_CST);
+            if (tail - head == RECV_QUEUE_LEN) {
+                recv_queue_stats.dropped++;
+                continue;
+            }
+
+            struct recv_slot *slot = &recv_queue[tail % RECV_QUEUE_LEN];
+            memcpy(slot->data, recv_discard, len);
+            slot->len = len;
+            n = 1;
+        } else {
+            if (space > RECV_BATCH_LEN) {
+                space = RECV_BATCH_LEN;
+            }
+
+            memset(msgs, 0, sizeof(msgs));
+            for (unsigned int i = 0; i < space; i++) {
+                iov[i].iov_base = recv_queue[(tail + i) % RECV_QUEUE_LEN].data;
+                iov[i].iov_len = MAX_RECV_STRING;
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            // block for the first datagram, then take what else is already there
+            if ((n = recvmmsg(sock, msgs, space, MSG_WAITFORONE, NULL)) < 0) {
+                dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_ERROR, "Could not receive message!\n");
+                continue;
+            }
+
+            for (int i = 0; i < n; i++) {
+                if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    recv_queue_stats.dropped++;
+                    recv_queue[(tail + i) % RECV_QUEUE_LEN].len = 0;
+                } else {
+                    recv_queue[(tail + i) % RECV_QUEUE_LEN].len = msgs[i].msg_len;
+                }
+            }
         }
-        recv_string[recv_string_len] = '\0';
 
-        printf("Received network message: %s\n", recv_string);
-        handle_network_msg(recv_string);
-    }
-}
+        // empty and truncated datagrams are not queued
+        int queued = 0;
+        for (int i = 0; i < n; i++) {
+            struct recv_slot *slot = &recv_queue[(tail + i) % RECV_QUEUE_LEN];
 
-void *receive_msg_enc(void *args) {
-    while (1) {
-        if ((recv_string_len =
-                     recvfrom(sock, recv_string, MAX_RECV_STRING, 0, NULL, 0)) < 0) {
-            fprintf(stderr, "Could not receive message!\n");
+            if (slot->len == 0) {
+                continue;
+            }
+
+            if (queued != i) {
+                struct recv_slot *to = &recv_queue[(tail + queued) % RECV_QUEUE_LEN];
+                memcpy(to->data, slot->data, slot->len);
+                to->len = slot->len;
+                slot = to;
+            }
+            slot->data[slot->len] = '\0';
+            queued++;
+        }
+
+        if (queued == 0) {
             continue;
         }
 
-        if (recv_string == NULL) {
-            return 0;
+        __atomic_store_n(&recv_queue_tail, tail + queued, __ATOMIC_SEQ_CST);
+
+        recv_queue_stats.received += queued;
+        if (tail + queued - head > recv_queue_stats.high_watermark) {
+            recv_queue_stats.high_watermark = tail + queued - head;
         }
 
-        if (strlen(recv_string) <= 0) {
-            return 0;
+        // wake the consumer if it may have seen an empty queue, else it is still draining
+        if (__atomic_load_n(&recv_queue_head, __ATOMIC_SEQ_CST) == tail) {
+            if (write(recv_queue_wake[1], "", 1) < 0 && errno != EAGAIN) {
+                dawn_log_error("write(): %s\n", strerror(errno));
+            }
         }
-        recv_string[recv_string_len] = '\0';
+    }
 
-        char *base64_dec_str = malloc(B64_DECODE_LEN(strlen(recv_string)));
-        if (!base64_dec_str){
-            fprintf(stderr, "Received network error: not enought memory\n");
-            return 0;
+    return NULL;
+}
+
+static void handle_received_msg(char *msg, int len) {
+    if (!network_config.use_symm_enc) {
+        dawn_log_debug("Received network message: %s\n", msg);
+        handle_network_msg(msg, len);
+        return;
+    }
+
+    // decrypted in place, the plaintext includes the terminating NUL
+    if (network_config.use_symm_enc == CRYPTO_MODE_AEAD) {
+        int dec_len = gcrypt_aead_open(msg, len);
+        char *dec = msg + GCRYPT_AEAD_NONCE_LEN;
+
+        if (dec_len <= 0 || dec[dec_len - 1] != '\0') {
+            dawn_stats.msgs[DAWN_STATS_MSG_UNKNOWN].dropped++;
+            dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_WARN, "Received network error: corrupt message\n");
+            return;
         }
-        int base64_dec_length = b64_decode(recv_string, base64_dec_str, B64_DECODE_LEN(strlen(recv_string)));
-        char *dec = gcrypt_decrypt_msg(base64_dec_str, base64_dec_length);
-        if (!dec){
-            free(base64_dec_str);
-            fprintf(stderr, "Received network error: not enought memory\n");
-            return 0;
+
+        dawn_log_debug("Received network message: %s\n", dec);
+        handle_network_msg(dec, dec_len - 1);
+        return;
+    }
+
+    char *base64_dec_str = malloc(B64_DECODE_LEN(len));
+    if (!base64_dec_str){
+        dawn_log_error("Received network error: not enought memory\n");
+        return;
+    }
+    int base64_dec_length = b64_decode(msg, base64_dec_str, B64_DECODE_LEN(len));
+    char *dec = gcrypt_decrypt_msg(base64_dec_str, base64_dec_length);
+    free(base64_dec_str);
+    if (!dec){
+        dawn_log_error("Received network error: not enought memory\n");
+        return;
+    }
+
+    dawn_log_debug("Received network message: %s\n", dec);
+    handle_network_msg(dec, strlen(dec));
+    free(dec);
+}
+
+static void receive_queue_cb(struct uloop_fd *fd, unsigned int events) {
+    char buf[64];
+    unsigned int head = recv_queue_head;
+
+    while (read(fd->fd, buf, sizeof(buf)) > 0) {
+    }
+
+    while (head != __atomic_load_n(&recv_queue_tail, __ATOMIC_SEQ_CST)) {
+        struct recv_slot *slot = &recv_queue[head % RECV_QUEUE_LEN];
+
+        handle_received_msg(slot->data, slot->len);
+        recv_queue_stats.processed++;
+
+        head++;
+        __atomic_store_n(&recv_queue_head, head, __ATOMIC_SEQ_CST);
+    }
+}
+
+void receive_queue_add_uloop() {
+    if (recv_queue_wake[0] < 0) {
+        return;
+    }
+
+    recv_queue_fd.fd = recv_queue_wake[0];
+    recv_queue_fd.cb = receive_queue_cb;
+    uloop_fd_add(&recv_queue_fd, ULOOP_READ);
+}
+
+// Caller must hold send_mutex
+static void send_batch_flush() {
+    int sent = 0;
+
+    while (sent < send_batch_len) {
+        int n = sendmmsg(sock, &send_msgs[sent], send_batch_len - sent, 0);
+
+        if (n < 0) {
+            dawn_log_error("sendmmsg(): %s\n", strerror(errno));
+            pthread_mutex_unlock(&send_mutex);
+            exit(EXIT_FAILURE);
         }
+        sent += n;
+    }
+
+    for (int i = 0; i < send_batch_len; i++) {
+        free(send_iov[i].iov_base);
+    }
+    send_batch_len = 0;
+}
+
+// Takes ownership of data.  Caller must hold send_mutex
+static void send_batch_add(char *data, size_t len) {
+    struct msghdr *hdr = &send_msgs[send_batch_len].msg_hdr;
+
+    send_iov[send_batch_len].iov_base = data;
+    send_iov[send_batch_len].iov_len = len;
 
-        printf("Received network message: %s\n", dec);
-        free(base64_dec_str);
-        handle_network_msg(dec);
-        free(dec);
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_name = &addr;
+    hdr->msg_namelen = sizeof(addr);
+    hdr->msg_iov = &send_iov[send_batch_len];
+    hdr->msg_iovlen = 1;
+
+    send_batch_len++;
+
+    if (send_batch_len == SEND_BATCH_LEN) {
+        uloop_timeout_cancel(&send_batch_timer);
+        send_batch_flush();
+    } else if (send_batch_len == 1) {
+        uloop_timeout_set(&send_batch_timer, 0);
     }
 }
 
+static void send_batch_cb(struct uloop_timeout *t) {
+    pthread_mutex_lock(&send_mutex);
+    send_batch_flush();
+    pthread_mutex_unlock(&send_mutex);
+}
+
 int send_string(char *msg) {
     pthread_mutex_lock(&send_mutex);
     size_t msglen = strlen(msg);
 
-    if (sendto(sock,
-               msg,
-               msglen,
-               0,
-               (struct sockaddr *) &addr,
-               sizeof(addr)) < 0) {
-        perror("sendto()");
+    char *data = malloc(msglen);
+    if (!data){
+        dawn_log_error("sendto() error: not enought memory\n");
         pthread_mutex_unlock(&send_mutex);
         exit(EXIT_FAILURE);
     }
+    memcpy(data, msg, msglen);
+    send_batch_add(data, msglen);
+
     pthread_mutex_unlock(&send_mutex);
 
     return 0;
@@ -143,9 +353,29 @@ int send_string_enc(char *msg) {
 
     int length_enc;
     size_t msglen = strlen(msg);
+
+    // sent as binary, the datagram length is known to the receiver
+    if (network_config.use_symm_enc == CRYPTO_MODE_AEAD) {
+        char *data = malloc(msglen + 1 + GCRYPT_AEAD_OVERHEAD);
+        if (!data){
+            dawn_log_error("sendto() error: not enought memory\n");
+            pthread_mutex_unlock(&send_mutex);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(data + GCRYPT_AEAD_NONCE_LEN, msg, msglen + 1);
+
+        if (gcrypt_aead_seal(data, msglen + 1)) {
+            free(data);
+            pthread_mutex_unlock(&send_mutex);
+            return -1;
+        }
+        send_batch_add(data, msglen + 1 + GCRYPT_AEAD_OVERHEAD);
+        pthread_mutex_unlock(&send_mutex);
+        return 0;
+    }
     char *enc = gcrypt_encrypt_msg(msg, msglen + 1, &length_enc);
     if (!enc){
-        fprintf(stderr, "sendto() error: not enought memory\n");
+        dawn_log_error("sendto() error: not enought memory\n");
         pthread_mutex_unlock(&send_mutex);
         exit(EXIT_FAILURE);
     }
@@ -153,29 +383,37 @@ int send_string_enc(char *msg) {
     char *base64_enc_str = malloc(B64_ENCODE_LEN(length_enc));
     if (!base64_enc_str){
         free(enc);
-        fprintf(stderr, "sendto() error: not enought memory\n");
+        dawn_log_error("sendto() error: not enought memory\n");
         pthread_mutex_unlock(&send_mutex);
         exit(EXIT_FAILURE);
     }
     size_t base64_enc_length = b64_encode(enc, length_enc, base64_enc_str, B64_ENCODE_LEN(length_enc));
 
-    if (sendto(sock,
-               base64_enc_str,
-               base64_enc_length, // very important to use actual length of string because of '\0' in encrypted msg
-               0,
-               (struct sockaddr *) &addr,
-               sizeof(addr)) < 0) {
-        perror("sendto()");
-        pthread_mutex_unlock(&send_mutex);
-        exit(EXIT_FAILURE);
-    }
-    free(base64_enc_str);
+    // very important to use actual length of string because of '\0' in encrypted msg
+    send_batch_add(base64_enc_str, base64_enc_length);
     free(enc);
     pthread_mutex_unlock(&send_mutex);
     return 0;
 }
 
+size_t send_string_max_len() {
+    if (network_config.use_symm_enc == CRYPTO_MODE_AEAD) {
+        return MAX_RECV_STRING - 1 - GCRYPT_AEAD_OVERHEAD;
+    }
+
+    // base64 of the message and its NUL, padded to whole AES blocks
+    if (network_config.use_symm_enc) {
+        return MAX_RECV_STRING / 4 * 3 / 16 * 16 - 1;
+    }
+
+    return MAX_RECV_STRING;
+}
+
 void close_socket() {
+    pthread_mutex_lock(&send_mutex);
+    send_batch_flush();
+    pthread_mutex_unlock(&send_mutex);
+
     if (multicast_socket) {
         remove_multicast_socket(sock);
     }
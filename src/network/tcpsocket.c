@@ -1,19 +1,79 @@
 #include <libubox/usock.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <inttypes.h>
+#include <sys/uio.h>
+#include <errno.h>
 
 #include "msghandler.h"
 #include "crypto.h"
 #include "datastorage.h"
 #include "tcpsocket.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_NETWORK
 
 #define STR_EVAL(x) #x
 #define STR_QUOTE(x) STR_EVAL(x)
 
+// Frames are prefixed with their length in network byte order, the length includes the prefix
+#define TCP_FRAME_HEADER_LEN sizeof(uint32_t)
+#define TCP_MAX_FRAME_LEN (1024 * 1024)
+
+// Connection manager, times are in seconds
+#define TCP_MANAGER_INTERVAL 1
+#define TCP_CONNECT_TIMEOUT 5
+#define TCP_MAX_CONNECTING 4 // connects in flight at a time
+#define TCP_BACKOFF_MAX 64
+#define TCP_PEER_EXPIRY_MIN 60 // peers no longer announced via umdns are forgotten after this
+
+#define TCP_KEEPALIVE_IDLE 30
+#define TCP_KEEPALIVE_INTERVAL 10
+#define TCP_KEEPALIVE_COUNT 3
+
 LIST_HEAD(tcp_sock_list);
 
+// A frame is encoded and encrypted once and then shared by the send queues of all peers
+struct tcp_frame {
+    int refcount;
+    int method; // enum dawn_stats_msg
+    uint32_t len;
+    char data[];
+};
+
 struct network_con_s *tcp_list_contains_address(struct sockaddr_in entry);
 
+static void tcp_set_wire_version(struct network_con_s *con, int version);
+
+static struct tcp_frame *tcp_build_frame(struct blob_attr *msg, const char *method, int wire_version);
+
+static void tcp_frame_put(struct tcp_frame *frame);
+
+static void tcp_queue_frame(struct network_con_s *con, struct tcp_frame *frame);
+
+static void tcp_send_queue_clear(struct network_con_s *con);
+
+static int tcp_flush(struct network_con_s *con);
+
+static time_t tcp_now();
+
+static void tcp_set_keepalive(int fd);
+
+static void tcp_con_connect(struct network_con_s *con);
+
+static void tcp_con_disconnect(struct network_con_s *con);
+
+static void tcp_con_schedule(struct network_con_s *con, time_t now);
+
+static void tcp_con_update_rtt(struct network_con_s *con);
+
+static void tcp_manager_cb(struct uloop_timeout *t);
+
+static struct uloop_timeout tcp_manager_timer = {
+        .cb = tcp_manager_cb
+};
+
 static struct uloop_fd server;
 struct client *next_client = NULL;
 
@@ -23,15 +83,30 @@ struct client {
     struct ustream_fd s;
     int ctr;
     int counter;
+
+    // a frame that is not contiguous in the read buffer is collected here
+    char *frame;
+    uint32_t frame_size; // allocated
+    uint32_t frame_len; // of the frame being collected, valid once the header is complete
+    uint32_t frame_fill; // bytes collected so far, 0 if none
 };
 
+static int client_frame_len_valid(uint32_t frame_len);
+
+static int client_frame_reserve(struct client *cl, uint32_t len);
+
+static void client_handle_frame(struct client *cl, char *msg, int len);
+
+static void client_read_error(struct ustream *s, const char *reason);
+
 static void client_close(struct ustream *s) {
     struct client *cl = container_of(s,
     struct client, s.stream);
 
-    fprintf(stderr, "Connection closed\n");
+    dawn_log_info("Connection closed\n");
     ustream_free(s);
     close(cl->s.fd.fd);
+    free(cl->frame);
     free(cl);
 }
 
@@ -46,7 +121,7 @@ static void client_notify_state(struct ustream *s) {
     if (!s->eof)
         return;
 
-    fprintf(stderr, "eof!, pending: %d, total: %d\n", s->w.data_bytes, cl->ctr);
+    dawn_log_debug("eof!, pending: %d, total: %d\n", s->w.data_bytes, cl->ctr);
 
     if (!s->w.data_bytes)
         return client_close(s);
@@ -57,76 +132,187 @@ static void client_to_server_close(struct ustream *s) {
     struct network_con_s *con = container_of(s,
     struct network_con_s, stream.stream);
 
-    fprintf(stderr, "Connection to server closed\n");
-    ustream_free(s);
-    close(con->fd.fd);
-    list_del(&con->list);
-    free(con);
+    dawn_log_info("Connection to server closed\n");
+    tcp_con_disconnect(con);
 }
 
+// Whatever is still buffered can not be delivered anymore
 static void client_to_server_state(struct ustream *s) {
-    struct client *cl = container_of(s,
-    struct client, s.stream);
+    if (!s->eof && !s->write_error)
+        return;
 
-    if (!s->eof)
+    dawn_log_debug("eof!, pending: %d\n", s->w.data_bytes);
+
+    client_to_server_close(s);
+}
+
+// The ustream has written what was left of a frame, pass it the next ones
+static void client_to_server_notify_write(struct ustream *s, int bytes) {
+    struct network_con_s *con = container_of(s,
+    struct network_con_s, stream.stream);
+
+    if (ustream_pending_data(s, true) > 0)
         return;
 
-    fprintf(stderr, "eof!, pending: %d, total: %d\n", s->w.data_bytes, cl->ctr);
+    // the ustream is still using the connection, so close it from the state callback
+    if (tcp_flush(con) < 0) {
+        s->write_error = true;
+        ustream_state_change(s);
+    }
+}
+
+static int client_frame_len_valid(uint32_t frame_len) {
+    if (frame_len < TCP_FRAME_HEADER_LEN || frame_len > TCP_MAX_FRAME_LEN)
+        return 0;
 
-    if (!s->w.data_bytes)
-        return client_to_server_close(s);
+    // encrypted payloads are whole cipher blocks
+    if (network_config.use_symm_enc == CRYPTO_MODE_ECB && ((frame_len - TCP_FRAME_HEADER_LEN) & 0xf))
+        return 0;
 
+    if (network_config.use_symm_enc == CRYPTO_MODE_AEAD && frame_len - TCP_FRAME_HEADER_LEN < GCRYPT_AEAD_OVERHEAD)
+        return 0;
+
+    return 1;
 }
 
-static void client_read_cb(struct ustream *s, int bytes) {
-    char *str, *str_tmp;
-    int len = 0;
-    uint32_t final_len = sizeof(uint32_t); // big enough to get msg length
-    str = malloc(final_len);
-    if (!str) {
-        fprintf(stderr,"not enough memory (" STR_QUOTE(__LINE__) ")\n");
-        goto nofree;
+static int client_frame_reserve(struct client *cl, uint32_t len) {
+    if (cl->frame_size >= len)
+        return 0;
+
+    char *frame = realloc(cl->frame, len);
+    if (!frame) {
+        dawn_log_error("not enough memory (%" PRIu32 " @ " STR_QUOTE(__LINE__) ")\n", len);
+        return -1;
     }
+    cl->frame = frame;
+    cl->frame_size = len;
+
+    return 0;
+}
+
+static void client_handle_frame(struct client *cl, char *msg, int len) {
+    struct network_con_s *con = tcp_list_contains_address(cl->sin);
+    char *dec = NULL;
+    int version;
+
+    if (con)
+        con->bytes_received += TCP_FRAME_HEADER_LEN + len;
+
+    if (len == 0)
+        return;
 
-    if ((len = ustream_pending_data(s, false)) < final_len){//ensure recv sizeof(uint32_t).
-        fprintf(stdout,"not complete msg, len:%d, expected len:%u\n", len, final_len);
-        goto out;
+    if (network_config.use_symm_enc == CRYPTO_MODE_AEAD) {
+        len = gcrypt_aead_open(msg, len);
+        if (len < 0) {
+            dawn_stats.msgs[DAWN_STATS_MSG_UNKNOWN].dropped++;
+            dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_WARN, "Dropping corrupt message from %s\n", inet_ntoa(cl->sin.sin_addr));
+            return;
+        }
+        msg += GCRYPT_AEAD_NONCE_LEN;
     }
-    if (ustream_read(s, str, final_len) != final_len) // read msg length bytes
-    {
-        fprintf(stdout,"msg length read failed\n");
-        goto out;
-    }	
-
-    final_len = ntohl(*(uint32_t *)str) - final_len;//the final_len in headder includes header itself
-    str_tmp = realloc(str, final_len);
-    if (!str_tmp) {
-        fprintf(stderr,"not enough memory (%" PRIu32 " @ " STR_QUOTE(__LINE__) ")\n", final_len);
-        goto out;//On failure, realloc returns a null pointer. The original pointer str remains valid
-                 //and may need to be deallocated with free() or realloc().
-    }
-    str = str_tmp;
-
-    if ((len = ustream_pending_data(s, false)) < final_len){//ensure recv final_len bytes.
-        fprintf(stdout,"not complete msg, len:%d, expected len:%u\n", len, final_len);
-        goto out;
-    }
-    ustream_read(s, str, final_len);
-    if (network_config.use_symm_enc) {
-        char *dec = gcrypt_decrypt_msg(str, final_len);//len of str is final_len
+    else if (network_config.use_symm_enc) {
+        dec = gcrypt_decrypt_buf(msg, len, &len);
         if (!dec) {
-            fprintf(stderr,"not enough memory (" STR_QUOTE(__LINE__) ")\n");
-            goto out;
+            dawn_log_error("not enough memory (" STR_QUOTE(__LINE__) ")\n");
+            return;
+        }
+        msg = dec;
+    }
+
+    // JSON is parsed as a string, so it has to end within the frame
+    if (len > 0 && (msg[0] == NETWORK_WIRE_MAGIC || memchr(msg, '\0', len))) {
+        version = handle_network_msg(msg, len);
+        if (version >= 0 && con)
+            tcp_set_wire_version(con, version);
+    }
+    else {
+        dawn_stats.msgs[DAWN_STATS_MSG_UNKNOWN].dropped++;
+        dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_WARN, "Dropping unterminated message from %s\n", inet_ntoa(cl->sin.sin_addr));
+    }
+
+    free(dec);
+}
+
+// The stream can not be resynchronised after a broken frame, so drop the connection
+static void client_read_error(struct ustream *s, const char *reason) {
+    dawn_log_warn("Closing connection: %s\n", reason);
+    ustream_consume(s, ustream_pending_data(s, false));
+    s->eof = true;
+    ustream_state_change(s);
+}
+
+static void client_read_cb(struct ustream *s, int bytes) {
+    struct client *cl = container_of(s,
+    struct client, s.stream);
+    char *buf;
+    int len;
+
+    while ((buf = ustream_get_read_buf(s, &len)) != NULL && len > 0) {
+        uint32_t frame_len;
+
+        // whole frames in the read buffer are handled in place, if aligned for the blob parser
+        if (cl->frame_fill == 0 && len >= TCP_FRAME_HEADER_LEN) {
+            memcpy(&frame_len, buf, TCP_FRAME_HEADER_LEN);
+            frame_len = ntohl(frame_len);
+
+            if (!client_frame_len_valid(frame_len)) {
+                client_read_error(s, "invalid frame length");
+                return;
+            }
+
+            if (len >= frame_len && ((uintptr_t) buf & 0x3) == 0) {
+                client_handle_frame(cl, buf + TCP_FRAME_HEADER_LEN, frame_len - TCP_FRAME_HEADER_LEN);
+                ustream_consume(s, frame_len);
+                continue;
+            }
+        }
+
+        // otherwise collect the frame, it may arrive over several callbacks
+        if (cl->frame_fill < TCP_FRAME_HEADER_LEN) {
+            int n = TCP_FRAME_HEADER_LEN - cl->frame_fill;
+            if (n > len)
+                n = len;
+
+            if (client_frame_reserve(cl, TCP_FRAME_HEADER_LEN)) {
+                client_read_error(s, "out of memory");
+                return;
+            }
+            memcpy(cl->frame + cl->frame_fill, buf, n);
+            ustream_consume(s, n);
+            cl->frame_fill += n;
+
+            if (cl->frame_fill < TCP_FRAME_HEADER_LEN)
+                continue;
+
+            memcpy(&frame_len, cl->frame, TCP_FRAME_HEADER_LEN);
+            cl->frame_len = ntohl(frame_len);
+
+            if (!client_frame_len_valid(cl->frame_len)) {
+                cl->frame_fill = 0;
+                client_read_error(s, "invalid frame length");
+                return;
+            }
+            if (client_frame_reserve(cl, cl->frame_len)) {
+                cl->frame_fill = 0;
+                client_read_error(s, "out of memory");
+                return;
+            }
+        }
+        else {
+            int n = cl->frame_len - cl->frame_fill;
+            if (n > len)
+                n = len;
+
+            memcpy(cl->frame + cl->frame_fill, buf, n);
+            ustream_consume(s, n);
+            cl->frame_fill += n;
+        }
+
+        if (cl->frame_fill == cl->frame_len) {
+            cl->frame_fill = 0;
+            client_handle_frame(cl, cl->frame + TCP_FRAME_HEADER_LEN, cl->frame_len - TCP_FRAME_HEADER_LEN);
         }
-        handle_network_msg(dec);
-        free(dec);
-    } else {
-        handle_network_msg(str);//len of str is final_len
     }
-out:
-    free(str);
-nofree:
-    return;
 }
 
 static void server_cb(struct uloop_fd *fd, unsigned int events) {
@@ -140,7 +326,7 @@ static void server_cb(struct uloop_fd *fd, unsigned int events) {
     cl = next_client;
     sfd = accept(server.fd, (struct sockaddr *) &cl->sin, &sl);
     if (sfd < 0) {
-        fprintf(stderr, "Accept failed\n");
+        dawn_log_error("Accept failed\n");
         return;
     }
 
@@ -148,20 +334,21 @@ static void server_cb(struct uloop_fd *fd, unsigned int events) {
     cl->s.stream.notify_read = client_read_cb;
     cl->s.stream.notify_state = client_notify_state;
     cl->s.stream.notify_write = client_notify_write;
+    tcp_set_keepalive(sfd);
     ustream_fd_init(&cl->s, sfd);
     next_client = NULL;
-    fprintf(stderr, "New connection\n");
+    dawn_log_info("New connection\n");
 }
 
 int run_server(int port) {
-    printf("Adding socket!\n");
+    dawn_log_info("Adding socket!\n");
     char port_str[12];
     sprintf(port_str, "%d", port);
 
     server.cb = server_cb;
     server.fd = usock(USOCK_TCP | USOCK_SERVER | USOCK_IPV4ONLY | USOCK_NUMERIC, INADDR_ANY, port_str);
     if (server.fd < 0) {
-        perror("usock");
+        dawn_log_error("usock: %s\n", strerror(errno));
         return 1;
     }
 
@@ -176,7 +363,7 @@ static void client_not_be_used_read_cb(struct ustream *s, int bytes) {
 
     len = ustream_read(s, buf, sizeof(buf));
     buf[len] = '\0';
-    printf("Read %d bytes from SSL connection: %s\n", len, buf);
+    dawn_log_debug("Read %d bytes from SSL connection: %s\n", len, buf);
 }
 
 static void connect_cb(struct uloop_fd *f, unsigned int events) {
@@ -184,29 +371,31 @@ static void connect_cb(struct uloop_fd *f, unsigned int events) {
     struct network_con_s *entry = container_of(f, struct network_con_s, fd);
 
     if (f->eof || f->error) {
-        fprintf(stderr, "Connection failed (%s)\n", f->eof ? "EOF" : "ERROR");
-        close(entry->fd.fd);
-        list_del(&entry->list);
-        free(entry);
+        dawn_log_info("Connection failed (%s)\n", f->eof ? "EOF" : "ERROR");
+        tcp_con_disconnect(entry);
         return;
     }
 
-    fprintf(stderr, "Connection established\n");
+    dawn_log_info("Connection established\n");
     uloop_fd_delete(&entry->fd);
+    tcp_set_keepalive(entry->fd.fd);
 
     entry->stream.stream.notify_read = client_not_be_used_read_cb;
     entry->stream.stream.notify_state = client_to_server_state;
+    entry->stream.stream.notify_write = client_to_server_notify_write;
 
     ustream_fd_init(&entry->stream, entry->fd.fd);
+    entry->connecting = 0;
     entry->connected = 1;
+    entry->since = tcp_now();
+    entry->connects++;
+    if (dawn_log_debug_enabled())
+        print_tcp_array();
 }
 
 int add_tcp_conncection(char *ipv4, int port) {
     struct sockaddr_in serv_addr;
 
-    char port_str[12];
-    sprintf(port_str, "%d", port);
-
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = inet_addr(ipv4);
@@ -214,108 +403,341 @@ int add_tcp_conncection(char *ipv4, int port) {
 
     struct network_con_s *tmp = tcp_list_contains_address(serv_addr);
     if (tmp != NULL) {
-        if(tmp->connected == true)
-        {
-            return 0;
-        } else{
-            // Delete already existing entry
-            close(tmp->fd.fd);
-            list_del(&tmp->list);
-            free(tmp);
-        }
+        tmp->last_seen = tcp_now();
+        if (!tmp->connected && !tmp->connecting)
+            tmp->sock_addr = serv_addr;
+        return 0;
     }
 
     struct network_con_s *tcp_entry = calloc(1, sizeof(struct network_con_s));
-    tcp_entry->fd.fd = usock(USOCK_TCP | USOCK_NONBLOCK, ipv4, port_str);
-    tcp_entry->sock_addr = serv_addr;
-
-    if (tcp_entry->fd.fd < 0) {
-        free(tcp_entry);
+    if (!tcp_entry) {
+        dawn_log_error("not enough memory (" STR_QUOTE(__LINE__) ")\n");
         return -1;
     }
-    tcp_entry->fd.cb = connect_cb;
-    uloop_fd_add(&tcp_entry->fd, ULOOP_WRITE | ULOOP_EDGE_TRIGGER);
+    tcp_entry->sock_addr = serv_addr;
+    tcp_entry->last_seen = tcp_now();
+    tcp_entry->next_attempt = tcp_entry->last_seen;
 
-    printf("New TCP connection to %s:%d\n", ipv4, port);
+    dawn_log_info("New TCP peer %s:%d\n", ipv4, port);
     list_add(&tcp_entry->list, &tcp_sock_list);
 
+    // connect from the loop rather than from within the umdns callback
+    uloop_timeout_set(&tcp_manager_timer, 0);
+
     return 0;
 }
 
-void send_tcp(char *msg) {
-    print_tcp_array();
+static time_t tcp_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Detects peers that vanished without closing the connection, e.g. after a power cut
+static void tcp_set_keepalive(int fd) {
+    int on = 1;
+    int idle = TCP_KEEPALIVE_IDLE;
+    int interval = TCP_KEEPALIVE_INTERVAL;
+    int count = TCP_KEEPALIVE_COUNT;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)))
+        dawn_log_warn("setsockopt keepalive: %s\n", strerror(errno));
+}
+
+static void tcp_con_connect(struct network_con_s *con) {
+    char port_str[12];
+    char *ipv4 = inet_ntoa(con->sock_addr.sin_addr);
+    int port = ntohs(con->sock_addr.sin_port);
+
+    sprintf(port_str, "%d", port);
+
+    memset(&con->fd, 0, sizeof(con->fd));
+    memset(&con->stream, 0, sizeof(con->stream));
+    con->since = tcp_now();
+
+    con->fd.fd = usock(USOCK_TCP | USOCK_NONBLOCK | USOCK_IPV4ONLY | USOCK_NUMERIC, ipv4, port_str);
+    if (con->fd.fd < 0) {
+        dawn_log_warn("Connecting to %s:%d failed\n", ipv4, port);
+        tcp_con_schedule(con, con->since);
+        return;
+    }
+    con->fd.cb = connect_cb;
+    uloop_fd_add(&con->fd, ULOOP_WRITE | ULOOP_EDGE_TRIGGER);
+    con->connecting = 1;
+
+    dawn_log_info("New TCP connection to %s:%d\n", ipv4, port);
+}
+
+// Closes the connection but keeps the peer, the manager reconnects it once its backoff expired
+static void tcp_con_disconnect(struct network_con_s *con) {
+    time_t now = tcp_now();
+
+    if (con->connected) {
+        tcp_send_queue_clear(con);
+        ustream_free(&con->stream.stream);
+        close(con->fd.fd);
+
+        // a connection that was up for a while starts over with the shortest backoff
+        if (now - con->since >= TCP_BACKOFF_MAX)
+            con->failures = 0;
+    } else if (con->connecting) {
+        uloop_fd_delete(&con->fd);
+        close(con->fd.fd);
+    }
+
+    con->connected = 0;
+    con->connecting = 0;
+    con->rtt_us = 0;
+    tcp_con_schedule(con, now);
+}
+
+static void tcp_con_schedule(struct network_con_s *con, time_t now) {
+    time_t backoff = TCP_BACKOFF_MAX;
+
+    if (con->failures < 6)
+        backoff = (time_t) 1 << con->failures;
+
+    // spread out the reconnects of peers that failed together, e.g. after a switch reboot
+    backoff += rand() % (backoff / 2 + 1);
+
+    con->failures++;
+    con->next_attempt = now + backoff;
+    dawn_log_debug("Reconnecting to %s in %ld s\n", inet_ntoa(con->sock_addr.sin_addr), (long) backoff);
+
+    uloop_timeout_set(&tcp_manager_timer, TCP_MANAGER_INTERVAL * 1000);
+}
+
+static void tcp_con_update_rtt(struct network_con_s *con) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (getsockopt(con->fd.fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+        con->rtt_us = info.tcpi_rtt;
+}
+
+static void tcp_manager_cb(struct uloop_timeout *t) {
     struct network_con_s *con, *tmp;
-    if (network_config.use_symm_enc) {
-        int length_enc;
-        size_t msglen = strlen(msg)+1;
-        char *enc = gcrypt_encrypt_msg(msg, msglen, &length_enc);
-        if (!enc){
-            fprintf(stderr, "Ustream error: not enought memory (" STR_QUOTE(__LINE__) ")\n");
-            return;
+    time_t now = tcp_now();
+    time_t expiry = 3 * timeout_config.update_tcp_con;
+    int connecting = 0;
+
+    if (expiry < TCP_PEER_EXPIRY_MIN)
+        expiry = TCP_PEER_EXPIRY_MIN;
+
+    list_for_each_entry_safe(con, tmp, &tcp_sock_list, list)
+    {
+        if (con->connecting && now - con->since >= TCP_CONNECT_TIMEOUT) {
+            dawn_log_info("Connecting to %s timed out\n", inet_ntoa(con->sock_addr.sin_addr));
+            tcp_con_disconnect(con);
         }
 
-        uint32_t final_len = length_enc + sizeof(final_len);
-        char *final_str = malloc(final_len);
-        if (!final_str){
-            free(enc);
-            fprintf(stderr, "Ustream error: not enought memory (" STR_QUOTE(__LINE__) ")\n");
-            return;
+        if (con->connected) {
+            tcp_con_update_rtt(con);
+        } else if (con->connecting) {
+            connecting++;
+        } else if (now - con->last_seen > expiry) {
+            dawn_log_info("Forgetting TCP peer %s\n", inet_ntoa(con->sock_addr.sin_addr));
+            list_del(&con->list);
+            free(con);
         }
-        uint32_t *msg_header = (uint32_t *)final_str;
-        *msg_header = htonl(final_len);
-        memcpy(final_str+sizeof(final_len), enc, length_enc);
-        list_for_each_entry_safe(con, tmp, &tcp_sock_list, list)
-        {
-            if (con->connected) {
-                int len_ustream = ustream_write(&con->stream.stream, final_str, final_len, 0);
-                printf("Ustream send: %d\n", len_ustream);
-                if (len_ustream <= 0) {
-                    fprintf(stderr,"Ustream error(" STR_QUOTE(__LINE__) ")!\n");
-                    //ERROR HANDLING!
-                    if (con->stream.stream.write_error) {
-                        ustream_free(&con->stream.stream);
-                        close(con->fd.fd);
-                        list_del(&con->list);
-                        free(con);
-                    }
-                }
-            }
+    }
 
+    list_for_each_entry(con, &tcp_sock_list, list)
+    {
+        if (connecting >= TCP_MAX_CONNECTING)
+            break;
+
+        if (!con->connected && !con->connecting && now >= con->next_attempt) {
+            tcp_con_connect(con);
+            if (con->connecting)
+                connecting++;
         }
+    }
+
+    if (!list_empty(&tcp_sock_list))
+        uloop_timeout_set(&tcp_manager_timer, TCP_MANAGER_INTERVAL * 1000);
+}
 
-        free(final_str);
-        free(enc);
+// The peer talks to us over its own connection, which is matched to our
+// outgoing connection by address only.
+static void tcp_set_wire_version(struct network_con_s *con, int version) {
+    if (version > NETWORK_WIRE_VERSION)
+        version = NETWORK_WIRE_VERSION;
+
+    if (con->wire_version != version) {
+        dawn_log_info("Peer %s speaks wire version %d\n", inet_ntoa(con->sock_addr.sin_addr), version);
+        con->wire_version = version;
+    }
+}
+
+static struct tcp_frame *tcp_build_frame(struct blob_attr *msg, const char *method, int wire_version) {
+    struct tcp_frame *frame;
+    char *payload;
+    int payload_len, padded_len;
+    int aead = network_config.use_symm_enc == CRYPTO_MODE_AEAD;
+    int body_offset = TCP_FRAME_HEADER_LEN + (aead ? GCRYPT_AEAD_NONCE_LEN : 0);
+
+    if (wire_version > 0) {
+        payload = network_msg_format_wire(msg, method, &payload_len, &padded_len);
     } else {
-        size_t msglen = strlen(msg) + 1;
-        uint32_t final_len = msglen + sizeof(final_len);
-        char *final_str = malloc(final_len);
-        if (!final_str){
-            fprintf(stderr, "Ustream error: not enought memory (" STR_QUOTE(__LINE__) ")\n");
-            return;
+        payload = network_msg_format_json(msg, method);
+        if (payload)
+            payload_len = padded_len = strlen(payload) + 1;
+    }
+    if (!payload) {
+        dawn_log_error("Ustream error: not enought memory (" STR_QUOTE(__LINE__) ")\n");
+        return NULL;
+    }
+
+    if (network_config.use_symm_enc == CRYPTO_MODE_ECB) {
+        int length_enc;
+        char *enc = gcrypt_encrypt_msg(payload, padded_len, &length_enc);
+        free(payload);
+        if (!enc) {
+            dawn_log_error("Ustream error: not enought memory (" STR_QUOTE(__LINE__) ")\n");
+            return NULL;
         }
-        uint32_t *msg_header = (uint32_t *)final_str;
-        *msg_header = htonl(final_len);
-        memcpy(final_str+sizeof(final_len), msg, msglen);
+        payload = enc;
+        payload_len = length_enc;
+    }
 
-        list_for_each_entry_safe(con, tmp, &tcp_sock_list, list)
-        {
-            if (con->connected) {
-                int len_ustream = ustream_write(&con->stream.stream, final_str, final_len, 0);
-                printf("Ustream send: %d\n", len_ustream);
-                if (len_ustream <= 0) {
-                    //ERROR HANDLING!
-                    fprintf(stderr,"Ustream error(" STR_QUOTE(__LINE__) ")!\n");
-                    if (con->stream.stream.write_error) {
-                        ustream_free(&con->stream.stream);
-                        close(con->fd.fd);
-                        list_del(&con->list);
-                        free(con);
-                    }
-                }
+    // the AEAD mode encrypts in place, with room for the nonce and the tag around the payload
+    frame = malloc(sizeof(*frame) + TCP_FRAME_HEADER_LEN + payload_len + (aead ? GCRYPT_AEAD_OVERHEAD : 0));
+    if (!frame) {
+        free(payload);
+        dawn_log_error("Ustream error: not enought memory (" STR_QUOTE(__LINE__) ")\n");
+        return NULL;
+    }
+    frame->refcount = 1;
+    frame->method = dawn_stats_msg_lookup(method);
+    frame->len = TCP_FRAME_HEADER_LEN + payload_len + (aead ? GCRYPT_AEAD_OVERHEAD : 0);
+
+    uint32_t msg_header = htonl(frame->len);
+    memcpy(frame->data, &msg_header, TCP_FRAME_HEADER_LEN);
+    memcpy(frame->data + body_offset, payload, payload_len);
+    free(payload);
+
+    if (aead && gcrypt_aead_seal(frame->data + TCP_FRAME_HEADER_LEN, payload_len)) {
+        free(frame);
+        return NULL;
+    }
+
+    return frame;
+}
+
+static void tcp_frame_put(struct tcp_frame *frame) {
+    if (frame && --frame->refcount == 0)
+        free(frame);
+}
+
+static void tcp_queue_frame(struct network_con_s *con, struct tcp_frame *frame) {
+    if (con->send_count == TCP_SEND_QUEUE_LEN) {
+        if (con->send_dropped++ == 0)
+            dawn_log_warn("Send queue to %s is full, dropping oldest frames\n", inet_ntoa(con->sock_addr.sin_addr));
+
+        dawn_stats.msgs[con->send_queue[con->send_head]->method].dropped++;
+        tcp_frame_put(con->send_queue[con->send_head]);
+        con->send_head = (con->send_head + 1) % TCP_SEND_QUEUE_LEN;
+        con->send_count--;
+    }
+
+    frame->refcount++;
+    con->send_queue[(con->send_head + con->send_count) % TCP_SEND_QUEUE_LEN] = frame;
+    con->send_count++;
+}
+
+static void tcp_send_queue_clear(struct network_con_s *con) {
+    while (con->send_count > 0) {
+        tcp_frame_put(con->send_queue[con->send_head]);
+        con->send_head = (con->send_head + 1) % TCP_SEND_QUEUE_LEN;
+        con->send_count--;
+    }
+}
+
+// Queued frames are written with a single writev() while the ustream has
+// nothing buffered. What the socket does not take of the first unfinished
+// frame is left to the ustream, which asks for the next frames via
+// notify_write once it is done. So at most one frame per peer is copied.
+static int tcp_flush(struct network_con_s *con) {
+    struct ustream *s = &con->stream.stream;
+    struct iovec iov[TCP_SEND_QUEUE_LEN];
+    ssize_t written;
+    int i;
+
+    if (con->send_count == 0 || ustream_pending_data(s, true) > 0)
+        return 0;
+
+    for (i = 0; i < con->send_count; i++) {
+        struct tcp_frame *frame = con->send_queue[(con->send_head + i) % TCP_SEND_QUEUE_LEN];
+
+        iov[i].iov_base = frame->data;
+        iov[i].iov_len = frame->len;
+    }
+
+    written = writev(con->fd.fd, iov, con->send_count);
+    if (written < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            dawn_log_error("Ustream error: %s\n", strerror(errno));
+            return -1;
+        }
+        written = 0;
+    }
+
+    while (con->send_count > 0) {
+        struct tcp_frame *frame = con->send_queue[con->send_head];
+        uint32_t done = (size_t) written < frame->len ? (uint32_t) written : frame->len;
+        int partial = done < frame->len;
+        int ret = 0;
+
+        if (partial)
+            ret = ustream_write(s, frame->data + done, frame->len - done, false);
+
+        written -= done;
+        con->bytes_sent += frame->len;
+        tcp_frame_put(frame);
+        con->send_head = (con->send_head + 1) % TCP_SEND_QUEUE_LEN;
+        con->send_count--;
+
+        if (ret < 0 || s->write_error) {
+            dawn_log_error("Ustream error(" STR_QUOTE(__LINE__) ")!\n");
+            return -1;
+        }
+        con->frames_sent++;
+        if (partial)
+            break;
+    }
+
+    return 0;
+}
+
+void send_tcp(struct blob_attr *msg, const char *method) {
+    struct network_con_s *con, *tmp;
+    // one frame per wire version, built on first use
+    struct tcp_frame *frames[NETWORK_WIRE_VERSION + 1] = { NULL };
+
+    list_for_each_entry_safe(con, tmp, &tcp_sock_list, list)
+    {
+        if (con->connected) {
+            int version = con->wire_version;
+
+            if (!frames[version]) {
+                frames[version] = tcp_build_frame(msg, method, version);
+                if (!frames[version])
+                    continue;
             }
+
+            tcp_queue_frame(con, frames[version]);
+            if (tcp_flush(con) < 0)
+                tcp_con_disconnect(con);
         }
-        free(final_str);
     }
+
+    for (int i = 0; i <= NETWORK_WIRE_VERSION; i++)
+        tcp_frame_put(frames[i]);
 }
 
 struct network_con_s* tcp_list_contains_address(struct sockaddr_in entry) {
@@ -331,13 +753,53 @@ struct network_con_s* tcp_list_contains_address(struct sockaddr_in entry) {
     return NULL;
 }
 
+int tcp_connection_count() {
+    struct network_con_s *con;
+    int count = 0;
+
+    list_for_each_entry(con, &tcp_sock_list, list)
+    {
+        if (con->connected)
+            count++;
+    }
+    return count;
+}
+
+void tcp_add_stats(struct blob_buf *b) {
+    struct network_con_s *con;
+    void *peers, *peer;
+
+    peers = blobmsg_open_array(b, "peers");
+    list_for_each_entry(con, &tcp_sock_list, list)
+    {
+        peer = blobmsg_open_table(b, NULL);
+        blobmsg_add_string(b, "address", inet_ntoa(con->sock_addr.sin_addr));
+        blobmsg_add_u32(b, "port", ntohs(con->sock_addr.sin_port));
+        blobmsg_add_u8(b, "connected", con->connected);
+        blobmsg_add_u32(b, "wire_version", con->wire_version);
+        blobmsg_add_u32(b, "rtt_us", con->rtt_us);
+        blobmsg_add_u32(b, "queued", con->send_count);
+        blobmsg_add_u32(b, "frames_sent", con->frames_sent);
+        blobmsg_add_u32(b, "frames_dropped", con->send_dropped);
+        blobmsg_add_u64(b, "bytes_sent", con->bytes_sent);
+        blobmsg_add_u64(b, "bytes_received", con->bytes_received);
+        blobmsg_add_u32(b, "connects", con->connects);
+        blobmsg_add_u32(b, "failures", con->failures);
+        blobmsg_close_table(b, peer);
+    }
+    blobmsg_close_array(b, peers);
+}
+
 void print_tcp_array() {
     struct network_con_s *con;
 
     printf("--------Connections------\n");
     list_for_each_entry(con, &tcp_sock_list, list)
     {
-        printf("Connecting to Port: %d, Connected: %s\n", ntohs(con->sock_addr.sin_port), con->connected ? "True" : "False");
+        printf("Connecting to %s:%d, Connected: %s, RTT: %" PRIu32 " us, Queue: %d (%d bytes buffered), Sent: %" PRIu32 ", Dropped: %" PRIu32 ", Connects: %" PRIu32 ", Failures: %d\n",
+               inet_ntoa(con->sock_addr.sin_addr), ntohs(con->sock_addr.sin_port), con->connected ? "True" : "False",
+               con->rtt_us, con->send_count, con->connected ? ustream_pending_data(&con->stream.stream, true) : 0,
+               con->frames_sent, con->send_dropped, con->connects, con->failures);
     }
     printf("------------------\n");
 }
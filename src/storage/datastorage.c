@@ -1,4 +1,6 @@
+#include <sched.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include "dawn_iwinfo.h"
 #include "dawn_uci.h"
@@ -6,13 +8,20 @@
 #include "ieee80211_utils.h"
 
 #include "datastorage.h"
+#include "slab.h"
 #include "test_storage.h"
 #include "msghandler.h"
 #include "ubus.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_STORAGE
 
 struct probe_metric_s dawn_metric;
 struct network_config_s network_config;
 struct time_config_s timeout_config;
+struct storage_config_s storage_config;
+uint32_t dawn_metric_generation = 1;
 
 
 
@@ -25,28 +34,86 @@ struct time_config_s timeout_config;
 #define WLAN_RRM_CAPS_BEACON_REPORT_ACTIVE BIT(5)
 #define WLAN_RRM_CAPS_BEACON_REPORT_TABLE BIT(6)
 
-static int go_next_help(char sort_order[], int i, probe_entry entry,
-                 probe_entry next_entry);
+static int go_next_help(char sort_order[], int i, const probe_entry* entry,
+                 const probe_entry* next_entry);
+
+static int go_next(char sort_order[], int i, const probe_entry* entry,
+            const probe_entry* next_entry);
+
+static probe_entry** probe_array_find(const uint8_t bssid_addr[], const uint8_t client_addr[]);
+
+static probe_client** probe_client_find(const uint8_t client_addr[]);
+
+static void probe_client_link(probe_client* pc, probe_entry* entry);
+
+static void probe_client_unlink(probe_client* pc, probe_entry* entry);
+
+static void probe_array_remove(probe_entry* entry);
+
+static void probe_expiry_link(probe_entry* entry);
+
+static void client_expiry_link(client* entry);
+
+static void ap_expiry_link(ap* entry);
+
+static void probe_hash_grow();
+
+static void probe_client_hash_grow();
+
+static void* storage_array_fit(void* array, int* size, size_t entry_size, int n);
+
+static void client_array_remove(client* entry);
+
+static void client_array_evict();
+
+static client_bssid** client_bssid_find(const uint8_t bssid_addr[]);
+
+static client** client_hash_find(const uint8_t bssid_addr[], const uint8_t client_addr[]);
+
+static client** client_addr_hash_find(const uint8_t client_addr[], const client* entry);
+
+static void client_hash_grow();
+
+static void client_bssid_sweep();
+
+static void ap_array_remove(ap* entry);
+
+static void ap_array_evict();
+
+static void denied_req_array_evict();
+
+static int kick_client(client* client_entry, char* neighbor_report);
+
+static int probe_entry_score(probe_entry* probe_entry, const ap* ap_entry);
+
+static int probe_entry_eval(probe_entry* probe_entry, const ap_snapshot* aps);
+
+static int probe_metric_score(const probe_entry* probe_entry, const ap* ap_entry);
+
+static void probe_client_update_best(probe_client* pc, const ap_snapshot* aps);
+
+static int better_ap_lookup(probe_client* pc, probe_entry* own_probe, int own_score, const ap_snapshot* aps);
+
+static uint32_t ap_generation_next();
 
-static int go_next(char sort_order[], int i, probe_entry entry,
-            probe_entry next_entry);
+static void ap_snapshot_publish();
 
-static int client_array_go_next(char sort_order[], int i, client entry,
-                         client next_entry);
+static int ap_snapshot_compare(const void* a, const void* b);
 
-static int client_array_go_next_help(char sort_order[], int i, client entry,
-                              client next_entry);
+static int probe_score_inputs_equal(const probe_entry* a, const probe_entry* b);
 
-static int kick_client(struct client_s client_entry, char* neighbor_report);
+static int ap_score_inputs_equal(const ap* a, const ap* b);
 
-static void print_ap_entry(ap entry);
+static int ap_snapshot_inputs_equal(const ap* a, const ap* b);
+
+static void print_ap_entry(const ap* entry);
 
 static int is_connected(uint8_t bssid_addr[], uint8_t client_addr[]);
 
 static int compare_station_count(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compare, uint8_t *client_addr,
-                          int automatic_kick);
+                          int automatic_kick, const ap_snapshot* aps);
 
-static int compare_ssid(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compare);
+static int compare_ssid(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compare, const ap_snapshot* aps);
 
 static int denied_req_array_go_next(char sort_order[], int i, auth_entry entry,
                              auth_entry next_entry);
@@ -55,27 +122,59 @@ static int denied_req_array_go_next_help(char sort_order[], int i, auth_entry en
                                   auth_entry next_entry);
 
 // ---------------- Global variables ----------------
-struct auth_entry_s denied_req_array[DENY_REQ_ARRAY_LEN];
+// Arrays start at this size and grow / shrink by factors of two
+#define STORAGE_ARRAY_MIN_SIZE 16
+
+struct auth_entry_s* denied_req_array = NULL;
+static int denied_req_array_size = 0;
 extern int denied_req_last;
 pthread_mutex_t denied_array_mutex;
 
-struct probe_entry_s probe_array[PROBE_ARRAY_LEN];
-extern int probe_entry_last;
+// Hash tables start with static buckets and are reallocated as they grow
+static probe_entry* probe_hash_initial[PROBE_HASH_SIZE];
+static probe_entry** probe_hash = probe_hash_initial;
+static unsigned int probe_hash_size = PROBE_HASH_SIZE;
+static probe_client* probe_client_hash_initial[PROBE_CLIENT_HASH_SIZE];
+static probe_client** probe_client_hash = probe_client_hash_initial;
+static unsigned int probe_client_hash_size = PROBE_CLIENT_HASH_SIZE;
+static int probe_client_count = 0;
+LIST_HEAD(probe_client_list);
+LIST_HEAD(probe_lru_list);
+int probe_entry_count = 0;
 pthread_mutex_t probe_array_mutex;
 
-struct ap_s ap_array[ARRAY_AP_LEN];
-extern int ap_entry_last;
+// Entries live in slabs so pointers to them stay valid until they are removed
+static struct slab probe_slab = SLAB_INIT(probe_slab, probe_entry);
+static struct slab probe_client_slab = SLAB_INIT(probe_client_slab, probe_client);
+
+static struct slab ap_slab = SLAB_INIT(ap_slab, ap);
+LIST_HEAD(ap_entry_list);
+static LIST_HEAD(ap_expiry_list);
+int ap_entry_count = 0;
+// Changes whenever an AP is added, removed or changes its generation
+static uint32_t ap_generation = 0;
 pthread_mutex_t ap_array_mutex;
 
-struct client_s client_array[ARRAY_CLIENT_LEN];
-extern int client_entry_last;
+// Readers take a reference to the published snapshot without locking.  The initial empty
+// snapshot holds an extra reference so it is never freed.
+static ap_snapshot ap_snapshot_empty = {.refs = 2};
+static ap_snapshot* ap_snapshot_current = &ap_snapshot_empty;
+static int ap_snapshot_readers = 0; // readers between loading ap_snapshot_current and taking a reference
+
+static client* client_hash_initial[CLIENT_HASH_SIZE];
+static client** client_hash = client_hash_initial;
+static client* client_addr_hash_initial[CLIENT_HASH_SIZE];
+static client** client_addr_hash = client_addr_hash_initial;
+static unsigned int client_hash_size = CLIENT_HASH_SIZE; // of both tables
+static struct slab client_slab = SLAB_INIT(client_slab, client);
+static struct slab client_bssid_slab = SLAB_INIT(client_bssid_slab, client_bssid);
+static client_bssid* client_bssid_hash[CLIENT_BSSID_HASH_SIZE];
+LIST_HEAD(client_entry_list);
+int client_entry_count = 0;
 pthread_mutex_t client_array_mutex;
 
 char sort_string[SORT_LENGTH];
 
-int probe_entry_last = -1;
-int client_entry_last = -1;
-int ap_entry_last = -1;
 int mac_list_entry_last = -1;
 int denied_req_last = -1;
 
@@ -84,109 +183,142 @@ uint8_t mac_list[MAC_LIST_LENGTH][ETH_ALEN];
 void send_beacon_reports(uint8_t bssid[], int id) {
     pthread_mutex_lock(&client_array_mutex);
 
-    // Seach for BSSID
-    int i;
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(client_array[i].bssid_addr, bssid)) {
-            break;
+    // Go threw clients of the BSSID
+    client_bssid* cb = client_array_get_bssid(bssid);
+    if (cb != NULL) {
+        client* c;
+        list_for_each_entry(c, &cb->clients, bssid_list) {
+            if (c->rrm_enabled_capa &
+                (WLAN_RRM_CAPS_BEACON_REPORT_PASSIVE |
+                 WLAN_RRM_CAPS_BEACON_REPORT_ACTIVE |
+                 WLAN_RRM_CAPS_BEACON_REPORT_TABLE))
+                ubus_send_beacon_report(c->client_addr, id);
         }
     }
+    pthread_mutex_unlock(&client_array_mutex);
+}
 
-    // Go threw clients
-    int j;
-    for (j = i; j <= client_entry_last; j++) {
-        if (!mac_is_equal(client_array[j].bssid_addr, bssid)) {
-            break;
-        }
-        if (client_array[j].rrm_enabled_capa &
-            (WLAN_RRM_CAPS_BEACON_REPORT_PASSIVE |
-             WLAN_RRM_CAPS_BEACON_REPORT_ACTIVE |
-             WLAN_RRM_CAPS_BEACON_REPORT_TABLE))
-            ubus_send_beacon_report(client_array[j].client_addr, id);
+int eval_probe_metric(probe_entry* probe_entry) {
+    const ap_snapshot* aps = ap_snapshot_get();
+    int score = probe_entry_eval(probe_entry, aps);
+
+    ap_snapshot_put(aps);
+    return score;
+}
+
+static int probe_entry_eval(probe_entry* probe_entry, const ap_snapshot* aps) {
+    int score = probe_entry_score(probe_entry, ap_snapshot_get_ap(aps, probe_entry->bssid_addr));
+
+    if (dawn_log_debug_enabled()) {
+        dawn_log_debug("Score: %d of:\n", score);
+        print_probe_entry(probe_entry);
     }
-    pthread_mutex_unlock(&client_array_mutex);
+
+    return score;
 }
 
-// TODO: Can metric be cached once calculated? Add score_fresh indicator and reset when signal changes
-// TODO: as rest of values look to be static fr any given entry.
-int eval_probe_metric(struct probe_entry_s probe_entry) {
+// Cached score of a probe entry, ap_entry is its AP or NULL
+static int probe_entry_score(probe_entry* probe_entry, const ap* ap_entry) {
+    uint32_t generation = ap_entry != NULL ? ap_entry->generation : 0;
+    struct probe_score_s* cache = &probe_entry->score_cache;
 
-    int score = 0;
+    if (cache->metric_generation != dawn_metric_generation || cache->ap_generation != generation) {
+        cache->score = probe_metric_score(probe_entry, ap_entry);
+        cache->metric_generation = dawn_metric_generation;
+        cache->ap_generation = generation;
+    }
+
+    return cache->score;
+}
 
-    ap ap_entry = ap_array_get_ap(probe_entry.bssid_addr);
+static int probe_metric_score(const probe_entry* probe_entry, const ap* ap_entry) {
+
+    int score = 0;
 
     // check if ap entry is available
-    if (mac_is_equal(ap_entry.bssid_addr, probe_entry.bssid_addr)) {
-        score += probe_entry.ht_capabilities && ap_entry.ht_support ? dawn_metric.ht_support : 0;
-        score += !probe_entry.ht_capabilities && !ap_entry.ht_support ? dawn_metric.no_ht_support : 0;  // TODO: Is both devices not having a capability worthy of scoring?
+    if (ap_entry != NULL) {
+        score += probe_entry->ht_capabilities && ap_entry->ht_support ? dawn_metric.ht_support : 0;
+        score += !probe_entry->ht_capabilities && !ap_entry->ht_support ? dawn_metric.no_ht_support : 0;  // TODO: Is both devices not having a capability worthy of scoring?
 
         // performance anomaly?
         if (network_config.bandwidth >= 1000 || network_config.bandwidth == -1) {
-            score += probe_entry.vht_capabilities && ap_entry.vht_support ? dawn_metric.vht_support : 0;
+            score += probe_entry->vht_capabilities && ap_entry->vht_support ? dawn_metric.vht_support : 0;
         }
 
-        score += !probe_entry.vht_capabilities && !ap_entry.vht_support ? dawn_metric.no_vht_support : 0;  // TODO: Is both devices not having a capability worthy of scoring?
-        score += ap_entry.channel_utilization <= dawn_metric.chan_util_val ? dawn_metric.chan_util : 0;
-        score += ap_entry.channel_utilization > dawn_metric.max_chan_util_val ? dawn_metric.max_chan_util : 0;
+        score += !probe_entry->vht_capabilities && !ap_entry->vht_support ? dawn_metric.no_vht_support : 0;  // TODO: Is both devices not having a capability worthy of scoring?
+        score += ap_entry->channel_utilization <= dawn_metric.chan_util_val ? dawn_metric.chan_util : 0;
+        score += ap_entry->channel_utilization > dawn_metric.max_chan_util_val ? dawn_metric.max_chan_util : 0;
 
-        score += ap_entry.ap_weight;
+        score += ap_entry->ap_weight;
     }
 
-    score += (probe_entry.freq > 5000) ? dawn_metric.freq : 0;
+    score += (probe_entry->freq > 5000) ? dawn_metric.freq : 0;
 
     // TODO: Should RCPI be used here as well?
     // TODO: Check higher value means more signal, not more -dB :)
     // TODO: Should this be more scaled?  Should -63dB on current and -77dB on other both score 0 if low / high are -80db and -60dB?
     // TODO: That then lets device capabilites dominate score - making them more important than RSSI difference of 14dB.
-    score += (probe_entry.signal >= dawn_metric.rssi_val) ? dawn_metric.rssi : 0;
-    score += (probe_entry.signal <= dawn_metric.low_rssi_val) ? dawn_metric.low_rssi : 0;
+    score += (probe_entry->signal >= dawn_metric.rssi_val) ? dawn_metric.rssi : 0;
+    score += (probe_entry->signal <= dawn_metric.low_rssi_val) ? dawn_metric.low_rssi : 0;
 
     // TODO: This magic value never checked by caller.  What does it achieve?
     if (score < 0)
         score = -2; // -1 already used...
 
-    printf("Score: %d of:\n", score);
-    print_probe_entry(probe_entry);
-
     return score;
 }
 
-static int compare_ssid(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compare) {
-    ap ap_entry_own = ap_array_get_ap(bssid_addr_own);
-    ap ap_entry_to_compre = ap_array_get_ap(bssid_addr_to_compare);
+// Fields of a probe entry that probe_metric_score() depends on
+static int probe_score_inputs_equal(const probe_entry* a, const probe_entry* b) {
+    return a->signal == b->signal && a->freq == b->freq &&
+           a->ht_capabilities == b->ht_capabilities && a->vht_capabilities == b->vht_capabilities;
+}
+
+// Fields of an AP entry that probe_metric_score() depends on
+static int ap_score_inputs_equal(const ap* a, const ap* b) {
+    return a->ht_support == b->ht_support && a->vht_support == b->vht_support &&
+           a->channel_utilization == b->channel_utilization && a->ap_weight == b->ap_weight;
+}
+
+// Fields of an AP entry that are read through the snapshot, besides the SSID
+static int ap_snapshot_inputs_equal(const ap* a, const ap* b) {
+    return ap_score_inputs_equal(a, b) && a->station_count == b->station_count && a->freq == b->freq &&
+           strcmp(a->neighbor_report, b->neighbor_report) == 0;
+}
+
+static int compare_ssid(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compare, const ap_snapshot* aps) {
+    const ap* ap_entry_own = ap_snapshot_get_ap(aps, bssid_addr_own);
+    const ap* ap_entry_to_compre = ap_snapshot_get_ap(aps, bssid_addr_to_compare);
 
-    if (mac_is_equal(ap_entry_own.bssid_addr, bssid_addr_own) &&
-        mac_is_equal(ap_entry_to_compre.bssid_addr, bssid_addr_to_compare)) {
-        return (strcmp((char *) ap_entry_own.ssid, (char *) ap_entry_to_compre.ssid) == 0);
+    if (ap_entry_own != NULL && ap_entry_to_compre != NULL) {
+        return (strcmp((char *) ap_entry_own->ssid, (char *) ap_entry_to_compre->ssid) == 0);
     }
     return 0;
 }
 
 static int compare_station_count(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compare, uint8_t *client_addr,
-                          int automatic_kick) {
+                          int automatic_kick, const ap_snapshot* aps) {
 
-    ap ap_entry_own = ap_array_get_ap(bssid_addr_own);
-    ap ap_entry_to_compre = ap_array_get_ap(bssid_addr_to_compare);
+    const ap* ap_entry_own = ap_snapshot_get_ap(aps, bssid_addr_own);
+    const ap* ap_entry_to_compre = ap_snapshot_get_ap(aps, bssid_addr_to_compare);
 
     // check if ap entry is available
-    if (mac_is_equal(ap_entry_own.bssid_addr, bssid_addr_own)
-        && mac_is_equal(ap_entry_to_compre.bssid_addr, bssid_addr_to_compare)
-            ) {
-        printf("Comparing own %d to %d\n", ap_entry_own.station_count, ap_entry_to_compre.station_count);
+    if (ap_entry_own != NULL && ap_entry_to_compre != NULL) {
+        dawn_log_debug("Comparing own %d to %d\n", ap_entry_own->station_count, ap_entry_to_compre->station_count);
 
 
-        int sta_count = ap_entry_own.station_count;
-        int sta_count_to_compare = ap_entry_to_compre.station_count;
+        int sta_count = ap_entry_own->station_count;
+        int sta_count_to_compare = ap_entry_to_compre->station_count;
         if (is_connected(bssid_addr_own, client_addr)) {
-            printf("Own is already connected! Decrease counter!\n");
+            dawn_log_debug("Own is already connected! Decrease counter!\n");
             sta_count--;
         }
 
         if (is_connected(bssid_addr_to_compare, client_addr)) {
-            printf("Comparing station is already connected! Decrease counter!\n");
+            dawn_log_debug("Comparing station is already connected! Decrease counter!\n");
             sta_count_to_compare--;
         }
-        printf("Comparing own station count %d to %d\n", sta_count, sta_count_to_compare);
+        dawn_log_debug("Comparing own station count %d to %d\n", sta_count, sta_count_to_compare);
 
         return sta_count - sta_count_to_compare > dawn_metric.max_station_diff;
     }
@@ -198,75 +330,72 @@ static int compare_station_count(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to
 int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neighbor_report, int automatic_kick) {
     int own_score = -1;
 
-    // find first client entry in probe array
-    int i;
-    for (i = 0; i <= probe_entry_last; i++) {
-        if (mac_is_equal(probe_array[i].client_addr, client_addr)) {
-            break;
-        }
-    }
+    // one consistent view of the APs for the whole decision
+    const ap_snapshot* aps = ap_snapshot_get();
 
     // find own probe entry and calculate score
-    int j;
-    for (j = i; j <= probe_entry_last; j++) {
-        if (!mac_is_equal(probe_array[j].client_addr, client_addr)) {
-            // this shouldn't happen!
-            //return 1; // kick client!
-            //return 0;
-            break;
-        }
-        if (mac_is_equal(bssid_addr, probe_array[j].bssid_addr)) {
-            printf("Calculating own score!\n");
-            own_score = eval_probe_metric(probe_array[j]);  //TODO: Should the -2 return be handled?
-            break;
-        }
+    probe_entry* own_probe = *probe_array_find(bssid_addr, client_addr);
+    if (own_probe != NULL) {
+        dawn_log_debug("Calculating own score!\n");
+        own_score = probe_entry_eval(own_probe, aps);  //TODO: Should the -2 return be handled?
     }
 
     // no entry for own ap
     if (own_score == -1) {
+        ap_snapshot_put(aps);
         return -1;
     }
 
-    int k;
+    probe_client* pc = *probe_client_find(client_addr);
+
+    // without a neighbor report to fill in the answer can usually come from the best candidate
+    if (neighbor_report == NULL) {
+        int known = better_ap_lookup(pc, own_probe, own_score, aps);
+
+        if (known >= 0) {
+            ap_snapshot_put(aps);
+            return known;
+        }
+    }
+
     int max_score = 0;  //TODO: Set this to own_score so we are just looking for AP that are better?
     int kick = 0;
-    for (k = i; k <= probe_entry_last; k++) {
+    for (probe_entry* k = pc->probes; k != NULL; k = k->next_client_probe) {
         int score_to_compare;
 
-        if (!mac_is_equal(probe_array[k].client_addr, client_addr)) {
-            break;
-        }
-
-        if (mac_is_equal(bssid_addr, probe_array[k].bssid_addr)) {
-            printf("Own Score! Skipping!\n");
-            print_probe_entry(probe_array[k]);
+        if (k == own_probe) {
+            if (dawn_log_debug_enabled()) {
+                dawn_log_debug("Own Score! Skipping!\n");
+                print_probe_entry(k);
+            }
             continue;
         }
 
         // check if same ssid!
-        if (!compare_ssid(bssid_addr, probe_array[k].bssid_addr)) {
+        if (!compare_ssid(bssid_addr, k->bssid_addr, aps)) {
             continue;
         }
 
-        printf("Calculating score to compare!\n");
-        score_to_compare = eval_probe_metric(probe_array[k]);
+        dawn_log_debug("Calculating score to compare!\n");
+        score_to_compare = probe_entry_eval(k, aps);
 
         // instead of returning we append a neighbor report list...
         if (own_score < score_to_compare && score_to_compare > max_score) {
             if(neighbor_report == NULL)
             {
-                fprintf(stderr,"Neigbor-Report is null!\n");
+                dawn_log_error("Neigbor-Report is null!\n");
+                ap_snapshot_put(aps);
                 return 1;
             }
 
             kick = 1;
-            struct ap_s destap = ap_array_get_ap(probe_array[k].bssid_addr);
+            const ap* destap = ap_snapshot_get_ap(aps, k->bssid_addr);
 
-            if (!mac_is_equal(destap.bssid_addr, probe_array[k].bssid_addr)) {
+            if (destap == NULL) {
                 continue;
             }
 
-            strcpy(neighbor_report,destap.neighbor_report);
+            strcpy(neighbor_report,destap->neighbor_report);
 
             max_score = score_to_compare;
 
@@ -281,34 +410,101 @@ int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neigh
             if (own_score >= 0) {
 
                 // if ap have same value but station count is different...
-                if (compare_station_count(bssid_addr, probe_array[k].bssid_addr, probe_array[k].client_addr,
-                                          automatic_kick)) {
+                if (compare_station_count(bssid_addr, k->bssid_addr, k->client_addr,
+                                          automatic_kick, aps)) {
                     //return 1;
                     kick = 1;
                     if(neighbor_report == NULL)
                     {
-                        fprintf(stderr,"Neigbor-Report is null!\n");
+                        dawn_log_error("Neigbor-Report is null!\n");
+                        ap_snapshot_put(aps);
                         return 1;
                     }
-                    struct ap_s destap = ap_array_get_ap(probe_array[k].bssid_addr);
+                    const ap* destap = ap_snapshot_get_ap(aps, k->bssid_addr);
 
-                    if (!mac_is_equal(destap.bssid_addr, probe_array[k].bssid_addr)) {
+                    if (destap == NULL) {
                         continue;
                     }
 
-                    strcpy(neighbor_report,destap.neighbor_report);
+                    strcpy(neighbor_report,destap->neighbor_report);
                     }
                 }
             }
         }
+    ap_snapshot_put(aps);
     return kick;
 }
 
+// Find the highest scoring probe of a client whose AP is known, unless nothing changed since the last time
+static void probe_client_update_best(probe_client* pc, const ap_snapshot* aps) {
+    if (pc->best_score.metric_generation == dawn_metric_generation &&
+        pc->best_score.ap_generation == aps->generation) {
+        return;
+    }
+
+    pc->best = NULL;
+    pc->best_count = 0;
+
+    for (probe_entry* k = pc->probes; k != NULL; k = k->next_client_probe) {
+        const ap* ap_entry = ap_snapshot_get_ap(aps, k->bssid_addr);
+
+        if (ap_entry == NULL) {
+            continue;
+        }
+
+        int score = probe_entry_score(k, ap_entry);
+
+        if (pc->best == NULL || score > pc->best_score.score) {
+            pc->best = k;
+            pc->best_score.score = score;
+            pc->best_count = 1;
+        }
+        else if (score == pc->best_score.score) {
+            pc->best_count++;
+        }
+    }
+
+    pc->best_score.metric_generation = dawn_metric_generation;
+    pc->best_score.ap_generation = aps->generation;
+}
+
+// Answer better_ap_available() for admission from the best candidate of the client.
+// Returns 1 or 0 where that gives the same result as comparing all probes, else -1.
+static int better_ap_lookup(probe_client* pc, probe_entry* own_probe, int own_score, const ap_snapshot* aps) {
+    const ap* own_ap = ap_snapshot_get_ap(aps, own_probe->bssid_addr);
+
+    // compare_ssid() fails for every other AP
+    if (own_ap == NULL) {
+        return 0;
+    }
+
+    probe_client_update_best(pc, aps);
+
+    int best_score = pc->best_score.score;
+
+    // only an AP scoring above 0 can be better, and ties only count with use_station_count
+    if (best_score <= 0 || (best_score == own_score &&
+                            (dawn_metric.use_station_count <= 0 || pc->best_count == 1))) {
+        return 0;
+    }
+
+    if (best_score > own_score) {
+        const ap* best_ap = ap_snapshot_get_ap(aps, pc->best->bssid_addr);
+
+        if (strcmp((char *) own_ap->ssid, (char *) best_ap->ssid) == 0) {
+            return 1;
+        }
+    }
+
+    // the best candidate is on another SSID or ties need station counts
+    return -1;
+}
+
 // TODO: mac_in_maclist() returns 0 or 1; better_ap_available() returns -1, 0, or 1.
 // What is the intended behaviour for 1 && -1 -> 1?  Is this relying on undocumented side-effects to get -1?
-static int kick_client(struct client_s client_entry, char* neighbor_report) {
-    return !mac_in_maclist(client_entry.client_addr) &&
-           better_ap_available(client_entry.bssid_addr, client_entry.client_addr, neighbor_report, 1);
+static int kick_client(client* client_entry, char* neighbor_report) {
+    return !mac_in_maclist(client_entry->client_addr) &&
+           better_ap_available(client_entry->bssid_addr, client_entry->client_addr, neighbor_report, 1);
 }
 
 int kick_clients(uint8_t bssid[], uint32_t id) {
@@ -317,30 +513,21 @@ int kick_clients(uint8_t bssid[], uint32_t id) {
 
     int kicked_clients = 0;
 
-    printf("-------- KICKING CLIENTS!!!---------\n");
-    char mac_buf_ap[20];
-    sprintf(mac_buf_ap, MACSTR, MAC2STR(bssid));
-    printf("EVAL %s\n", mac_buf_ap);
+    dawn_log_debug("-------- KICKING CLIENTS!!!---------\n");
+    dawn_log_debug("EVAL " MACSTR "\n", MAC2STR(bssid));
 
     // Seach for BSSID
-    int i;
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(client_array[i].bssid_addr, bssid)) {
-            break;
-        }
-    }
+    client_bssid* cb = client_array_get_bssid(bssid);
+    client* j = cb != NULL ? list_first_entry(&cb->clients, client, bssid_list) : NULL;
 
     // Go threw clients
-    int j = i;
-    while (j <= client_entry_last) {
-        if (!mac_is_equal(client_array[j].bssid_addr, bssid)) {
-            break;
-        }
+    while (j != NULL && &j->bssid_list != &cb->clients) {
+        client* next = list_entry(j->bssid_list.next, client, bssid_list);
 
         char neighbor_report[NEIGHBOR_REPORT_LEN] = "";
         strcpy(neighbor_report, "This is a test");
-        int do_kick = kick_client(client_array[j], neighbor_report);
-        printf("Chosen AP %s\n", neighbor_report);
+        int do_kick = kick_client(j, neighbor_report);
+        dawn_log_debug("Chosen AP %s\n", neighbor_report);
 
         // better ap available
         if (do_kick > 0) {
@@ -349,23 +536,25 @@ int kick_clients(uint8_t bssid[], uint32_t id) {
             // + rssi is changing a lot
             // + chan util is changing a lot
             // + ping pong behavior of clients will be reduced
-            client_array[j].kick_count++;
-            printf("Comparing kick count! kickcount: %d to min_kick_count: %d!\n", client_array[j].kick_count,
+            j->kick_count++;
+            dawn_log_debug("Comparing kick count! kickcount: %d to min_kick_count: %d!\n", j->kick_count,
                 dawn_metric.min_kick_count);
-            if (client_array[j].kick_count < dawn_metric.min_kick_count) {
-                j++;
+            if (j->kick_count < dawn_metric.min_kick_count) {
+                j = next;
             }
             else
             {
-                printf("Better AP available. Kicking client:\n");
-                print_client_entry(client_array[j]);
-                printf("Check if client is active receiving!\n");
+                if (dawn_log_enabled(DAWN_LOG_CATEGORY, DAWN_LOG_INFO)) {
+                    dawn_log_info("Better AP available. Kicking client:\n");
+                    print_client_entry(j);
+                }
+                dawn_log_debug("Check if client is active receiving!\n");
 
                 float rx_rate, tx_rate;
-                if (get_bandwidth_iwinfo(client_array[j].client_addr, &rx_rate, &tx_rate)) {
-                    printf("No active transmission data for client. Don't kick!\n");
+                if (get_bandwidth_iwinfo(j->client_addr, &rx_rate, &tx_rate)) {
+                    dawn_log_info("No active transmission data for client. Don't kick!\n");
 
-                    j++;
+                    j = next;
                 }
                 else
                 {
@@ -373,31 +562,34 @@ int kick_clients(uint8_t bssid[], uint32_t id) {
                     // <= 6MBits <- probably no transmission
                     // tx_rate has always some weird value so don't use ist
                     if (rx_rate > dawn_metric.bandwidth_threshold) {
-                        printf("Client is probably in active transmisison. Don't kick! RxRate is: %f\n", rx_rate);
+                        dawn_log_info("Client is probably in active transmisison. Don't kick! RxRate is: %f\n", rx_rate);
 
-                        j++;
+                        j = next;
                     }
                     else
                     {
-                        printf("Client is probably NOT in active transmisison. KICK! RxRate is: %f\n", rx_rate);
+                        dawn_log_info("Client is probably NOT in active transmisison. KICK! RxRate is: %f\n", rx_rate);
 
                         // here we should send a messsage to set the probe.count for all aps to the min that there is no delay between switching
                         // the hearing map is full...
-                        send_set_probe(client_array[j].client_addr);
+                        send_set_probe(j->client_addr);
 
                         // don't deauth station? <- deauth is better!
                         // maybe we can use handovers...
-                        //del_client_interface(id, client_array[j].client_addr, NO_MORE_STAS, 1, 1000);
-                        int sync_kick = wnm_disassoc_imminent(id, client_array[j].client_addr, neighbor_report, 12);
+                        //del_client_interface(id, j->client_addr, NO_MORE_STAS, 1, 1000);
+                        int sync_kick = wnm_disassoc_imminent(id, j->client_addr, neighbor_report, 12);
 
                         // Synchronous kick is a test harness feature to indicate arrays have been updated, so don't change further
                         if (sync_kick)
                         {
                             kicked_clients++;
+
+                            // the kicked entry has moved to another BSSID, the others and cb stay where they are
+                            j = next;
                         }
                         else
                         {
-                            client_array_delete(client_array[j]);
+                            client_array_remove(j);
 
                             // don't delete clients in a row. use update function again...
                             // -> chan_util update, ...
@@ -411,25 +603,29 @@ int kick_clients(uint8_t bssid[], uint32_t id) {
         // no entry in probe array for own bssid
         // TODO: Is test against -1 from (1 && -1) portable?
         else if (do_kick == -1) {
-            printf("No Information about client. Force reconnect:\n");
-            print_client_entry(client_array[j]);
-            del_client_interface(id, client_array[j].client_addr, 0, 1, 0);
+            if (dawn_log_enabled(DAWN_LOG_CATEGORY, DAWN_LOG_INFO)) {
+                dawn_log_info("No Information about client. Force reconnect:\n");
+                print_client_entry(j);
+            }
+            del_client_interface(id, j->client_addr, 0, 1, 0);
 
 
-            j++;
+            j = next;
         }
         // ap is best
         else {
-            printf("AP is best. Client will stay:\n");
-            print_client_entry(client_array[j]);
+            if (dawn_log_debug_enabled()) {
+                dawn_log_debug("AP is best. Client will stay:\n");
+                print_client_entry(j);
+            }
             // set kick counter to 0 again
-            client_array[j].kick_count = 0;
+            j->kick_count = 0;
 
-            j++;
+            j = next;
         }
     }
 
-    printf("---------------------------\n");
+    dawn_log_debug("---------------------------\n");
 
     pthread_mutex_unlock(&probe_array_mutex);
     pthread_mutex_unlock(&client_array_mutex);
@@ -441,284 +637,545 @@ void update_iw_info(uint8_t bssid[]) {
     pthread_mutex_lock(&client_array_mutex);
     pthread_mutex_lock(&probe_array_mutex);
 
-    printf("-------- IW INFO UPDATE!!!---------\n");
-    char mac_buf_ap[20];
-    sprintf(mac_buf_ap, MACSTR, MAC2STR(bssid));
-    printf("EVAL %s\n", mac_buf_ap);
+    dawn_log_debug("-------- IW INFO UPDATE!!!---------\n");
+    dawn_log_debug("EVAL " MACSTR "\n", MAC2STR(bssid));
 
     // Seach for BSSID
-    int i;
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(client_array[i].bssid_addr, bssid)) {
-            break;
-        }
-    }
+    client_bssid* cb = client_array_get_bssid(bssid);
 
     // Go threw clients
-    int j;
-    for (j = i; j <= client_entry_last; j++) {
-        if (!mac_is_equal(client_array[j].bssid_addr, bssid)) {
-            break;
-        }
-
-        // update rssi
-        int rssi = get_rssi_iwinfo(client_array[j].client_addr);
-        int exp_thr = get_expected_throughput_iwinfo(client_array[j].client_addr);
-        double exp_thr_tmp = iee80211_calculate_expected_throughput_mbit(exp_thr);
-        printf("Expected throughput %f Mbit/sec\n", exp_thr_tmp);
+    if (cb != NULL) {
+        client* j;
+        list_for_each_entry(j, &cb->clients, bssid_list) {
+            // update rssi
+            int rssi = get_rssi_iwinfo(j->client_addr);
+            int exp_thr = get_expected_throughput_iwinfo(j->client_addr);
+            double exp_thr_tmp = iee80211_calculate_expected_throughput_mbit(exp_thr);
+            dawn_log_debug("Expected throughput %f Mbit/sec\n", exp_thr_tmp);
+
+            if (rssi != INT_MIN) {
+                pthread_mutex_unlock(&probe_array_mutex);
+                if (!probe_array_update_rssi(j->bssid_addr, j->client_addr, rssi, true)) {
+                    dawn_log_debug("Failed to update rssi!\n");
+                }
+                else {
+                    dawn_log_debug("Updated rssi: %d\n", rssi);
+                }
+                pthread_mutex_lock(&probe_array_mutex);
 
-        if (rssi != INT_MIN) {
-            pthread_mutex_unlock(&probe_array_mutex);
-            if (!probe_array_update_rssi(client_array[j].bssid_addr, client_array[j].client_addr, rssi, true)) {
-                printf("Failed to update rssi!\n");
             }
-            else {
-                printf("Updated rssi: %d\n", rssi);
-            }
-            pthread_mutex_lock(&probe_array_mutex);
-
         }
     }
 
-    printf("---------------------------\n");
+    dawn_log_debug("---------------------------\n");
 
     pthread_mutex_unlock(&probe_array_mutex);
     pthread_mutex_unlock(&client_array_mutex);
 }
 
 int is_connected_somehwere(uint8_t client_addr[]) {
-    int i;
-    int found_in_array = 0;
+    return client_array_get_client(client_addr) != NULL;
+}
 
-    if (client_entry_last == -1) {
-        return 0;
-    }
+static int is_connected(uint8_t bssid_addr[], uint8_t client_addr[]) {
+    return client_array_find(bssid_addr, client_addr) != NULL;
+}
 
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(client_addr, client_array[i].client_addr)) {
-            found_in_array = 1;
-            break;
+int storage_limit(int limit, int default_limit) {
+    return limit < 0 ? default_limit : limit;
+}
+
+// Resize a dynamic array so it can hold n entries, shrinking it once it is mostly unused.
+// On allocation failure the old array is returned unchanged, so callers check *size.
+static void* storage_array_fit(void* array, int* size, size_t entry_size, int n) {
+    int new_size = *size;
+
+    if (n > new_size) {
+        if (new_size == 0) {
+            new_size = STORAGE_ARRAY_MIN_SIZE;
+        }
+        while (n > new_size) {
+            new_size *= 2;
         }
+    } else if (new_size > STORAGE_ARRAY_MIN_SIZE && n < new_size / 4) {
+        new_size /= 2;
+    }
+
+    if (new_size == *size) {
+        return array;
+    }
+
+    void* new_array = realloc(array, new_size * entry_size);
+    if (new_array == NULL) {
+        dawn_log_error("Failed to resize array!\n");
+        return array;
     }
-    return found_in_array;
+
+    *size = new_size;
+    return new_array;
 }
 
-static int is_connected(uint8_t bssid_addr[], uint8_t client_addr[]) {
-    int i;
-    int found_in_array = 0;
+// Make room for a new client by dropping the least recently updated one
+static void client_array_evict() {
+    dawn_stats.evictions[DAWN_STATS_TABLE_CLIENT]++;
+    client_array_remove(list_first_entry(&client_entry_list, client, list));
+}
 
-    if (client_entry_last == -1) {
-        return 0;
+client* client_array_insert(const client* entry) {
+    int limit = storage_limit(storage_config.client_limit, ARRAY_CLIENT_LEN);
+
+    if (limit > 0 && client_entry_count >= limit) {
+        client_array_evict();
     }
 
-    for (i = 0; i <= client_entry_last; i++) {
+    if (client_entry_count >= client_hash_size) {
+        client_hash_grow();
+    }
 
-        if (mac_is_equal(bssid_addr, client_array[i].bssid_addr) &&
-            mac_is_equal(client_addr, client_array[i].client_addr)) {
-            found_in_array = 1;
-            break;
+    client* new_entry = slab_alloc(&client_slab);
+    if (new_entry == NULL) {
+        dawn_log_error("Failed to allocate client entry! Dropping entry!\n");
+        return NULL;
+    }
+
+    client_bssid** cb = client_bssid_find(entry->bssid_addr);
+    if (*cb == NULL) {
+        *cb = slab_alloc(&client_bssid_slab);
+        if (*cb == NULL) {
+            dawn_log_error("Failed to allocate client BSSID entry! Dropping entry!\n");
+            slab_free(&client_slab, new_entry);
+            return NULL;
         }
+
+        (*cb)->next_hash = NULL;
+        memcpy((*cb)->bssid_addr, entry->bssid_addr, ETH_ALEN);
+        INIT_LIST_HEAD(&(*cb)->clients);
+        (*cb)->client_count = 0;
     }
-    return found_in_array;
+
+    *new_entry = *entry;
+    new_entry->bssid = *cb;
+
+    client** i = client_hash_find(entry->bssid_addr, entry->client_addr);
+    new_entry->next_hash = *i;
+    *i = new_entry;
+
+    i = client_addr_hash_find(entry->client_addr, NULL);
+    new_entry->next_client_hash = *i;
+    *i = new_entry;
+
+    // neighbours are linked around the new entry and never move
+    list_add_tail(&new_entry->bssid_list, &(*cb)->clients);
+    (*cb)->client_count++;
+    client_expiry_link(new_entry);
+    client_entry_count++;
+
+    return new_entry;
 }
 
-static int client_array_go_next_help(char sort_order[], int i, client entry,
-                              client next_entry) {
-    switch (sort_order[i]) {
-        // bssid-mac
-        case 'b':
-            return mac_is_greater(entry.bssid_addr, next_entry.bssid_addr);
-            // client-mac
-        case 'c':
-            return mac_is_greater(entry.client_addr, next_entry.client_addr) &&
-                   mac_is_equal(entry.bssid_addr, next_entry.bssid_addr);
-        default:
-            break;
+static client_bssid** client_bssid_find(const uint8_t bssid_addr[]) {
+    client_bssid** i = &client_bssid_hash[mac_hash(bssid_addr, MAC_HASH_INIT) & (CLIENT_BSSID_HASH_SIZE - 1)];
+
+    while (*i != NULL && !mac_is_equal(bssid_addr, (*i)->bssid_addr)) {
+        i = &(*i)->next_hash;
     }
-    return 0;
+
+    return i;
 }
 
-static int client_array_go_next(char sort_order[], int i, client entry,
-                         client next_entry) {
-    int conditions = 1;
-    for (int j = 0; j < i; j++) {
-        i &= !(client_array_go_next(sort_order, j, entry, next_entry));
+client_bssid* client_array_get_bssid(const uint8_t bssid_addr[]) {
+    return *client_bssid_find(bssid_addr);
+}
+
+static client** client_hash_find(const uint8_t bssid_addr[], const uint8_t client_addr[]) {
+    uint32_t hash = mac_hash(client_addr, mac_hash(bssid_addr, MAC_HASH_INIT));
+    client** i = &client_hash[hash & (client_hash_size - 1)];
+
+    while (*i != NULL && !(mac_is_equal(bssid_addr, (*i)->bssid_addr) &&
+                           mac_is_equal(client_addr, (*i)->client_addr))) {
+        i = &(*i)->next_hash;
     }
-    return conditions && client_array_go_next_help(sort_order, i, entry, next_entry);
+
+    return i;
 }
 
-void client_array_insert(client entry) {
-    if (client_entry_last == -1) {
-        client_array[0] = entry;
-        client_entry_last++;
+// Find the link to the first entry of a client, or to entry itself if it is given
+static client** client_addr_hash_find(const uint8_t client_addr[], const client* entry) {
+    client** i = &client_addr_hash[mac_hash(client_addr, MAC_HASH_INIT) & (client_hash_size - 1)];
+
+    while (*i != NULL && (entry != NULL ? *i != entry : !mac_is_equal(client_addr, (*i)->client_addr))) {
+        i = &(*i)->next_client_hash;
+    }
+
+    return i;
+}
+
+static void client_hash_grow() {
+    unsigned int new_size = client_hash_size * 2;
+    client** new_hash = calloc(new_size, sizeof(client*));
+    client** new_addr_hash = calloc(new_size, sizeof(client*));
+
+    // keep going with longer chains if there is no memory
+    if (new_hash == NULL || new_addr_hash == NULL) {
+        dawn_log_error("Failed to grow client hash!\n");
+        free(new_hash);
+        free(new_addr_hash);
         return;
     }
 
-    int i;
-    for (i = 0; i <= client_entry_last; i++) {
-        if (!client_array_go_next("bc", 2, entry, client_array[i])) {
-            break;
-        }
+    client* i;
+    list_for_each_entry(i, &client_entry_list, list) {
+        uint32_t hash = mac_hash(i->client_addr, mac_hash(i->bssid_addr, MAC_HASH_INIT));
+        i->next_hash = new_hash[hash & (new_size - 1)];
+        new_hash[hash & (new_size - 1)] = i;
+
+        hash = mac_hash(i->client_addr, MAC_HASH_INIT);
+        i->next_client_hash = new_addr_hash[hash & (new_size - 1)];
+        new_addr_hash[hash & (new_size - 1)] = i;
     }
-    for (int j = client_entry_last; j >= i; j--) {
-        if (j + 1 <= ARRAY_CLIENT_LEN) {
-            client_array[j + 1] = client_array[j];
-        }
+
+    if (client_hash != client_hash_initial) {
+        free(client_hash);
+        free(client_addr_hash);
     }
-    client_array[i] = entry;
+    client_hash = new_hash;
+    client_addr_hash = new_addr_hash;
+    client_hash_size = new_size;
+}
+
+client* client_array_find(const uint8_t bssid_addr[], const uint8_t client_addr[]) {
+    return *client_hash_find(bssid_addr, client_addr);
+}
 
-    if (client_entry_last < ARRAY_CLIENT_LEN) {
-        client_entry_last++;
+// BSSIDs without clients are released here and not in client_array_remove(), so a
+// walk over the clients of one BSSID keeps its list head while entries move away.
+static void client_bssid_sweep() {
+    for (int n = 0; n < CLIENT_BSSID_HASH_SIZE; n++) {
+        client_bssid** i = &client_bssid_hash[n];
+
+        while (*i != NULL) {
+            if ((*i)->client_count == 0) {
+                client_bssid* empty = *i;
+
+                *i = empty->next_hash;
+                slab_free(&client_bssid_slab, empty);
+            }
+            else {
+                i = &(*i)->next_hash;
+            }
+        }
     }
 }
 
-client client_array_get_client(const uint8_t* client_addr) {
-    if (client_entry_last == -1) {
-        client nc = { .client_addr = {0, 0, 0, 0, 0, 0} };
+client* client_array_get_client(const uint8_t* client_addr) {
+    return *client_addr_hash_find(client_addr, NULL);
+}
 
-        return nc;
+static void client_array_remove(client* entry) {
+    *client_hash_find(entry->bssid_addr, entry->client_addr) = entry->next_hash;
+    *client_addr_hash_find(entry->client_addr, entry) = entry->next_client_hash;
+    list_del(&entry->bssid_list);
+    entry->bssid->client_count--;
+    list_del(&entry->list);
+    slab_free(&client_slab, entry);
+    client_entry_count--;
+}
+
+int client_array_touch_bssid(const uint8_t bssid_addr[], time_t time) {
+    client_bssid* cb = client_array_get_bssid(bssid_addr);
+    int touched = 0;
+
+    if (cb == NULL) {
+        return 0;
     }
 
-    //pthread_mutex_lock(&client_array_mutex);
-    int i;
+    client* i;
+    list_for_each_entry(i, &cb->clients, bssid_list) {
+        if (i->time != time) {
+            i->time = time;
+            list_del(&i->list);
+            client_expiry_link(i);
+        }
+        touched++;
+    }
 
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(client_addr, client_array[i].client_addr)) {
-            break;
+    return touched;
+}
+
+int client_array_remove_stale_bssid(const uint8_t bssid_addr[], time_t time) {
+    client_bssid* cb = client_array_get_bssid(bssid_addr);
+    int removed = 0;
+
+    if (cb == NULL) {
+        return 0;
+    }
+
+    client *i, *next;
+    list_for_each_entry_safe(i, next, &cb->clients, bssid_list) {
+        if (i->time < time) {
+            client_array_remove(i);
+            removed++;
         }
     }
-    //pthread_mutex_unlock(&client_array_mutex);
 
-    return client_array[i];
+    return removed;
 }
 
-client client_array_delete(client entry) {
+int client_array_delete(const client* entry) {
+    // TODO: Why check BSSID here?  Aren't entries unique by client MAC?
+    client* i = client_array_find(entry->bssid_addr, entry->client_addr);
 
-    int i;
-    int found_in_array = 0;
-    client tmp;
+    if (i == NULL) {
+        return 0;
+    }
 
-    if (client_entry_last == -1) {
-        return tmp;
+    client_array_remove(i);
+    return 1;
+}
+
+
+static probe_entry** probe_array_find(const uint8_t bssid_addr[], const uint8_t client_addr[]) {
+    uint32_t hash = mac_hash(client_addr, mac_hash(bssid_addr, MAC_HASH_INIT));
+    probe_entry** i = &probe_hash[hash & (probe_hash_size - 1)];
+
+    while (*i != NULL && !(mac_is_equal(bssid_addr, (*i)->bssid_addr) &&
+                           mac_is_equal(client_addr, (*i)->client_addr))) {
+        i = &(*i)->next_hash;
     }
 
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(entry.bssid_addr, client_array[i].bssid_addr) && // TODO: Why check BSSID here?  Aren't entries unique by client MAC?
-            mac_is_equal(entry.client_addr, client_array[i].client_addr)) {
-            found_in_array = 1;
-            tmp = client_array[i];
-            break;
-        }
+    return i;
+}
+
+static probe_client** probe_client_find(const uint8_t client_addr[]) {
+    probe_client** i = &probe_client_hash[mac_hash(client_addr, MAC_HASH_INIT) & (probe_client_hash_size - 1)];
+
+    while (*i != NULL && !mac_is_equal(client_addr, (*i)->client_addr)) {
+        i = &(*i)->next_hash;
     }
 
-    for (int j = i; j < client_entry_last; j++) {
-        client_array[j] = client_array[j + 1];
+    return i;
+}
+
+// Keep the per client list in the order given by sort_string
+static void probe_client_link(probe_client* pc, probe_entry* entry) {
+    probe_entry** i = &pc->probes;
+
+    while (*i != NULL && go_next(sort_string, SORT_LENGTH, entry, *i)) {
+        i = &(*i)->next_client_probe;
     }
 
-    if (client_entry_last > -1 && found_in_array) {
-        client_entry_last--;
+    entry->next_client_probe = *i;
+    *i = entry;
+}
+
+static void probe_client_unlink(probe_client* pc, probe_entry* entry) {
+    probe_entry** i = &pc->probes;
+
+    while (*i != NULL && *i != entry) {
+        i = &(*i)->next_client_probe;
+    }
+
+    if (*i != NULL) {
+        *i = entry->next_client_probe;
     }
-    return tmp;
 }
 
+static void probe_hash_grow() {
+    unsigned int new_size = probe_hash_size * 2;
+    probe_entry** new_hash = calloc(new_size, sizeof(probe_entry*));
 
-void probe_array_insert(probe_entry entry) {
-    if (probe_entry_last == -1) {
-        probe_array[0] = entry;
-        probe_entry_last++;
+    // keep going with longer chains if there is no memory
+    if (new_hash == NULL) {
+        dawn_log_error("Failed to grow probe hash!\n");
         return;
     }
 
-    int i;
-    for (i = 0; i <= probe_entry_last; i++) {
-        if (!go_next(sort_string, SORT_LENGTH, entry, probe_array[i])) {
-            break;
+    for (unsigned int i = 0; i < probe_hash_size; i++) {
+        probe_entry* entry = probe_hash[i];
+
+        while (entry != NULL) {
+            probe_entry* next = entry->next_hash;
+            uint32_t hash = mac_hash(entry->client_addr, mac_hash(entry->bssid_addr, MAC_HASH_INIT));
+
+            entry->next_hash = new_hash[hash & (new_size - 1)];
+            new_hash[hash & (new_size - 1)] = entry;
+            entry = next;
         }
     }
-    for (int j = probe_entry_last; j >= i; j--) {
-        if (j + 1 <= PROBE_ARRAY_LEN) {
-            probe_array[j + 1] = probe_array[j];
+
+    if (probe_hash != probe_hash_initial) {
+        free(probe_hash);
+    }
+    probe_hash = new_hash;
+    probe_hash_size = new_size;
+}
+
+static void probe_client_hash_grow() {
+    unsigned int new_size = probe_client_hash_size * 2;
+    probe_client** new_hash = calloc(new_size, sizeof(probe_client*));
+
+    // keep going with longer chains if there is no memory
+    if (new_hash == NULL) {
+        dawn_log_error("Failed to grow probe client hash!\n");
+        return;
+    }
+
+    for (unsigned int i = 0; i < probe_client_hash_size; i++) {
+        probe_client* pc = probe_client_hash[i];
+
+        while (pc != NULL) {
+            probe_client* next = pc->next_hash;
+            uint32_t hash = mac_hash(pc->client_addr, MAC_HASH_INIT);
+
+            pc->next_hash = new_hash[hash & (new_size - 1)];
+            new_hash[hash & (new_size - 1)] = pc;
+            pc = next;
         }
     }
-    probe_array[i] = entry;
 
-    if (probe_entry_last < PROBE_ARRAY_LEN) {
-        probe_entry_last++;
+    if (probe_client_hash != probe_client_hash_initial) {
+        free(probe_client_hash);
     }
+    probe_client_hash = new_hash;
+    probe_client_hash_size = new_size;
 }
 
-probe_entry probe_array_delete(probe_entry entry) {
-    int i;
-    int found_in_array = 0;
-    probe_entry tmp;
+probe_client* probe_array_get_client(const uint8_t client_addr[]) {
+    return *probe_client_find(client_addr);
+}
 
-    if (probe_entry_last == -1) {
-        return tmp;
+void probe_array_insert(probe_entry entry) {
+    int limit = storage_limit(storage_config.probe_limit, PROBE_ARRAY_LEN);
+
+    // make room by dropping the least recently updated entry, it is the oldest
+    if (limit > 0 && probe_entry_count >= limit) {
+        dawn_stats.evictions[DAWN_STATS_TABLE_PROBE]++;
+        probe_array_remove(list_first_entry(&probe_lru_list, probe_entry, lru));
     }
 
-    for (i = 0; i <= probe_entry_last; i++) {
-        if (mac_is_equal(entry.bssid_addr, probe_array[i].bssid_addr) &&
-            mac_is_equal(entry.client_addr, probe_array[i].client_addr)) {
-            found_in_array = 1;
-            tmp = probe_array[i];
-            break;
-        }
+    if (probe_entry_count >= probe_hash_size) {
+        probe_hash_grow();
     }
 
-    for (int j = i; j < probe_entry_last; j++) {
-        probe_array[j] = probe_array[j + 1];
+    if (probe_client_count >= probe_client_hash_size) {
+        probe_client_hash_grow();
     }
 
-    if (probe_entry_last > -1 && found_in_array) {
-        probe_entry_last--;
+    probe_entry* new_entry = slab_alloc(&probe_slab);
+    probe_client** pc_ref = probe_client_find(entry.client_addr);
+
+    if (new_entry == NULL) {
+        dawn_log_error("Failed to allocate probe entry!\n");
+        return;
     }
-    return tmp;
+
+    if (*pc_ref == NULL) {
+        probe_client* pc = slab_alloc(&probe_client_slab);
+
+        if (pc == NULL) {
+            dawn_log_error("Failed to allocate probe entry!\n");
+            slab_free(&probe_slab, new_entry);
+            return;
+        }
+
+        memcpy(pc->client_addr, entry.client_addr, ETH_ALEN);
+        pc->probes = NULL;
+        pc->next_hash = NULL;
+        list_add_tail(&pc->list, &probe_client_list);
+        *pc_ref = pc;
+        probe_client_count++;
+    }
+
+    *new_entry = entry;
+    new_entry->score_cache.metric_generation = 0;
+
+    probe_entry** i = probe_array_find(entry.bssid_addr, entry.client_addr);
+    new_entry->next_hash = *i;
+    *i = new_entry;
+
+    probe_client_link(*pc_ref, new_entry);
+    (*pc_ref)->best_score.metric_generation = 0;
+    probe_expiry_link(new_entry);
+    probe_entry_count++;
 }
 
-int probe_array_set_all_probe_count(uint8_t client_addr[], uint32_t probe_count) {
+// The lists used for expiry are ordered by time.  Updates are usually the newest entry, so
+// search from the tail and expiry can stop at the first entry that is still fresh.
+static void probe_expiry_link(probe_entry* entry) {
+    struct list_head* i = probe_lru_list.prev;
 
-    int updated = 0;
+    while (i != &probe_lru_list && list_entry(i, probe_entry, lru)->time > entry->time) {
+        i = i->prev;
+    }
 
-    if (probe_entry_last == -1) {
-        return 0;
+    list_add(&entry->lru, i);
+}
+
+static void client_expiry_link(client* entry) {
+    struct list_head* i = client_entry_list.prev;
+
+    while (i != &client_entry_list && list_entry(i, client, list)->time > entry->time) {
+        i = i->prev;
     }
 
-    pthread_mutex_lock(&probe_array_mutex);
-    for (int i = 0; i <= probe_entry_last; i++) {
-        if (mac_is_equal(client_addr, probe_array[i].client_addr)) {
-            printf("Setting probecount for given mac!\n");
-            probe_array[i].counter = probe_count;
-        } else if (!mac_is_greater(client_addr, probe_array[i].client_addr)) {
-            printf("MAC not found!\n");
-            break;
-        }
+    list_add(&entry->list, i);
+}
+
+static void ap_expiry_link(ap* entry) {
+    struct list_head* i = ap_expiry_list.prev;
+
+    while (i != &ap_expiry_list && list_entry(i, ap, expiry)->time > entry->time) {
+        i = i->prev;
     }
-    pthread_mutex_unlock(&probe_array_mutex);
 
-    return updated;
+    list_add(&entry->expiry, i);
 }
 
-int probe_array_update_rssi(uint8_t bssid_addr[], uint8_t client_addr[], uint32_t rssi, int send_network)
-{
-    int updated = 0;
+static void probe_array_remove(probe_entry* entry) {
+    probe_entry** i = probe_array_find(entry->bssid_addr, entry->client_addr);
+    probe_client** pc_ref = probe_client_find(entry->client_addr);
+    probe_client* pc = *pc_ref;
+
+    *i = entry->next_hash;
+
+    probe_client_unlink(pc, entry);
+    pc->best_score.metric_generation = 0;
+    if (pc->probes == NULL) {
+        *pc_ref = pc->next_hash;
+        list_del(&pc->list);
+        slab_free(&probe_client_slab, pc);
+        probe_client_count--;
+    }
+
+    list_del(&entry->lru);
+    slab_free(&probe_slab, entry);
+    probe_entry_count--;
+}
+
+int probe_array_delete(const probe_entry* entry) {
+    probe_entry* i = *probe_array_find(entry->bssid_addr, entry->client_addr);
 
-    if (probe_entry_last == -1) {
+    if (i == NULL) {
         return 0;
     }
 
+    probe_array_remove(i);
+    return 1;
+}
+
+int probe_array_set_all_probe_count(uint8_t client_addr[], uint32_t probe_count) {
+
+    int updated = 0;
 
     pthread_mutex_lock(&probe_array_mutex);
-    for (int i = 0; i <= probe_entry_last; i++) {
-        if (mac_is_equal(bssid_addr, probe_array[i].bssid_addr) &&
-            mac_is_equal(client_addr, probe_array[i].client_addr)) {
-            probe_array[i].signal = rssi;
-            updated = 1;
-            if(send_network)
-            {
-                ubus_send_probe_via_network(probe_array[i]);
-            }
-            break;
-            //TODO: break?!
+    probe_client* pc = *probe_client_find(client_addr);
+    if (pc == NULL) {
+        dawn_log_debug("MAC not found!\n");
+    }
+    else {
+        for (probe_entry* i = pc->probes; i != NULL; i = i->next_client_probe) {
+            dawn_log_debug("Setting probecount for given mac!\n");
+            i->counter = probe_count;
         }
     }
     pthread_mutex_unlock(&probe_array_mutex);
@@ -726,28 +1183,27 @@ int probe_array_update_rssi(uint8_t bssid_addr[], uint8_t client_addr[], uint32_
     return updated;
 }
 
-int probe_array_update_rcpi_rsni(uint8_t bssid_addr[], uint8_t client_addr[], uint32_t rcpi, uint32_t rsni, int send_network)
+int probe_array_update_rssi(uint8_t bssid_addr[], uint8_t client_addr[], uint32_t rssi, int send_network)
 {
     int updated = 0;
 
-    if (probe_entry_last == -1) {
-        return 0;
-    }
-
-
     pthread_mutex_lock(&probe_array_mutex);
-    for (int i = 0; i <= probe_entry_last; i++) {
-        if (mac_is_equal(bssid_addr, probe_array[i].bssid_addr) &&
-            mac_is_equal(client_addr, probe_array[i].client_addr)) {
-            probe_array[i].rcpi = rcpi;
-            probe_array[i].rsni = rsni;
-            updated = 1;
-            if(send_network)
-            {
-                ubus_send_probe_via_network(probe_array[i]);
-            }
-            break;
-            //TODO: break?!
+    probe_entry* i = *probe_array_find(bssid_addr, client_addr);
+    if (i != NULL) {
+        probe_client* pc = *probe_client_find(client_addr);
+
+        // signal may be part of the sort order
+        probe_client_unlink(pc, i);
+        if (i->signal != rssi) {
+            i->signal = rssi;
+            i->score_cache.metric_generation = 0;
+            pc->best_score.metric_generation = 0;
+        }
+        probe_client_link(pc, i);
+        updated = 1;
+        if(send_network)
+        {
+            ubus_send_probe_via_network(*i);
         }
     }
     pthread_mutex_unlock(&probe_array_mutex);
@@ -755,53 +1211,59 @@ int probe_array_update_rcpi_rsni(uint8_t bssid_addr[], uint8_t client_addr[], ui
     return updated;
 }
 
-probe_entry probe_array_get_entry(uint8_t bssid_addr[], uint8_t client_addr[]) {
-
-    int i;
-    probe_entry tmp = {.bssid_addr = {0, 0, 0, 0, 0, 0}, .client_addr = {0, 0, 0, 0, 0, 0}};
-
-    if (probe_entry_last == -1) {
-        return tmp;
-    }
+int probe_array_update_rcpi_rsni(uint8_t bssid_addr[], uint8_t client_addr[], uint32_t rcpi, uint32_t rsni, int send_network)
+{
+    int updated = 0;
 
     pthread_mutex_lock(&probe_array_mutex);
-    for (i = 0; i <= probe_entry_last; i++) {
-        if (mac_is_equal(bssid_addr, probe_array[i].bssid_addr) &&
-            mac_is_equal(client_addr, probe_array[i].client_addr)) {
-            tmp = probe_array[i];
-            break;
+    probe_entry* i = *probe_array_find(bssid_addr, client_addr);
+    if (i != NULL) {
+        i->rcpi = rcpi;
+        i->rsni = rsni;
+        updated = 1;
+        if(send_network)
+        {
+            ubus_send_probe_via_network(*i);
         }
     }
     pthread_mutex_unlock(&probe_array_mutex);
 
-    return tmp;
+    return updated;
+}
+
+probe_entry* probe_array_get_entry(const uint8_t bssid_addr[], const uint8_t client_addr[]) {
+    return *probe_array_find(bssid_addr, client_addr);
 }
 
 void print_probe_array() {
+    pthread_mutex_lock(&probe_array_mutex);
     printf("------------------\n");
-    printf("Probe Entry Last: %d\n", probe_entry_last);
-    for (int i = 0; i <= probe_entry_last; i++) {
-        print_probe_entry(probe_array[i]);
+    printf("Probe Entry Count: %d\n", probe_entry_count);
+    probe_client* pc;
+    list_for_each_entry(pc, &probe_client_list, list) {
+        for (probe_entry* i = pc->probes; i != NULL; i = i->next_client_probe) {
+            print_probe_entry(i);
+        }
     }
     printf("------------------\n");
+    pthread_mutex_unlock(&probe_array_mutex);
 }
 
 probe_entry insert_to_array(probe_entry entry, int inc_counter, int save_80211k, int is_beacon) {
     pthread_mutex_lock(&probe_array_mutex);
 
     entry.counter = 0;
-    probe_entry tmp = probe_array_delete(entry);
+    probe_entry* tmp = *probe_array_find(entry.bssid_addr, entry.client_addr);
 
-    if (mac_is_equal(entry.bssid_addr, tmp.bssid_addr)
-        && mac_is_equal(entry.client_addr, tmp.client_addr)) {
-        entry.counter = tmp.counter;
+    if (tmp != NULL) {
+        entry.counter = tmp->counter;
 
         if(save_80211k)
         {
-            if (tmp.rcpi != -1)
-                entry.rcpi = tmp.rcpi;
-            if (tmp.rsni != -1)
-                entry.rsni = tmp.rsni;
+            if (tmp->rcpi != -1)
+                entry.rcpi = tmp->rcpi;
+            if (tmp->rsni != -1)
+                entry.rsni = tmp->rsni;
         }
     }
 
@@ -810,21 +1272,134 @@ probe_entry insert_to_array(probe_entry entry, int inc_counter, int save_80211k,
         entry.counter++;
     }
 
-    probe_array_insert(entry);
+    if (tmp != NULL) {
+        // update in place, only the position in the per client list may change
+        probe_client* pc = *probe_client_find(entry.client_addr);
+
+        probe_client_unlink(pc, tmp);
+        entry.next_hash = tmp->next_hash;
+        entry.lru = tmp->lru;
+        entry.score_cache = tmp->score_cache;
+        if (!probe_score_inputs_equal(&entry, tmp)) {
+            entry.score_cache.metric_generation = 0;
+            pc->best_score.metric_generation = 0;
+        }
+        *tmp = entry;
+        probe_client_link(pc, tmp);
+        list_del(&tmp->lru);
+        probe_expiry_link(tmp);
+    }
+    else {
+        probe_array_insert(entry);
+    }
 
     pthread_mutex_unlock(&probe_array_mutex);
 
     return entry;
 }
 
-ap insert_to_ap_array(ap entry) {
+void insert_to_ap_array(const ap* entry) {
     pthread_mutex_lock(&ap_array_mutex);
 
-    ap_array_delete(entry);
-    ap_array_insert(entry);
+    ap* old_entry = ap_array_get_ap(entry->bssid_addr);
+
+    // the position only depends on SSID and BSSID, so an update can stay in place
+    if (old_entry != NULL && strcmp((char *) old_entry->ssid, (char *) entry->ssid) == 0) {
+        struct list_head list = old_entry->list;
+        uint32_t generation = old_entry->generation;
+        int publish = !ap_snapshot_inputs_equal(old_entry, entry);
+
+        // keep cached probe scores if nothing they depend on changed
+        if (!ap_score_inputs_equal(old_entry, entry)) {
+            generation = ap_generation_next();
+        }
+
+        list_del(&old_entry->expiry);
+        *old_entry = *entry;
+        old_entry->list = list;
+        old_entry->generation = generation;
+        ap_expiry_link(old_entry);
+
+        // most updates only refresh the time, which the snapshot readers do not need
+        if (publish) {
+            ap_snapshot_publish();
+        }
+    }
+    else {
+        if (old_entry != NULL) {
+            ap_array_remove(old_entry);
+        }
+        ap_array_insert(entry);
+    }
+
     pthread_mutex_unlock(&ap_array_mutex);
+}
 
-    return entry;
+const ap_snapshot* ap_snapshot_get() {
+    __atomic_add_fetch(&ap_snapshot_readers, 1, __ATOMIC_SEQ_CST);
+    ap_snapshot* snapshot = __atomic_load_n(&ap_snapshot_current, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&ap_snapshot_readers, 1, __ATOMIC_SEQ_CST);
+
+    return snapshot;
+}
+
+void ap_snapshot_put(const ap_snapshot* snapshot) {
+    ap_snapshot* s = (ap_snapshot*) snapshot;
+
+    if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_SEQ_CST) == 0) {
+        free(s);
+    }
+}
+
+static int ap_snapshot_compare(const void* a, const void* b) {
+    return memcmp(((const ap*) a)->bssid_addr, ((const ap*) b)->bssid_addr, ETH_ALEN);
+}
+
+const ap* ap_snapshot_get_ap(const ap_snapshot* snapshot, const uint8_t bssid_addr[]) {
+    ap key;
+
+    memcpy(key.bssid_addr, bssid_addr, ETH_ALEN);
+    return bsearch(&key, snapshot->entries, snapshot->count, sizeof(ap), ap_snapshot_compare);
+}
+
+// Replace the published snapshot with a copy of the AP table.  Caller must hold ap_array_mutex.
+static void ap_snapshot_publish() {
+    ap_snapshot* snapshot = malloc(sizeof(ap_snapshot) + ap_entry_count * sizeof(ap));
+
+    // readers keep the previous version until the next update
+    if (snapshot == NULL) {
+        dawn_log_error("Failed to allocate AP snapshot!\n");
+        return;
+    }
+
+    snapshot->refs = 1;
+    snapshot->generation = ap_generation;
+    snapshot->count = 0;
+
+    ap* i;
+    list_for_each_entry(i, &ap_entry_list, list) {
+        snapshot->entries[snapshot->count++] = *i;
+    }
+    qsort(snapshot->entries, snapshot->count, sizeof(ap), ap_snapshot_compare);
+
+    ap_snapshot* old = __atomic_exchange_n(&ap_snapshot_current, snapshot, __ATOMIC_SEQ_CST);
+
+    // a reader that loaded the old pointer has taken its reference once this drops to 0
+    while (__atomic_load_n(&ap_snapshot_readers, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+
+    ap_snapshot_put(old);
+}
+
+static uint32_t ap_generation_next() {
+    // 0 is never used so a probe scored without an AP entry is recalculated once it appears
+    if (++ap_generation == 0) {
+        ap_generation++;
+    }
+
+    return ap_generation;
 }
 
 
@@ -832,147 +1407,185 @@ ap insert_to_ap_array(ap entry) {
 int ap_get_collision_count(int col_domain) {
 
     int ret_sta_count = 0;
+    ap* i;
 
-    pthread_mutex_lock(&ap_array_mutex);
-    int i;
-
-    for (i = 0; i <= ap_entry_last; i++) {
-        if (ap_array[i].collision_domain == col_domain)
-            ret_sta_count += ap_array[i].station_count;
+    list_for_each_entry(i, &ap_entry_list, list) {
+        if (i->collision_domain == col_domain)
+            ret_sta_count += i->station_count;
     }
-    pthread_mutex_unlock(&ap_array_mutex);
 
     return ret_sta_count;
 }
 
-ap ap_array_get_ap(uint8_t bssid_addr[]) {
-    ap ret = {.bssid_addr = {0, 0, 0, 0, 0, 0}};
+ap* ap_array_get_ap(const uint8_t bssid_addr[]) {
+    ap* i;
 
-    if (ap_entry_last == -1) {
-        return ret;
+    list_for_each_entry(i, &ap_entry_list, list) {
+        if (mac_is_equal(bssid_addr, i->bssid_addr)) {
+            return i;
+        }
     }
 
-    pthread_mutex_lock(&ap_array_mutex);
-    int i;
+    return NULL;
+}
 
-    for (i = 0; i <= ap_entry_last; i++) {
-        if (mac_is_equal(bssid_addr, ap_array[i].bssid_addr)) {
-            //|| mac_is_greater(ap_array[i].bssid_addr, bssid_addr)) {
-            break;
-        }
-    }
-    ret = ap_array[i];
-    pthread_mutex_unlock(&ap_array_mutex);
+static void ap_array_remove(ap* entry) {
+    ap_generation_next();
+    list_del(&entry->list);
+    list_del(&entry->expiry);
+    slab_free(&ap_slab, entry);
+    ap_entry_count--;
+}
 
-    return ret;
+// Make room for a new AP by dropping the least recently updated one
+static void ap_array_evict() {
+    dawn_stats.evictions[DAWN_STATS_TABLE_AP]++;
+    ap_array_remove(list_first_entry(&ap_expiry_list, ap, expiry));
 }
 
-void ap_array_insert(ap entry) {
-    if (ap_entry_last == -1) {
-        ap_array[0] = entry;
-        ap_entry_last++;
-        return;
+ap* ap_array_insert(const ap* entry) {
+    int limit = storage_limit(storage_config.ap_limit, ARRAY_AP_LEN);
+
+    if (limit > 0 && ap_entry_count >= limit) {
+        ap_array_evict();
     }
 
-    int i;
-    for (i = 0; i <= ap_entry_last; i++) {
-        if (mac_is_greater(entry.bssid_addr, ap_array[i].bssid_addr) &&
-            strcmp((char *) entry.ssid, (char *) ap_array[i].ssid) == 0) {
+    ap* new_entry = slab_alloc(&ap_slab);
+    if (new_entry == NULL) {
+        dawn_log_error("Failed to allocate AP entry! Dropping entry!\n");
+        return NULL;
+    }
+
+    *new_entry = *entry;
+    new_entry->generation = ap_generation_next();
+
+    ap* i;
+    list_for_each_entry(i, &ap_entry_list, list) {
+        if (mac_is_greater(new_entry->bssid_addr, i->bssid_addr) &&
+            strcmp((char *) new_entry->ssid, (char *) i->ssid) == 0) {
             continue;
         }
 
-        if (!string_is_greater(entry.ssid, ap_array[i].ssid)) {
+        if (!string_is_greater(new_entry->ssid, i->ssid)) {
             break;
         }
 
     }
-    for (int j = ap_entry_last; j >= i; j--) {
-        if (j + 1 <= ARRAY_AP_LEN) {
-            ap_array[j + 1] = ap_array[j];
-        }
-    }
-    ap_array[i] = entry;
 
-    if (ap_entry_last < ARRAY_AP_LEN) {
-        ap_entry_last++;
-    }
+    // neighbours are linked around the new entry and never move
+    list_add_tail(&new_entry->list, &i->list);
+    ap_expiry_link(new_entry);
+    ap_entry_count++;
+    ap_snapshot_publish();
+
+    return new_entry;
 }
 
-ap ap_array_delete(ap entry) {
-    int i;
-    int found_in_array = 0;
-    ap tmp;
+int ap_array_delete(const ap* entry) {
+    ap* i;
 
-    if (ap_entry_last == -1) {
-        return tmp;
+    list_for_each_entry(i, &ap_entry_list, list) {
+        if (mac_is_equal(entry->bssid_addr, i->bssid_addr)) {
+            ap_array_remove(i);
+            ap_snapshot_publish();
+            return 1;
+        }
     }
 
-    for (i = 0; i <= ap_entry_last; i++) {
-        if (mac_is_equal(entry.bssid_addr, ap_array[i].bssid_addr)) {
-            found_in_array = 1;
-            tmp = ap_array[i];
+    return 0;
+}
+
+int remove_old_client_entries(time_t current_time, long long int threshold) {
+    int removed = 0;
+
+    client *i, *next;
+    list_for_each_entry_safe(i, next, &client_entry_list, list) {
+        if (i->time >= current_time - threshold) {
             break;
         }
+        client_array_remove(i);
+        removed++;
     }
 
-    for (int j = i; j < ap_entry_last; j++) {
-        ap_array[j] = ap_array[j + 1];
-    }
+    client_bssid_sweep();
 
-    if (ap_entry_last > -1 && found_in_array) {
-        ap_entry_last--;
-    }
-    return tmp;
+    dawn_stats.expired[DAWN_STATS_TABLE_CLIENT] += removed;
+    return removed;
 }
 
-void remove_old_client_entries(time_t current_time, long long int threshold) {
-    int i = 0;
-    while (i <= client_entry_last) {
-        if (client_array[i].time < current_time - threshold) {
-            client_array_delete(client_array[i]);
+int remove_old_probe_entries(time_t current_time, long long int threshold) {
+    int removed = 0;
+
+    probe_entry *i, *next;
+    list_for_each_entry_safe(i, next, &probe_lru_list, lru) {
+        if (i->time >= current_time - threshold) {
+            break;
         }
-        else {
-            i++;
+
+        // probes of connected clients stay, only those are visited again next time
+        if (!is_connected(i->bssid_addr, i->client_addr)) {
+            probe_array_remove(i);
+            removed++;
         }
     }
+
+    dawn_stats.expired[DAWN_STATS_TABLE_PROBE] += removed;
+    return removed;
 }
 
-void remove_old_probe_entries(time_t current_time, long long int threshold) {
-    int i = 0;
-    while (i <= probe_entry_last) {
-        if ((probe_array[i].time < current_time - threshold) && !is_connected(probe_array[i].bssid_addr, probe_array[i].client_addr)) {
-            probe_array_delete(probe_array[i]);
-        }
-        else {
-            i++;
+int remove_old_ap_entries(time_t current_time, long long int threshold) {
+    int removed = 0;
+
+    ap *i, *next;
+    list_for_each_entry_safe(i, next, &ap_expiry_list, expiry) {
+        if (i->time >= current_time - threshold) {
+            break;
         }
+        ap_array_remove(i);
+        removed++;
     }
-}
 
-void remove_old_ap_entries(time_t current_time, long long int threshold) {
-    int i = 0;
-    while (i <= ap_entry_last) {
-        if (ap_array[i].time < current_time - threshold) {
-            ap_array_delete(ap_array[i]);
-        }
-        else {
-            i++;
-        }
+    if (removed > 0) {
+        ap_snapshot_publish();
     }
+
+    dawn_stats.expired[DAWN_STATS_TABLE_AP] += removed;
+    return removed;
 }
 
-void insert_client_to_array(client entry) {
+void insert_client_to_array(const client* entry) {
     pthread_mutex_lock(&client_array_mutex);
-    entry.kick_count = 0;
-
-    client client_tmp = client_array_delete(entry);
 
-    if (mac_is_equal(entry.bssid_addr, client_tmp.bssid_addr)) {
-        entry.kick_count = client_tmp.kick_count;
+    client* i = client_array_find(entry->bssid_addr, entry->client_addr);
+
+    if (i != NULL) {
+        // update in place, the BSSID and so the position in the lists and hash chains stay the same
+        struct list_head list = i->list;
+        struct list_head bssid_list = i->bssid_list;
+        client* next_hash = i->next_hash;
+        client* next_client_hash = i->next_client_hash;
+        client_bssid* cb = i->bssid;
+        uint32_t kick_count = i->kick_count;
+
+        *i = *entry;
+        i->list = list;
+        i->bssid_list = bssid_list;
+        i->next_hash = next_hash;
+        i->next_client_hash = next_client_hash;
+        i->bssid = cb;
+        i->kick_count = kick_count;
+
+        list_del(&i->list);
+        client_expiry_link(i);
+    }
+    else {
+        i = client_array_insert(entry);
+
+        if (i != NULL) {
+            i->kick_count = 0;
+        }
     }
 
-    client_array_insert(entry);
-
     pthread_mutex_unlock(&client_array_mutex);
 }
 
@@ -988,8 +1601,8 @@ void insert_macs_from_file() {
         exit(EXIT_FAILURE);
 
     while ((read = getline(&line, &len, fp)) != -1) {
-        printf("Retrieved line of length %zu :\n", read);
-        printf("%s", line);
+        dawn_log_debug("Retrieved line of length %zu :\n", read);
+        dawn_log_debug("%s", line);
 
         int tmp_int_mac[ETH_ALEN];
         sscanf(line, MACSTR, STR2MAC(tmp_int_mac));
@@ -1000,11 +1613,9 @@ void insert_macs_from_file() {
         }
     }
 
-    printf("Printing MAC list:\n");
+    dawn_log_debug("Printing MAC list:\n");
     for (int i = 0; i <= mac_list_entry_last; i++) {
-        char mac_buf_target[20];
-        sprintf(mac_buf_target, MACSTR, MAC2STR(mac_list[i]));
-        printf("%d: %s\n", i, mac_buf_target);
+        dawn_log_debug("%d: " MACSTR "\n", i, MAC2STR(mac_list[i]));
     }
 
     fclose(fp);
@@ -1086,7 +1697,33 @@ static int denied_req_array_go_next(char sort_order[], int i, auth_entry entry,
     return conditions && denied_req_array_go_next_help(sort_order, i, entry, next_entry);
 }
 
+// Make room for a new request by dropping the least recently updated one
+static void denied_req_array_evict() {
+    int oldest = 0;
+
+    for (int i = 1; i <= denied_req_last; i++) {
+        if (denied_req_array[i].time < denied_req_array[oldest].time) {
+            oldest = i;
+        }
+    }
+
+    dawn_stats.evictions[DAWN_STATS_TABLE_DENIED_REQ]++;
+    denied_req_array_delete(denied_req_array[oldest]);
+}
+
 void denied_req_array_insert(auth_entry entry) {
+    int limit = storage_limit(storage_config.denied_req_limit, DENY_REQ_ARRAY_LEN);
+
+    if (limit > 0 && denied_req_last + 1 >= limit) {
+        denied_req_array_evict();
+    }
+
+    denied_req_array = storage_array_fit(denied_req_array, &denied_req_array_size, sizeof(auth_entry), denied_req_last + 2);
+    if (denied_req_last + 1 >= denied_req_array_size) {
+        dawn_log_warn("Denied request array is full! Dropping entry!\n");
+        return;
+    }
+
     if (denied_req_last == -1) {
         denied_req_array[0] = entry;
         denied_req_last++;
@@ -1100,15 +1737,11 @@ void denied_req_array_insert(auth_entry entry) {
         }
     }
     for (int j = denied_req_last; j >= i; j--) {
-        if (j + 1 <= DENY_REQ_ARRAY_LEN) {
-            denied_req_array[j + 1] = denied_req_array[j];
-        }
+        denied_req_array[j + 1] = denied_req_array[j];
     }
     denied_req_array[i] = entry;
 
-    if (denied_req_last < DENY_REQ_ARRAY_LEN) {
-        denied_req_last++;
-    }
+    denied_req_last++;
 }
 
 auth_entry denied_req_array_delete(auth_entry entry) {
@@ -1136,38 +1769,67 @@ auth_entry denied_req_array_delete(auth_entry entry) {
 
     if (denied_req_last > -1 && found_in_array) {
         denied_req_last--;
+        denied_req_array = storage_array_fit(denied_req_array, &denied_req_array_size, sizeof(auth_entry), denied_req_last + 1);
     }
     return tmp;
 }
 
-static int go_next_help(char sort_order[], int i, probe_entry entry,
-                 probe_entry next_entry) {
+int remove_old_denied_req_entries(time_t current_time, long long int threshold, void (*expired)(const auth_entry* entry)) {
+    int kept = 0;
+
+    for (int i = 0; i <= denied_req_last; i++) {
+        if (denied_req_array[i].time < current_time - threshold) {
+            if (expired != NULL) {
+                expired(&denied_req_array[i]);
+            }
+        }
+        else {
+            if (kept != i) {
+                denied_req_array[kept] = denied_req_array[i];
+            }
+            kept++;
+        }
+    }
+
+    int removed = denied_req_last + 1 - kept;
+
+    if (removed > 0) {
+        denied_req_last = kept - 1;
+        denied_req_array = storage_array_fit(denied_req_array, &denied_req_array_size, sizeof(auth_entry), kept);
+    }
+
+    dawn_stats.expired[DAWN_STATS_TABLE_DENIED_REQ] += removed;
+    return removed;
+}
+
+static int go_next_help(char sort_order[], int i, const probe_entry* entry,
+                 const probe_entry* next_entry) {
     switch (sort_order[i]) {
         // bssid-mac
         case 'b':
-            return mac_is_greater(entry.bssid_addr, next_entry.bssid_addr) &&
-                   mac_is_equal(entry.client_addr, next_entry.client_addr);
+            return mac_is_greater(entry->bssid_addr, next_entry->bssid_addr) &&
+                   mac_is_equal(entry->client_addr, next_entry->client_addr);
             break;
 
             // client-mac
         case 'c':
-            return mac_is_greater(entry.client_addr, next_entry.client_addr);
+            return mac_is_greater(entry->client_addr, next_entry->client_addr);
             break;
 
             // frequency
             // mac is 5 ghz or 2.4 ghz?
         case 'f':
-            return //entry.freq < next_entry.freq &&
-                    entry.freq < 5000 &&
-                    next_entry.freq >= 5000 &&
-                    //entry.freq < 5 &&
-                    mac_is_equal(entry.client_addr, next_entry.client_addr);
+            return //entry->freq < next_entry->freq &&
+                    entry->freq < 5000 &&
+                    next_entry->freq >= 5000 &&
+                    //entry->freq < 5 &&
+                    mac_is_equal(entry->client_addr, next_entry->client_addr);
             break;
 
             // signal strength (RSSI)
         case 's':
-            return entry.signal < next_entry.signal &&
-                   mac_is_equal(entry.client_addr, next_entry.client_addr);
+            return entry->signal < next_entry->signal &&
+                   mac_is_equal(entry->client_addr, next_entry->client_addr);
             break;
 
         default:
@@ -1176,8 +1838,8 @@ static int go_next_help(char sort_order[], int i, probe_entry entry,
     }
 }
 
-static int go_next(char sort_order[], int i, probe_entry entry,
-            probe_entry next_entry) {
+static int go_next(char sort_order[], int i, const probe_entry* entry,
+            const probe_entry* next_entry) {
     int conditions = 1;
     for (int j = 0; j < i; j++) {
         i &= !(go_next(sort_order, j, entry, next_entry));
@@ -1186,22 +1848,22 @@ static int go_next(char sort_order[], int i, probe_entry entry,
 }
 
 
-void print_probe_entry(probe_entry entry) {
+void print_probe_entry(const probe_entry* entry) {
 #ifndef DAWN_NO_OUTPUT
     char mac_buf_ap[20];
     char mac_buf_client[20];
     char mac_buf_target[20];
 
-    sprintf(mac_buf_ap, MACSTR, MAC2STR(entry.bssid_addr));
-    sprintf(mac_buf_client, MACSTR, MAC2STR(entry.client_addr));
-    sprintf(mac_buf_target, MACSTR, MAC2STR(entry.target_addr));
+    sprintf(mac_buf_ap, MACSTR, MAC2STR(entry->bssid_addr));
+    sprintf(mac_buf_client, MACSTR, MAC2STR(entry->client_addr));
+    sprintf(mac_buf_target, MACSTR, MAC2STR(entry->target_addr));
 
 
     printf(
             "bssid_addr: %s, client_addr: %s, signal: %d, freq: "
             "%d, counter: %d, vht: %d, min_rate: %d, max_rate: %d\n",
-            mac_buf_ap, mac_buf_client, entry.signal, entry.freq, entry.counter, entry.vht_capabilities,
-            entry.min_supp_datarate, entry.max_supp_datarate);
+            mac_buf_ap, mac_buf_client, entry->signal, entry->freq, entry->counter, entry->vht_capabilities,
+            entry->min_supp_datarate, entry->max_supp_datarate);
 #endif
 }
 
@@ -1222,54 +1884,58 @@ void print_auth_entry(auth_entry entry) {
 #endif
 }
 
-void print_client_entry(client entry) {
+void print_client_entry(const client* entry) {
 #ifndef DAWN_NO_OUTPUT
     char mac_buf_ap[20];
     char mac_buf_client[20];
 
-    sprintf(mac_buf_ap, MACSTR, MAC2STR(entry.bssid_addr));
-    sprintf(mac_buf_client, MACSTR, MAC2STR(entry.client_addr));
+    sprintf(mac_buf_ap, MACSTR, MAC2STR(entry->bssid_addr));
+    sprintf(mac_buf_client, MACSTR, MAC2STR(entry->client_addr));
 
     printf("bssid_addr: %s, client_addr: %s, freq: %d, ht_supported: %d, vht_supported: %d, ht: %d, vht: %d, kick: %d\n",
-           mac_buf_ap, mac_buf_client, entry.freq, entry.ht_supported, entry.vht_supported, entry.ht, entry.vht,
-           entry.kick_count);
+           mac_buf_ap, mac_buf_client, entry->freq, entry->ht_supported, entry->vht_supported, entry->ht, entry->vht,
+           entry->kick_count);
 #endif
 }
 
 void print_client_array() {
     printf("--------Clients------\n");
-    printf("Client Entry Last: %d\n", client_entry_last);
-    for (int i = 0; i <= client_entry_last; i++) {
-        print_client_entry(client_array[i]);
+    printf("Client Entry Count: %d\n", client_entry_count);
+    client* i;
+    list_for_each_entry(i, &client_entry_list, list) {
+        print_client_entry(i);
     }
     printf("------------------\n");
 }
 
-static void print_ap_entry(ap entry) {
+static void print_ap_entry(const ap* entry) {
 #ifndef DAWN_NO_OUTPUT
     char mac_buf_ap[20];
 
-    sprintf(mac_buf_ap, MACSTR, MAC2STR(entry.bssid_addr));
+    sprintf(mac_buf_ap, MACSTR, MAC2STR(entry->bssid_addr));
     printf("ssid: %s, bssid_addr: %s, freq: %d, ht: %d, vht: %d, chan_utilz: %d, col_d: %d, bandwidth: %d, col_count: %d neighbor_report: %s\n",
-           entry.ssid, mac_buf_ap, entry.freq, entry.ht_support, entry.vht_support,
-           entry.channel_utilization, entry.collision_domain, entry.bandwidth,
-           ap_get_collision_count(entry.collision_domain), entry.neighbor_report
+           entry->ssid, mac_buf_ap, entry->freq, entry->ht_support, entry->vht_support,
+           entry->channel_utilization, entry->collision_domain, entry->bandwidth,
+           ap_get_collision_count(entry->collision_domain), entry->neighbor_report
     );
 #endif
 }
 
 void print_ap_array() {
+    pthread_mutex_lock(&ap_array_mutex);
     printf("--------APs------\n");
-    for (int i = 0; i <= ap_entry_last; i++) {
-        print_ap_entry(ap_array[i]);
+    ap* i;
+    list_for_each_entry(i, &ap_entry_list, list) {
+        print_ap_entry(i);
     }
     printf("------------------\n");
+    pthread_mutex_unlock(&ap_array_mutex);
 }
 
 void destroy_mutex() {
 
     // free resources
-    fprintf(stdout, "Freeing mutex resources\n");
+    dawn_log_debug("Freeing mutex resources\n");
     pthread_mutex_destroy(&probe_array_mutex);
     pthread_mutex_destroy(&client_array_mutex);
     pthread_mutex_destroy(&ap_array_mutex);
@@ -1280,22 +1946,22 @@ void destroy_mutex() {
 int init_mutex() {
 
     if (pthread_mutex_init(&probe_array_mutex, NULL) != 0) {
-        fprintf(stderr, "Mutex init failed!\n");
+        dawn_log_error("Mutex init failed!\n");
         return 1;
     }
 
     if (pthread_mutex_init(&client_array_mutex, NULL) != 0) {
-        fprintf(stderr, "Mutex init failed!\n");
+        dawn_log_error("Mutex init failed!\n");
         return 1;
     }
 
     if (pthread_mutex_init(&ap_array_mutex, NULL) != 0) {
-        fprintf(stderr, "Mutex init failed!\n");
+        dawn_log_error("Mutex init failed!\n");
         return 1;
     }
 
     if (pthread_mutex_init(&denied_array_mutex, NULL) != 0) {
-        fprintf(stderr, "Mutex init failed!\n");
+        dawn_log_error("Mutex init failed!\n");
         return 1;
     }
     return 0;
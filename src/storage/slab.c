@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+struct slab_chunk {
+    struct list_head list; // partial or full list of the slab
+    void* free_list; // entries given back, linked through their first word
+    int used;
+    int unused; // index of the first entry never handed out
+};
+
+// Entries start after the chunk header, aligned like malloc() memory.  max_align_t
+// needs C11, so this is its gnu99 equivalent.
+typedef union {
+    long long ll;
+    long double ld;
+    void* p;
+} slab_max_align;
+
+#define SLAB_ALIGNMENT __alignof__(slab_max_align)
+#define SLAB_ALIGN(x) (((x) + SLAB_ALIGNMENT - 1) & ~(SLAB_ALIGNMENT - 1))
+#define SLAB_HEADER_SIZE SLAB_ALIGN(sizeof(struct slab_chunk))
+
+static struct slab_chunk* slab_chunk_of(void* entry) {
+    return (struct slab_chunk*) ((uintptr_t) entry & ~((uintptr_t) SLAB_CHUNK_SIZE - 1));
+}
+
+void* slab_alloc(struct slab* s) {
+    struct slab_chunk* chunk;
+    void* entry;
+
+    if (s->entries_per_chunk == 0) {
+        s->entry_size = SLAB_ALIGN(s->entry_size);
+        s->entries_per_chunk = (SLAB_CHUNK_SIZE - SLAB_HEADER_SIZE) / s->entry_size;
+    }
+
+    if (list_empty(&s->partial)) {
+        void* mem;
+
+        if (posix_memalign(&mem, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE) != 0) {
+            fprintf(stderr, "Failed to allocate slab chunk!\n");
+            return NULL;
+        }
+
+        chunk = mem;
+        chunk->free_list = NULL;
+        chunk->used = 0;
+        chunk->unused = 0;
+        list_add(&chunk->list, &s->partial);
+        s->chunk_count++;
+    }
+
+    chunk = list_first_entry(&s->partial, struct slab_chunk, list);
+
+    if (chunk->free_list != NULL) {
+        entry = chunk->free_list;
+        chunk->free_list = *(void**) entry;
+    }
+    else {
+        entry = (char*) chunk + SLAB_HEADER_SIZE + chunk->unused * s->entry_size;
+        chunk->unused++;
+    }
+
+    chunk->used++;
+    if (chunk->used == s->entries_per_chunk) {
+        list_del(&chunk->list);
+        list_add(&chunk->list, &s->full);
+    }
+
+    s->entry_count++;
+    return entry;
+}
+
+void slab_free(struct slab* s, void* entry) {
+    struct slab_chunk* chunk = slab_chunk_of(entry);
+
+    *(void**) entry = chunk->free_list;
+    chunk->free_list = entry;
+
+    if (chunk->used == s->entries_per_chunk) {
+        list_del(&chunk->list);
+        list_add(&chunk->list, &s->partial);
+    }
+
+    chunk->used--;
+    s->entry_count--;
+
+    // keep the last chunk around to avoid allocation ping-pong on an almost empty table
+    if (chunk->used == 0 && s->chunk_count > 1) {
+        list_del(&chunk->list);
+        free(chunk);
+        s->chunk_count--;
+    }
+}
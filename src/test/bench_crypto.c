@@ -0,0 +1,110 @@
+// Microbenchmark of the message encryption paths.
+// Each round trip encrypts a message the way a sender does and decrypts it
+// the way a receiver does, including the allocations and copies involved:
+//   ecb+base64 - UDP with use_symm_enc = 1
+//   ecb        - TCP with use_symm_enc = 1
+//   aead       - UDP and TCP with use_symm_enc = 2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libubox/utils.h>
+
+#include "crypto.h"
+
+#define BENCH_KEY "Niiiiiiiiiiiiick"
+#define BENCH_IV "Niiiiiiiiiiiiick"
+
+static double bench_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int round_trip_ecb_base64(char *msg, size_t len) {
+    int length_enc;
+    char *enc = gcrypt_encrypt_msg(msg, len + 1, &length_enc);
+    char *b64 = malloc(B64_ENCODE_LEN(length_enc));
+    int b64_len = b64_encode(enc, length_enc, b64, B64_ENCODE_LEN(length_enc));
+    free(enc);
+
+    char *b64_dec = malloc(B64_DECODE_LEN(b64_len));
+    int dec_len = b64_decode(b64, b64_dec, B64_DECODE_LEN(b64_len));
+    char *dec = gcrypt_decrypt_msg(b64_dec, dec_len);
+    int ok = dec && strcmp(dec, msg) == 0;
+
+    free(b64);
+    free(b64_dec);
+    free(dec);
+    return ok;
+}
+
+static int round_trip_ecb(char *msg, size_t len) {
+    int length_enc, dec_len;
+    char *enc = gcrypt_encrypt_msg(msg, len + 1, &length_enc);
+    char *frame = malloc(length_enc + sizeof(uint32_t));
+    memcpy(frame + sizeof(uint32_t), enc, length_enc);
+    free(enc);
+
+    char *dec = gcrypt_decrypt_buf(frame + sizeof(uint32_t), length_enc, &dec_len);
+    int ok = dec && strcmp(dec, msg) == 0;
+
+    free(frame);
+    free(dec);
+    return ok;
+}
+
+static int round_trip_aead(char *msg, size_t len) {
+    char *frame = malloc(sizeof(uint32_t) + len + 1 + GCRYPT_AEAD_OVERHEAD);
+    char *body = frame + sizeof(uint32_t);
+    memcpy(body + GCRYPT_AEAD_NONCE_LEN, msg, len + 1);
+
+    int ok = gcrypt_aead_seal(body, len + 1) == 0 &&
+             gcrypt_aead_open(body, len + 1 + GCRYPT_AEAD_OVERHEAD) == len + 1 &&
+             strcmp(body + GCRYPT_AEAD_NONCE_LEN, msg) == 0;
+
+    free(frame);
+    return ok;
+}
+
+static void bench(const char *name, int (*round_trip)(char *, size_t), char *msg, size_t len, int iterations) {
+    double start = bench_now();
+
+    for (int i = 0; i < iterations; i++) {
+        if (!round_trip(msg, len)) {
+            fprintf(stderr, "%s: round trip failed\n", name);
+            exit(1);
+        }
+    }
+
+    double elapsed = bench_now() - start;
+    printf("%-12s %6zu bytes: %8.0f msgs/s %8.1f MB/s\n", name, len,
+           iterations / elapsed, iterations * (double) len / elapsed / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    static const size_t sizes[] = { 128, 512, 2048, 8192 };
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+    gcrypt_init();
+    gcrypt_set_key_and_iv(BENCH_KEY, BENCH_IV);
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char *msg = malloc(sizes[i] + 1);
+
+        // JSON like plaintext, the ECB padding must not cut it short
+        memset(msg, 'a', sizes[i]);
+        msg[0] = '{';
+        msg[sizes[i] - 1] = '}';
+        msg[sizes[i]] = '\0';
+
+        bench("ecb+base64", round_trip_ecb_base64, msg, sizes[i], iterations);
+        bench("ecb", round_trip_ecb, msg, sizes[i], iterations);
+        bench("aead", round_trip_aead, msg, sizes[i], iterations);
+        free(msg);
+    }
+
+    return 0;
+}
@@ -0,0 +1,417 @@
+// Benchmark of the storage and decision engine on a synthetic deployment.
+// Every AP hears its clients and some of its neighbours' clients. After the
+// initial load each round refreshes the APs, lets part of the clients send new
+// probes or roam, evaluates all clients and runs the expiry sweeps.
+// The result is written to stdout as JSON, latencies are in nanoseconds.
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "dawn_iwinfo.h"
+
+#include "datastorage.h"
+#include "ubus.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+#include "test_storage.h"
+
+#define BENCH_ROUND_SECONDS 10
+#define BENCH_EXPIRY 30
+
+enum {
+    BENCH_INSERT_AP,
+    BENCH_INSERT_CLIENT,
+    BENCH_INSERT_PROBE,
+    BENCH_UPDATE_PROBE,
+    BENCH_ROAM_CLIENT,
+    BENCH_ADMISSION,
+    BENCH_BETTER_AP,
+    BENCH_KICK_CLIENTS,
+    BENCH_SWEEP_PROBE,
+    BENCH_SWEEP_CLIENT,
+    BENCH_SWEEP_AP,
+    __BENCH_MAX
+};
+
+static const char *bench_names[__BENCH_MAX] = {
+        [BENCH_INSERT_AP] = "insert_to_ap_array",
+        [BENCH_INSERT_CLIENT] = "insert_client_to_array",
+        [BENCH_INSERT_PROBE] = "insert_to_array",
+        [BENCH_UPDATE_PROBE] = "insert_to_array_update",
+        [BENCH_ROAM_CLIENT] = "insert_client_to_array_roam",
+        [BENCH_ADMISSION] = "better_ap_available_admission",
+        [BENCH_BETTER_AP] = "better_ap_available_kick",
+        [BENCH_KICK_CLIENTS] = "kick_clients",
+        [BENCH_SWEEP_PROBE] = "remove_old_probe_entries",
+        [BENCH_SWEEP_CLIENT] = "remove_old_client_entries",
+        [BENCH_SWEEP_AP] = "remove_old_ap_entries",
+};
+
+// Durations in nanoseconds, the histograms do not care about the unit.  Their range then
+// ends at about 4 ms, slower operations only show up in the maximum.
+static struct dawn_histogram bench_hist[__BENCH_MAX];
+
+static int aps = 50;
+static int clients = 1000;
+static int probes_per_client = 5;
+static int rounds = 20;
+static int churn = 10; // percent of the clients that probe again or roam per round
+static int unlimited = 0;
+
+static time_t now = 1000000;
+static int *client_ap; // AP each client is associated with
+
+static int bench_mac_index(const uint8_t *mac);
+
+/*** Stub Functions - Called by SUT ***/
+void ubus_send_beacon_report(uint8_t client[], int id)
+{
+}
+
+int send_set_probe(uint8_t client_addr[])
+{
+    return 0;
+}
+
+// The client follows the transition at once, as with the test harness.  Without a usable
+// destination it is handled like in the daemon: kick_clients() drops it and stops.
+int wnm_disassoc_imminent(uint32_t id, const uint8_t* client_addr, char* dest_ap, uint32_t duration)
+{
+    uint8_t dest[ETH_ALEN];
+
+    if (dest_ap == NULL || hwaddr_aton(dest_ap, dest))
+        return 0;
+
+    client* mc = client_array_get_client(client_addr);
+    if (mc != NULL) {
+        client moved = *mc;
+
+        client_array_delete(mc);
+        memcpy(moved.bssid_addr, dest, ETH_ALEN);
+        client_array_insert(&moved);
+        client_ap[bench_mac_index(moved.client_addr)] = bench_mac_index(dest);
+    }
+
+    return 1;
+}
+
+void add_client_update_timer(time_t time)
+{
+}
+
+void del_client_interface(uint32_t id, const uint8_t* client_addr, uint32_t reason, uint8_t deauth, uint32_t ban_time)
+{
+}
+
+int ubus_send_probe_via_network(struct probe_entry_s probe_entry)
+{
+    return 0;
+}
+
+int get_rssi_iwinfo(uint8_t* client_addr)
+{
+    return 0;
+}
+
+int get_expected_throughput_iwinfo(uint8_t* client_addr)
+{
+    return 0;
+}
+
+int get_bandwidth_iwinfo(uint8_t* client_addr, float* rx_rate, float* tx_rate)
+{
+    *rx_rate = 0.0;
+    *tx_rate = 0.0;
+    return 0;
+}
+
+/*** Benchmark ***/
+static uint64_t bench_now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_done(int bench, uint64_t start) {
+    dawn_histogram_add(&bench_hist[bench], bench_now_ns() - start);
+}
+
+static void bench_mac(uint8_t *mac, uint8_t prefix, int i) {
+    mac[0] = 0x02;
+    mac[1] = prefix;
+    mac[2] = i >> 24;
+    mac[3] = i >> 16;
+    mac[4] = i >> 8;
+    mac[5] = i;
+}
+
+static int bench_mac_index(const uint8_t *mac) {
+    return mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5];
+}
+
+static void bench_metric() {
+    dawn_metric.ht_support = 10;
+    dawn_metric.vht_support = 100;
+    dawn_metric.rssi = 10;
+    dawn_metric.low_rssi = -500;
+    dawn_metric.freq = 100;
+    dawn_metric.max_chan_util = -500;
+    dawn_metric.rssi_val = -60;
+    dawn_metric.low_rssi_val = -80;
+    dawn_metric.chan_util_val = 140;
+    dawn_metric.max_chan_util_val = 170;
+    dawn_metric.min_probe_count = 2;
+    dawn_metric.bandwidth_threshold = 6;
+    dawn_metric.use_station_count = 1;
+    dawn_metric.max_station_diff = 1;
+    dawn_metric.min_kick_count = 3;
+    dawn_metric_generation++;
+
+    storage_config.probe_limit = unlimited ? 0 : -1;
+    storage_config.client_limit = unlimited ? 0 : -1;
+    storage_config.ap_limit = unlimited ? 0 : -1;
+    storage_config.denied_req_limit = unlimited ? 0 : -1;
+}
+
+static void bench_ap(int i) {
+    ap entry;
+
+    memset(&entry, 0, sizeof(entry));
+    bench_mac(entry.bssid_addr, 0xa0, i);
+    strcpy((char *) entry.ssid, "bench");
+    entry.freq = i % 2 ? 5180 : 2412;
+    entry.ht_support = 1;
+    entry.vht_support = i % 2;
+    entry.channel_utilization = rand() % 200;
+    entry.station_count = rand() % 30;
+    entry.time = now;
+    sprintf(entry.neighbor_report, MACSTR, MAC2STR(entry.bssid_addr));
+
+    uint64_t start = bench_now_ns();
+    insert_to_ap_array(&entry);
+    bench_done(BENCH_INSERT_AP, start);
+}
+
+static void bench_client(int i, int bench) {
+    client entry;
+
+    memset(&entry, 0, sizeof(entry));
+    bench_mac(entry.bssid_addr, 0xa0, client_ap[i]);
+    bench_mac(entry.client_addr, 0xc0, i);
+    entry.ht_supported = 1;
+    entry.vht_supported = 1;
+    entry.time = now;
+
+    uint64_t start = bench_now_ns();
+    insert_client_to_array(&entry);
+    bench_done(bench, start);
+}
+
+// The client is heard by its own AP and the next ones
+static void bench_probes(int i, int bench) {
+    probe_entry entry;
+
+    for (int j = 0; j < probes_per_client; j++) {
+        int ap_index = (client_ap[i] + j) % aps;
+
+        memset(&entry, 0, sizeof(entry));
+        bench_mac(entry.bssid_addr, 0xa0, ap_index);
+        bench_mac(entry.client_addr, 0xc0, i);
+        entry.signal = -40 - rand() % 50;
+        entry.freq = ap_index % 2 ? 5180 : 2412;
+        entry.ht_capabilities = 1;
+        entry.vht_capabilities = 1;
+        entry.rcpi = -1;
+        entry.rsni = -1;
+        entry.time = now;
+
+        uint64_t start = bench_now_ns();
+        insert_to_array(entry, true, true, false);
+        bench_done(bench, start);
+    }
+}
+
+static void bench_evaluate() {
+    uint8_t bssid[ETH_ALEN], client_addr[ETH_ALEN];
+    char neighbor_report[NEIGHBOR_REPORT_LEN];
+
+    for (int i = 0; i < clients; i++) {
+        bench_mac(bssid, 0xa0, client_ap[i]);
+        bench_mac(client_addr, 0xc0, i);
+
+        // requests are admitted without a neighbor report, that takes the best candidate
+        uint64_t start = bench_now_ns();
+        pthread_mutex_lock(&probe_array_mutex);
+        better_ap_available(bssid, client_addr, NULL, 0);
+        pthread_mutex_unlock(&probe_array_mutex);
+        bench_done(BENCH_ADMISSION, start);
+
+        // the kick evaluation compares all probes to build the report
+        neighbor_report[0] = '\0';
+
+        start = bench_now_ns();
+        pthread_mutex_lock(&probe_array_mutex);
+        better_ap_available(bssid, client_addr, neighbor_report, 0);
+        pthread_mutex_unlock(&probe_array_mutex);
+        bench_done(BENCH_BETTER_AP, start);
+    }
+
+    for (int i = 0; i < aps; i++) {
+        bench_mac(bssid, 0xa0, i);
+
+        uint64_t start = bench_now_ns();
+        kick_clients(bssid, 0);
+        bench_done(BENCH_KICK_CLIENTS, start);
+    }
+}
+
+static void bench_sweep() {
+    uint64_t start = bench_now_ns();
+    pthread_mutex_lock(&probe_array_mutex);
+    remove_old_probe_entries(now, BENCH_EXPIRY);
+    pthread_mutex_unlock(&probe_array_mutex);
+    bench_done(BENCH_SWEEP_PROBE, start);
+
+    start = bench_now_ns();
+    pthread_mutex_lock(&client_array_mutex);
+    remove_old_client_entries(now, BENCH_EXPIRY);
+    pthread_mutex_unlock(&client_array_mutex);
+    bench_done(BENCH_SWEEP_CLIENT, start);
+
+    start = bench_now_ns();
+    pthread_mutex_lock(&ap_array_mutex);
+    remove_old_ap_entries(now, BENCH_EXPIRY);
+    pthread_mutex_unlock(&ap_array_mutex);
+    bench_done(BENCH_SWEEP_AP, start);
+}
+
+static void bench_round() {
+    now += BENCH_ROUND_SECONDS;
+
+    for (int i = 0; i < aps; i++)
+        bench_ap(i);
+
+    // the same clients keep being active, the others expire
+    for (int i = 0; i < clients * churn / 100; i++) {
+        int c = rand() % clients;
+
+        // a client is associated with one AP only, the old one reports it as gone
+        if (rand() % 2) {
+            client entry;
+
+            bench_mac(entry.bssid_addr, 0xa0, client_ap[c]);
+            bench_mac(entry.client_addr, 0xc0, c);
+            pthread_mutex_lock(&client_array_mutex);
+            client_array_delete(&entry);
+            pthread_mutex_unlock(&client_array_mutex);
+
+            client_ap[c] = rand() % aps;
+            bench_client(c, BENCH_ROAM_CLIENT);
+        }
+        bench_probes(c, BENCH_UPDATE_PROBE);
+    }
+
+    bench_evaluate();
+    bench_sweep();
+}
+
+static void bench_print_json(double elapsed) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\n");
+    printf("  \"config\": {\"aps\": %d, \"clients\": %d, \"probes_per_client\": %d, \"rounds\": %d, "
+           "\"churn_percent\": %d, \"unlimited\": %s},\n",
+           aps, clients, probes_per_client, rounds, churn, unlimited ? "true" : "false");
+    printf("  \"elapsed_s\": %.3f,\n", elapsed);
+    printf("  \"peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+    printf("  \"entries\": {\"probe\": %d, \"client\": %d, \"ap\": %d},\n",
+           probe_entry_count, client_entry_count, ap_entry_count);
+    printf("  \"evictions\": {\"probe\": %" PRIu64 ", \"client\": %" PRIu64 ", \"ap\": %" PRIu64 "},\n",
+           dawn_stats.evictions[DAWN_STATS_TABLE_PROBE], dawn_stats.evictions[DAWN_STATS_TABLE_CLIENT],
+           dawn_stats.evictions[DAWN_STATS_TABLE_AP]);
+    printf("  \"expired\": {\"probe\": %" PRIu64 ", \"client\": %" PRIu64 ", \"ap\": %" PRIu64 "},\n",
+           dawn_stats.expired[DAWN_STATS_TABLE_PROBE], dawn_stats.expired[DAWN_STATS_TABLE_CLIENT],
+           dawn_stats.expired[DAWN_STATS_TABLE_AP]);
+    printf("  \"operations\": {\n");
+    for (int i = 0; i < __BENCH_MAX; i++) {
+        const struct dawn_histogram *h = &bench_hist[i];
+
+        printf("    \"%s\": {\"ops\": %" PRIu64 ", \"ops_per_sec\": %.0f, \"p50_ns\": %" PRIu64
+               ", \"p99_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}%s\n",
+               bench_names[i], h->count, h->sum_us ? h->count * 1e9 / h->sum_us : 0.0,
+               dawn_histogram_percentile(h, 50), dawn_histogram_percentile(h, 99), h->max_us,
+               i < __BENCH_MAX - 1 ? "," : "");
+    }
+    printf("  }\n");
+    printf("}\n");
+}
+
+static void bench_usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-a aps] [-c clients] [-p probes per client] [-r rounds] [-x churn percent] [-u] [-s seed]\n"
+                    "  -u : no soft limits on the table sizes\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:c:p:r:x:us:h")) != -1) {
+        switch (opt) {
+            case 'a': aps = atoi(optarg); break;
+            case 'c': clients = atoi(optarg); break;
+            case 'p': probes_per_client = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'x': churn = atoi(optarg); break;
+            case 'u': unlimited = 1; break;
+            case 's': seed = atoi(optarg); break;
+            default:
+                bench_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (aps <= 0 || clients <= 0 || probes_per_client <= 0 || rounds < 0 || churn < 0 || churn > 100) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    if (probes_per_client > aps)
+        probes_per_client = aps;
+
+    srand(seed);
+    strcpy(sort_string, "bcfs");
+    dawn_log_set_level(-1, DAWN_LOG_WARN);
+    init_mutex();
+    bench_metric();
+
+    client_ap = malloc(clients * sizeof(*client_ap));
+    if (!client_ap) {
+        fprintf(stderr, "not enough memory\n");
+        return 1;
+    }
+
+    uint64_t start = bench_now_ns();
+
+    for (int i = 0; i < aps; i++)
+        bench_ap(i);
+
+    for (int i = 0; i < clients; i++) {
+        client_ap[i] = i % aps;
+        bench_client(i, BENCH_INSERT_CLIENT);
+        bench_probes(i, BENCH_INSERT_PROBE);
+    }
+
+    for (int i = 0; i < rounds; i++)
+        bench_round();
+
+    bench_print_json((bench_now_ns() - start) / 1e9);
+
+    free(client_ap);
+    destroy_mutex();
+
+    return 0;
+}
@@ -6,11 +6,12 @@
 #include "datastorage.h"
 #include "msghandler.h"
 #include "ubus.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
 #include "test_storage.h"
 
 /*** Testing structures, etc ***/
 // pac_a_mac allows a 6-byte (48-bit) MAC address to be efficiently handled as a 64-bit integer
-#define MAC_MASK_PACKED_U64 0xFFFFFFFFFFFF0000
 union __attribute__((__packed__)) pac_a_mac
 {
     struct {
@@ -41,10 +42,16 @@ int ret = 0;
     if (dest_ap != NULL)
     {
         // Fake a client being disassociated and then rejoining on the recommended neoghbor
-        client mc = client_array_get_client(client_addr);
-        mc = client_array_delete(mc);
-        hwaddr_aton(dest_ap, mc.bssid_addr);
-        client_array_insert(mc);
+        client* mc = client_array_get_client(client_addr);
+
+        if (mc != NULL)
+        {
+            client moved = *mc;
+
+            client_array_delete(mc);
+            hwaddr_aton(dest_ap, moved.bssid_addr);
+            client_array_insert(&moved);
+        }
         printf("BSS TRANSITION TO %s\n", dest_ap);
 
         // Tell caller not to change the arrays any further
@@ -133,9 +140,9 @@ static int array_auto_helper(int action, int i0, int i1)
             memcpy(ap0.bssid_addr, &this_mac.unpacked.u8[0], sizeof(ap0.bssid_addr));
 
             if ((action & HELPER_ACTION_MASK) == HELPER_ACTION_ADD)
-                insert_to_ap_array(ap0);
+                insert_to_ap_array(&ap0);
             else
-                ap_array_delete(ap0);
+                ap_array_delete(&ap0);
             break;
         case HELPER_CLIENT:
             ; // Empty statement to allow label before declaration
@@ -144,9 +151,9 @@ static int array_auto_helper(int action, int i0, int i1)
             memcpy(client0.client_addr, &this_mac.unpacked.u8[0], sizeof(client0.client_addr));
 
             if ((action & HELPER_ACTION_MASK) == HELPER_ACTION_ADD)
-                insert_client_to_array(client0);
+                insert_client_to_array(&client0);
             else
-                client_array_delete(client0);
+                client_array_delete(&client0);
             break;
         case HELPER_PROBE_ARRAY:
             ; // Empty statement to allow label before declaration
@@ -157,7 +164,7 @@ static int array_auto_helper(int action, int i0, int i1)
             if ((action & HELPER_ACTION_MASK) == HELPER_ACTION_ADD)
                 insert_to_array(probe0, true, true, true); // TODO: Check bool flags
             else
-                probe_array_delete(probe0);
+                probe_array_delete(&probe0);
             break;
         case HELPER_AUTH_ENTRY:
             ; // Empty statement to allow label before declaration
@@ -351,6 +358,17 @@ static int consume_actions(int argc, char* argv[])
             }
             printf("------------------\n");
         }
+        else if (strcmp(*argv, "stats_show") == 0)
+        {
+            args_required = 1;
+
+            printf("--------Stats------\n");
+            for (int i = 0; i < __DAWN_STATS_TABLE_MAX; i++) {
+                printf("%s: evictions: %" PRIu64 ", expired: %" PRIu64 "\n", dawn_stats_table_name(i),
+                       dawn_stats.evictions[i], dawn_stats.expired[i]);
+            }
+            printf("------------------\n");
+        }
         else if (strcmp(*argv, "ap_add_auto") == 0)
         {
             args_required = 3;
@@ -420,7 +438,7 @@ static int consume_actions(int argc, char* argv[])
             args_required = 2;
             if (curr_arg + args_required <= argc)
             {
-                remove_old_ap_entries(faketime, atol(argv[1]));
+                printf("Removed %d AP entries\n", remove_old_ap_entries(faketime, atol(argv[1])));
             }
         }
         else if (strcmp(*argv, "remove_old_client_entries") == 0)
@@ -428,7 +446,7 @@ static int consume_actions(int argc, char* argv[])
             args_required = 2;
             if (curr_arg + args_required <= argc)
             {
-                remove_old_client_entries(faketime, atol(argv[1]));
+                printf("Removed %d client entries\n", remove_old_client_entries(faketime, atol(argv[1])));
             }
         }
         else if (strcmp(*argv, "remove_old_probe_entries") == 0)
@@ -436,7 +454,54 @@ static int consume_actions(int argc, char* argv[])
             args_required = 2;
             if (curr_arg + args_required <= argc)
             {
-                remove_old_probe_entries(faketime, atol(argv[1]));
+                printf("Removed %d probe entries\n", remove_old_probe_entries(faketime, atol(argv[1])));
+            }
+        }
+        else if (strcmp(*argv, "remove_old_auth_entries") == 0)
+        {
+            args_required = 2;
+            if (curr_arg + args_required <= argc)
+            {
+                printf("Removed %d auth entries\n", remove_old_denied_req_entries(faketime, atol(argv[1]), NULL));
+            }
+        }
+        else if (strcmp(*argv, "client_touch_bssid") == 0)
+        {
+            args_required = 2;
+            if (curr_arg + args_required <= argc)
+            {
+                uint8_t bssid_addr[ETH_ALEN];
+
+                load_mac(bssid_addr, argv[1]);
+                printf("Touched %d client entries\n", client_array_touch_bssid(bssid_addr, faketime));
+            }
+        }
+        else if (strcmp(*argv, "client_find") == 0)
+        {
+            args_required = 3;
+            if (curr_arg + args_required <= argc)
+            {
+                uint8_t bssid_addr[ETH_ALEN];
+                uint8_t client_addr[ETH_ALEN];
+
+                load_mac(bssid_addr, argv[1]);
+                load_mac(client_addr, argv[2]);
+                client* by_pair = client_array_find(bssid_addr, client_addr);
+                client* by_addr = client_array_get_client(client_addr);
+                printf("Client %s at %s: by BSSID %s, by address %s\n", argv[2], argv[1],
+                       by_pair != NULL ? "found" : "missing",
+                       by_addr != NULL && by_addr == by_pair ? "found" : "missing");
+            }
+        }
+        else if (strcmp(*argv, "client_remove_stale_bssid") == 0)
+        {
+            args_required = 2;
+            if (curr_arg + args_required <= argc)
+            {
+                uint8_t bssid_addr[ETH_ALEN];
+
+                load_mac(bssid_addr, argv[1]);
+                printf("Removed %d stale client entries\n", client_array_remove_stale_bssid(bssid_addr, faketime));
             }
         }
         else if (strcmp(*argv, "dawn") == 0) // Load metrics that configure DAWN
@@ -480,6 +545,10 @@ static int consume_actions(int argc, char* argv[])
                     dawn_metric.duration = 0;
                     dawn_metric.mode = 0;
                     dawn_metric.scan_channel = 0;
+                    storage_config.probe_limit = -1;
+                    storage_config.client_limit = -1;
+                    storage_config.ap_limit = -1;
+                    storage_config.denied_req_limit = -1;
                 }
                 else if (!strncmp(fn, "ap_weight=", 10)) load_int(&dawn_metric.ap_weight, fn + 10);
                 else if (!strncmp(fn, "ht_support=", 11)) load_int(&dawn_metric.ht_support, fn + 11);
@@ -513,6 +582,10 @@ static int consume_actions(int argc, char* argv[])
                 else if (!strncmp(fn, "duration=", 9)) load_int(&dawn_metric.duration, fn + 9);
                 else if (!strncmp(fn, "mode=", 5)) load_int(&dawn_metric.mode, fn + 5);
                 else if (!strncmp(fn, "scan_channel=", 13)) load_int(&dawn_metric.scan_channel, fn + 13);
+                else if (!strncmp(fn, "probe_limit=", 12)) load_int(&storage_config.probe_limit, fn + 12);
+                else if (!strncmp(fn, "client_limit=", 13)) load_int(&storage_config.client_limit, fn + 13);
+                else if (!strncmp(fn, "ap_limit=", 9)) load_int(&storage_config.ap_limit, fn + 9);
+                else if (!strncmp(fn, "denied_req_limit=", 17)) load_int(&storage_config.denied_req_limit, fn + 17);
                 else {
                     printf("ERROR: Loading DAWN control metrics, but don't recognise assignment \"%s\"\n", fn);
                     ret = 1;
@@ -521,6 +594,8 @@ static int consume_actions(int argc, char* argv[])
                 if (ret == 0)
                     args_required++;
             }
+
+            dawn_metric_generation++;
         }
         else if (strcmp(*argv, "macadd") == 0)
         {
@@ -596,7 +671,7 @@ static int consume_actions(int argc, char* argv[])
 
             if (ret == 0)
             {
-                insert_to_ap_array(ap0);
+                insert_to_ap_array(&ap0);
             }
         }
         else if (strcmp(*argv, "client") == 0)
@@ -660,7 +735,7 @@ static int consume_actions(int argc, char* argv[])
 
             if (ret == 0)
             {
-                insert_client_to_array(cl0);
+                insert_client_to_array(&cl0);
             }
         }
         else if (strcmp(*argv, "probe") == 0)
@@ -828,12 +903,11 @@ static int consume_actions(int argc, char* argv[])
                 load_mac(bssid_mac, argv[1]);
                 load_mac(client_mac, argv[2]);
 
-                probe_entry probe0 = probe_array_get_entry(bssid_mac, client_mac);
+                pthread_mutex_lock(&probe_array_mutex);
 
-                union pac_a_mac test_mac;
-                memcpy(test_mac.unpacked.u8, probe0.bssid_addr, sizeof(probe0.bssid_addr));
+                probe_entry* probe0 = probe_array_get_entry(bssid_mac, client_mac);
 
-                if ((test_mac.packed_u64 & MAC_MASK_PACKED_U64) == 0 )
+                if (probe0 == NULL)
                 {
                     printf("eval_probe_metric: Can't find probe entry!\n");
                 }
@@ -843,6 +917,8 @@ static int consume_actions(int argc, char* argv[])
                     printf("eval_probe_metric: Returned %d\n", this_metric);
                 }
 
+                pthread_mutex_unlock(&probe_array_mutex);
+
             }
         }
         else
@@ -965,6 +1041,8 @@ int main(int argc, char* argv[])
     else
     {
         strcpy(sort_string, "bcfs");
+        // the harness shows the reasoning behind each decision
+        dawn_log_set_level(-1, DAWN_LOG_DEBUG);
         init_mutex();
 
         // Step past command name on args, ie argv[0]
@@ -0,0 +1,89 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dawn_log.h"
+
+int dawn_log_level[__DAWN_LOG_CATEGORY_MAX] = {
+        [0 ... __DAWN_LOG_CATEGORY_MAX - 1] = DAWN_LOG_DEFAULT_LEVEL
+};
+
+static const char *dawn_log_level_names[] = {
+        [DAWN_LOG_ERROR] = "error",
+        [DAWN_LOG_WARN] = "warn",
+        [DAWN_LOG_INFO] = "info",
+        [DAWN_LOG_DEBUG] = "debug",
+};
+
+static const char *dawn_log_category_names[__DAWN_LOG_CATEGORY_MAX] = {
+        [DAWN_LOG_STORAGE] = "storage",
+        [DAWN_LOG_UBUS] = "ubus",
+        [DAWN_LOG_MSG] = "msg",
+        [DAWN_LOG_NETWORK] = "network",
+};
+
+void dawn_log_write(int category, int level, const char *format, ...) {
+    va_list ap;
+
+    va_start(ap, format);
+    vfprintf(level <= DAWN_LOG_WARN ? stderr : stdout, format, ap);
+    va_end(ap);
+}
+
+int dawn_log_ratelimit_pass(struct dawn_log_ratelimit *rl, int category, int level) {
+    time_t now = time(0);
+
+    if (now - rl->window_start >= DAWN_LOG_INTERVAL) {
+        if (rl->suppressed)
+            dawn_log_write(category, level, "%d %s messages suppressed\n", rl->suppressed,
+                           dawn_log_category_names[category]);
+
+        rl->window_start = now;
+        rl->count = 0;
+        rl->suppressed = 0;
+    }
+
+    if (rl->count >= DAWN_LOG_BURST) {
+        rl->suppressed++;
+        return 0;
+    }
+
+    rl->count++;
+    return 1;
+}
+
+void dawn_log_set_level(int category, int level) {
+    for (int i = 0; i < __DAWN_LOG_CATEGORY_MAX; i++) {
+        if (category < 0 || category == i)
+            dawn_log_level[i] = level;
+    }
+}
+
+int dawn_log_parse_level(const char *name) {
+    char *end;
+    long level;
+
+    if (!name || !*name)
+        return -1;
+
+    for (int i = 0; i <= DAWN_LOG_DEBUG; i++) {
+        if (strcmp(name, dawn_log_level_names[i]) == 0)
+            return i;
+    }
+
+    level = strtol(name, &end, 10);
+    if (*end || level < DAWN_LOG_ERROR || level > DAWN_LOG_DEBUG)
+        return -1;
+
+    return level;
+}
+
+int dawn_log_parse_category(const char *name) {
+    for (int i = 0; i < __DAWN_LOG_CATEGORY_MAX; i++) {
+        if (strcmp(name, dawn_log_category_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
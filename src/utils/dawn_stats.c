@@ -0,0 +1,203 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "dawn_stats.h"
+
+struct dawn_stats_s dawn_stats;
+
+static const char *dawn_stats_notify_names[__DAWN_STATS_NOTIFY_MAX] = {
+        [DAWN_STATS_NOTIFY_PROBE] = "probe",
+        [DAWN_STATS_NOTIFY_AUTH] = "auth",
+        [DAWN_STATS_NOTIFY_ASSOC] = "assoc",
+        [DAWN_STATS_NOTIFY_DEAUTH] = "deauth",
+        [DAWN_STATS_NOTIFY_BEACON_REPORT] = "beacon-report",
+};
+
+static const char *dawn_stats_msg_names[__DAWN_STATS_MSG_MAX] = {
+        [DAWN_STATS_MSG_PROBE] = "probe",
+        [DAWN_STATS_MSG_BATCH_PROBE] = "batch-probe",
+        [DAWN_STATS_MSG_CLIENTS] = "clients",
+        [DAWN_STATS_MSG_DELTA_CLIENTS] = "delta-clients",
+        [DAWN_STATS_MSG_DEAUTH] = "deauth",
+        [DAWN_STATS_MSG_SETPROBE] = "setprobe",
+        [DAWN_STATS_MSG_ADDMAC] = "addmac",
+        [DAWN_STATS_MSG_MACFILE] = "macfile",
+        [DAWN_STATS_MSG_UCI] = "uci",
+        [DAWN_STATS_MSG_BEACON_REPORT] = "beacon-report",
+        [DAWN_STATS_MSG_UNKNOWN] = "unknown",
+};
+
+static const char *dawn_stats_table_names[__DAWN_STATS_TABLE_MAX] = {
+        [DAWN_STATS_TABLE_PROBE] = "probe",
+        [DAWN_STATS_TABLE_CLIENT] = "client",
+        [DAWN_STATS_TABLE_AP] = "ap",
+        [DAWN_STATS_TABLE_DENIED_REQ] = "denied_req",
+};
+
+static const char *dawn_stats_event_names[__DAWN_STATS_EVENT_MAX] = {
+        [DAWN_STATS_EVENT_PROBE] = "probe",
+        [DAWN_STATS_EVENT_AUTH] = "auth",
+        [DAWN_STATS_EVENT_ASSOC] = "assoc",
+};
+
+static int dawn_histogram_bucket(uint64_t us);
+
+static uint64_t dawn_histogram_bucket_value(const struct dawn_histogram *h, int bucket);
+
+static void dawn_rate_roll(struct dawn_rate *r, time_t now);
+
+void dawn_stats_init() {
+    memset(&dawn_stats, 0, sizeof(dawn_stats));
+    dawn_stats.start = time(0);
+}
+
+uint64_t dawn_stats_now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Values below DAWN_HISTOGRAM_SUB_BUCKETS are counted exactly, above the bucket is
+// chosen by the position of the highest bit and the DAWN_HISTOGRAM_SUB_BITS below it
+static int dawn_histogram_bucket(uint64_t us) {
+    if (us < DAWN_HISTOGRAM_SUB_BUCKETS)
+        return us;
+
+    int msb = 63 - __builtin_clzll(us);
+    int bucket = (msb - DAWN_HISTOGRAM_SUB_BITS + 1) * DAWN_HISTOGRAM_SUB_BUCKETS +
+                 (int) (us >> (msb - DAWN_HISTOGRAM_SUB_BITS)) - DAWN_HISTOGRAM_SUB_BUCKETS;
+
+    return bucket < DAWN_HISTOGRAM_BUCKETS ? bucket : DAWN_HISTOGRAM_BUCKETS - 1;
+}
+
+void dawn_histogram_add(struct dawn_histogram *h, uint64_t us) {
+    h->count++;
+    h->sum_us += us;
+    h->buckets[dawn_histogram_bucket(us)]++;
+    if (us > h->max_us)
+        h->max_us = us;
+}
+
+void dawn_histogram_add_since(struct dawn_histogram *h, uint64_t start) {
+    dawn_histogram_add(h, dawn_stats_now_us() - start);
+}
+
+uint64_t dawn_histogram_bucket_limit(int bucket) {
+    if (bucket >= DAWN_HISTOGRAM_BUCKETS - 1)
+        return 0;
+
+    if (bucket < DAWN_HISTOGRAM_SUB_BUCKETS)
+        return bucket + 1;
+
+    int sub = bucket % DAWN_HISTOGRAM_SUB_BUCKETS;
+    return (uint64_t) (DAWN_HISTOGRAM_SUB_BUCKETS + sub + 1) << (bucket / DAWN_HISTOGRAM_SUB_BUCKETS - 1);
+}
+
+// Highest value a sample in the bucket may have had
+static uint64_t dawn_histogram_bucket_value(const struct dawn_histogram *h, int bucket) {
+    uint64_t limit = dawn_histogram_bucket_limit(bucket);
+
+    return limit && limit - 1 < h->max_us ? limit - 1 : h->max_us;
+}
+
+uint64_t dawn_histogram_percentile(const struct dawn_histogram *h, double percentile) {
+    double exact = h->count * percentile / 100;
+    uint64_t rank = (uint64_t) exact;
+    uint64_t seen = 0;
+
+    if (h->count == 0)
+        return 0;
+
+    // rounded up, the first sample has rank 1
+    if (rank < exact || rank == 0)
+        rank++;
+
+    for (int i = 0; i < DAWN_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return dawn_histogram_bucket_value(h, i);
+    }
+
+    return h->max_us;
+}
+
+void dawn_histogram_write(FILE *f, const char *name, const struct dawn_histogram *h) {
+    uint64_t seen = 0;
+
+    fprintf(f, "# %s, values in microseconds\n", name);
+    fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+    for (int i = 0; i < DAWN_HISTOGRAM_BUCKETS; i++) {
+        if (!h->buckets[i])
+            continue;
+
+        seen += h->buckets[i];
+        double fraction = (double) seen / h->count;
+
+        if (seen < h->count)
+            fprintf(f, "%12" PRIu64 " %14.12f %10" PRIu64 " %14.2f\n", dawn_histogram_bucket_value(h, i),
+                    fraction, seen, 1 / (1 - fraction));
+        else
+            fprintf(f, "%12" PRIu64 " %14.12f %10" PRIu64 "\n", dawn_histogram_bucket_value(h, i), fraction, seen);
+    }
+
+    fprintf(f, "#[Mean    = %12.3f, Max           = %12" PRIu64 "]\n",
+            h->count ? (double) h->sum_us / h->count : 0.0, h->max_us);
+    fprintf(f, "#[Total count    = %12" PRIu64 ", Buckets = %d, SubBuckets = %d]\n\n",
+            h->count, DAWN_HISTOGRAM_BUCKETS, DAWN_HISTOGRAM_SUB_BUCKETS);
+}
+
+void dawn_stats_notify_done(int notify, uint64_t start) {
+    uint64_t us = dawn_stats_now_us() - start;
+
+    dawn_histogram_add(&dawn_stats.notify[notify], us);
+    if (us > DAWN_NOTIFY_BUDGET_US)
+        dawn_stats.notify_over_budget[notify]++;
+}
+
+// Start a new window once the current one is over, a window without events is not seen
+static void dawn_rate_roll(struct dawn_rate *r, time_t now) {
+    if (now - r->window_start < DAWN_STATS_RATE_INTERVAL)
+        return;
+
+    r->last_count = now - r->window_start < 2 * DAWN_STATS_RATE_INTERVAL ? r->window_count : 0;
+    r->window_count = 0;
+    r->window_start = now;
+}
+
+void dawn_rate_inc(struct dawn_rate *r) {
+    dawn_rate_roll(r, time(0));
+    r->total++;
+    r->window_count++;
+}
+
+double dawn_rate_get(struct dawn_rate *r) {
+    dawn_rate_roll(r, time(0));
+    return (double) r->last_count / DAWN_STATS_RATE_INTERVAL;
+}
+
+int dawn_stats_msg_lookup(const char *method) {
+    for (int i = 0; i < DAWN_STATS_MSG_UNKNOWN; i++) {
+        if (strcmp(method, dawn_stats_msg_names[i]) == 0)
+            return i;
+    }
+
+    return DAWN_STATS_MSG_UNKNOWN;
+}
+
+const char *dawn_stats_notify_name(int notify) {
+    return dawn_stats_notify_names[notify];
+}
+
+const char *dawn_stats_msg_name(int msg) {
+    return dawn_stats_msg_names[msg];
+}
+
+const char *dawn_stats_table_name(int table) {
+    return dawn_stats_table_names[table];
+}
+
+const char *dawn_stats_event_name(int event) {
+    return dawn_stats_event_names[event];
+}
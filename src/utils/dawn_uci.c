@@ -5,6 +5,7 @@
 #include "datastorage.h"
 #include "dawn_iwinfo.h"
 #include "dawn_uci.h"
+#include "dawn_log.h"
 
 
 static struct uci_context *uci_ctx;
@@ -66,6 +67,8 @@ struct time_config_s uci_get_time_config() {
             ret.denied_req_threshold = uci_lookup_option_int(uci_ctx, s, "denied_req_threshold");
             ret.update_chan_util = uci_lookup_option_int(uci_ctx, s, "update_chan_util");
             ret.update_beacon_reports = uci_lookup_option_int(uci_ctx, s, "update_beacon_reports");
+            ret.probe_batch_window = uci_lookup_option_int(uci_ctx, s, "probe_batch_window");
+            ret.full_sync_interval = uci_lookup_option_int(uci_ctx, s, "full_sync_interval");
             return ret;
         }
     }
@@ -142,6 +145,14 @@ struct network_config_s uci_get_dawn_network() {
             const char* str_iv = uci_lookup_option_string(uci_ctx, s, "iv");
             strncpy(ret.iv, str_iv, MAX_KEY_LENGTH);
 
+            ret.key_id = uci_lookup_option_int(uci_ctx, s, "key_id");
+
+            const char* str_next_shared_key = uci_lookup_option_string(uci_ctx, s, "next_shared_key");
+            if (str_next_shared_key)
+                strncpy(ret.next_shared_key, str_next_shared_key, MAX_KEY_LENGTH);
+
+            ret.next_key_id = uci_lookup_option_int(uci_ctx, s, "next_key_id");
+
             ret.network_option = uci_lookup_option_int(uci_ctx, s, "network_option");
             ret.tcp_port = uci_lookup_option_int(uci_ctx, s, "tcp_port");
             ret.use_symm_enc = uci_lookup_option_int(uci_ctx, s, "use_symm_enc");
@@ -154,6 +165,31 @@ struct network_config_s uci_get_dawn_network() {
     return ret;
 }
 
+struct storage_config_s uci_get_dawn_storage() {
+    struct storage_config_s ret = {
+            .probe_limit = -1,
+            .client_limit = -1,
+            .ap_limit = -1,
+            .denied_req_limit = -1
+    };
+
+    struct uci_element *e;
+    uci_foreach_element(&uci_pkg->sections, e)
+    {
+        struct uci_section *s = uci_to_section(e);
+
+        if (strcmp(s->type, "storage") == 0) {
+            ret.probe_limit = uci_lookup_option_int(uci_ctx, s, "probe_limit");
+            ret.client_limit = uci_lookup_option_int(uci_ctx, s, "client_limit");
+            ret.ap_limit = uci_lookup_option_int(uci_ctx, s, "ap_limit");
+            ret.denied_req_limit = uci_lookup_option_int(uci_ctx, s, "denied_req_limit");
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
 bool uci_get_dawn_hostapd_dir() {
     struct uci_element *e;
     uci_foreach_element(&uci_pkg->sections, e)
@@ -184,6 +220,42 @@ bool uci_get_dawn_sort_order() {
     return false;
 }
 
+bool uci_get_dawn_log() {
+    struct uci_element *e;
+
+    dawn_log_set_level(-1, DAWN_LOG_DEFAULT_LEVEL);
+
+    uci_foreach_element(&uci_pkg->sections, e)
+    {
+        struct uci_section *s = uci_to_section(e);
+
+        if (strcmp(s->type, "log") == 0) {
+            int level = dawn_log_parse_level(uci_lookup_option_string(uci_ctx, s, "level"));
+            if (level >= 0)
+                dawn_log_set_level(-1, level);
+
+            struct uci_element *o;
+            uci_foreach_element(&s->options, o)
+            {
+                struct uci_option *opt = uci_to_option(o);
+                int category = dawn_log_parse_category(opt->e.name);
+
+                if (category < 0 || opt->type != UCI_TYPE_STRING)
+                    continue;
+
+                level = dawn_log_parse_level(opt->v.string);
+                if (level < 0) {
+                    fprintf(stderr, "Invalid log level %s for %s\n", opt->v.string, opt->e.name);
+                    continue;
+                }
+                dawn_log_set_level(category, level);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
 int uci_reset()
 {
     uci_unload(uci_ctx, uci_pkg);
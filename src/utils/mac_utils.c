@@ -41,6 +41,16 @@ int mac_is_greater(const uint8_t addr1[], const uint8_t addr2[]) {
     }
     return 0;
 }
+
+uint32_t mac_hash(const uint8_t addr[], uint32_t hash) {
+    for (int i = 0; i < ETH_ALEN; i++) {
+        hash ^= addr[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
 // TODO: Never called in DAWN code.  Remove?
 #if 0
 /* Convert badly formed MAC addresses with single digit element to double digit
@@ -4,20 +4,34 @@
 #include "datastorage.h"
 #include "ubus.h"
 #include "msghandler.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_MSG
 
 
 static struct blob_buf network_buf;
 static struct blob_buf data_buf;
+static struct blob_buf network_send_buf;
 
 enum {
     NETWORK_METHOD,
     NETWORK_DATA,
+    NETWORK_WIRE,
     __NETWORK_MAX,
 };
 
 static const struct blobmsg_policy network_policy[__NETWORK_MAX] = {
         [NETWORK_METHOD] = {.name = "method", .type = BLOBMSG_TYPE_STRING},
         [NETWORK_DATA] = {.name = "data", .type = BLOBMSG_TYPE_STRING},
+        [NETWORK_WIRE] = {.name = "wire", .type = BLOBMSG_TYPE_INT32},
+};
+
+// In the binary envelope the payload is carried as a nested table instead of
+// a JSON string, so it never has to be formatted or parsed.
+static const struct blobmsg_policy network_wire_policy[__NETWORK_MAX] = {
+        [NETWORK_METHOD] = {.name = "method", .type = BLOBMSG_TYPE_STRING},
+        [NETWORK_DATA] = {.name = "data", .type = BLOBMSG_TYPE_TABLE},
 };
 
 enum {
@@ -56,6 +70,15 @@ static const struct blobmsg_policy prob_policy[__PROB_MAX] = {
         [PROB_RSNI] = {.name = "rsni", .type = BLOBMSG_TYPE_INT32},
 };
 
+enum {
+    PROBE_BATCH_PROBES,
+    __PROBE_BATCH_MAX,
+};
+
+static const struct blobmsg_policy probe_batch_policy[__PROBE_BATCH_MAX] = {
+        [PROBE_BATCH_PROBES] = {.name = "probes", .type = BLOBMSG_TYPE_ARRAY},
+};
+
 enum {
     CLIENT_TABLE,
     CLIENT_TABLE_BSSID,
@@ -71,6 +94,9 @@ enum {
     CLIENT_TABLE_NEIGHBOR,
     CLIENT_TABLE_IFACE,
     CLIENT_TABLE_HOSTNAME,
+    CLIENT_TABLE_SEQ,
+    CLIENT_TABLE_FULL,
+    CLIENT_TABLE_REMOVED,
     __CLIENT_TABLE_MAX,
 };
 
@@ -89,6 +115,9 @@ static const struct blobmsg_policy client_table_policy[__CLIENT_TABLE_MAX] = {
         [CLIENT_TABLE_NEIGHBOR] = {.name = "neighbor_report", .type = BLOBMSG_TYPE_STRING},
         [CLIENT_TABLE_IFACE] = {.name = "iface", .type = BLOBMSG_TYPE_STRING},
         [CLIENT_TABLE_HOSTNAME] = {.name = "hostname", .type = BLOBMSG_TYPE_STRING},
+        [CLIENT_TABLE_SEQ] = {.name = "seq", .type = BLOBMSG_TYPE_INT32},
+        [CLIENT_TABLE_FULL] = {.name = "full", .type = BLOBMSG_TYPE_INT8},
+        [CLIENT_TABLE_REMOVED] = {.name = "removed", .type = BLOBMSG_TYPE_ARRAY},
 };
 
 enum {
@@ -128,6 +157,16 @@ static int handle_set_probe(struct blob_attr* msg);
 
 static int handle_uci_config(struct blob_attr* msg);
 
+static int parse_probe_attrs(void* data, size_t len, probe_entry* prob_req);
+
+static int handle_probe_batch(struct blob_attr* msg);
+
+static void parse_to_ap(struct blob_attr** tb, ap* ap_entry);
+
+static int parse_network_wire_msg(char* msg, int len, struct blob_attr** tb);
+
+static int parse_network_json_msg(char* msg, struct blob_attr** tb);
+
 
 int parse_to_hostapd_notify(struct blob_attr* msg, hostapd_notify_entry* notify_req) {
     struct blob_attr* tb[__HOSTAPD_NOTIFY_MAX];
@@ -144,9 +183,16 @@ int parse_to_hostapd_notify(struct blob_attr* msg, hostapd_notify_entry* notify_
 }
 
 int parse_to_probe_req(struct blob_attr* msg, probe_entry* prob_req) {
+    return parse_probe_attrs(blob_data(msg), blob_len(msg), prob_req);
+}
+
+static int parse_probe_attrs(void* data, size_t len, probe_entry* prob_req) {
     struct blob_attr* tb[__PROB_MAX];
 
-    blobmsg_parse(prob_policy, __PROB_MAX, tb, blob_data(msg), blob_len(msg));
+    blobmsg_parse(prob_policy, __PROB_MAX, tb, data, len);
+
+    if (!tb[PROB_BSSID_ADDR] || !tb[PROB_CLIENT_ADDR] || !tb[PROB_TARGET_ADDR])
+        return UBUS_STATUS_INVALID_ARGUMENT;
 
     if (hwaddr_aton(blobmsg_data(tb[PROB_BSSID_ADDR]), prob_req->bssid_addr))
         return UBUS_STATUS_INVALID_ARGUMENT;
@@ -198,6 +244,31 @@ int parse_to_probe_req(struct blob_attr* msg, probe_entry* prob_req) {
     return 0;
 }
 
+static int handle_probe_batch(struct blob_attr* msg) {
+    struct blob_attr* tb[__PROBE_BATCH_MAX];
+    struct blob_attr* attr;
+    int rem;
+
+    blobmsg_parse(probe_batch_policy, __PROBE_BATCH_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!tb[PROBE_BATCH_PROBES])
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    blobmsg_for_each_attr(attr, tb[PROBE_BATCH_PROBES], rem) {
+        probe_entry entry;
+
+        if (blobmsg_type(attr) != BLOBMSG_TYPE_TABLE)
+            continue;
+
+        if (parse_probe_attrs(blobmsg_data(attr), blobmsg_data_len(attr), &entry) == 0) {
+            entry.time = time(0);
+            insert_to_array(entry, 0, false, false); // use 802.11k values
+        }
+    }
+
+    return 0;
+}
+
 int handle_deauth_req(struct blob_attr* msg) {
 
     hostapd_notify_entry notify_req;
@@ -208,10 +279,10 @@ int handle_deauth_req(struct blob_attr* msg) {
     memcpy(client_entry.client_addr, notify_req.client_addr, sizeof(uint8_t) * ETH_ALEN);
 
     pthread_mutex_lock(&client_array_mutex);
-    client_array_delete(client_entry);
+    client_array_delete(&client_entry);
     pthread_mutex_unlock(&client_array_mutex);
 
-    printf("[WC] Deauth: %s\n", "deauth");
+    dawn_log_debug("[WC] Deauth: %s\n", "deauth");
 
     return 0;
 }
@@ -231,10 +302,35 @@ static int handle_set_probe(struct blob_attr* msg) {
     return 0;
 }
 
-int handle_network_msg(char* msg) {
-    struct blob_attr* tb[__NETWORK_MAX];
-    char* method;
-    char* data;
+static int parse_network_wire_msg(char* msg, int len, struct blob_attr** tb) {
+    struct blob_attr* envelope = (struct blob_attr*) (msg + NETWORK_WIRE_HEADER_LEN);
+    int envelope_len = len - NETWORK_WIRE_HEADER_LEN;
+    int version = (uint8_t) msg[3];
+
+    if (msg[1] != 'D' || msg[2] != 'A' || version < 1 || version > NETWORK_WIRE_VERSION) {
+        return -1;
+    }
+
+    if (envelope_len < (int) sizeof(struct blob_attr)
+        || blob_raw_len(envelope) < sizeof(struct blob_attr)
+        || blob_raw_len(envelope) > envelope_len) {
+        return -1;
+    }
+
+    blobmsg_parse(network_wire_policy, __NETWORK_MAX, tb, blob_data(envelope), blob_len(envelope));
+
+    if (!tb[NETWORK_METHOD] || !tb[NETWORK_DATA]) {
+        return -1;
+    }
+
+    blob_buf_init(&data_buf, 0);
+    blob_put_raw(&data_buf, blobmsg_data(tb[NETWORK_DATA]), blobmsg_data_len(tb[NETWORK_DATA]));
+
+    return version;
+}
+
+static int parse_network_json_msg(char* msg, struct blob_attr** tb) {
+    int version = 0;
 
     blob_buf_init(&network_buf, 0);
     blobmsg_add_json_from_string(&network_buf, msg);
@@ -245,23 +341,48 @@ int handle_network_msg(char* msg) {
         return -1;
     }
 
-    method = blobmsg_data(tb[NETWORK_METHOD]);
-    data = blobmsg_data(tb[NETWORK_DATA]);
-
-    printf("Network Method new: %s : %s\n", method, msg);
+    // peers that understand the binary envelope say so in their JSON messages
+    if (tb[NETWORK_WIRE]) {
+        version = blobmsg_get_u32(tb[NETWORK_WIRE]);
+    }
 
     blob_buf_init(&data_buf, 0);
-    blobmsg_add_json_from_string(&data_buf, data);
+    blobmsg_add_json_from_string(&data_buf, blobmsg_data(tb[NETWORK_DATA]));
 
-    if (!data_buf.head) {
-        return -1;
-    }
+    return version;
+}
 
-    if (blob_len(data_buf.head) <= 0) {
-        return -1;
+int handle_network_msg(char* msg, int len) {
+    struct blob_attr* tb[__NETWORK_MAX];
+    char* method;
+    int version;
+    int stats;
+
+    if (len >= NETWORK_WIRE_HEADER_LEN && msg[0] == NETWORK_WIRE_MAGIC) {
+        version = parse_network_wire_msg(msg, len, tb);
+        if (version < 0) {
+            dawn_stats.msgs[DAWN_STATS_MSG_UNKNOWN].dropped++;
+            return -1;
+        }
+
+        method = blobmsg_data(tb[NETWORK_METHOD]);
+        dawn_log_debug("Network Method new: %s (wire version %d)\n", method, version);
+    } else {
+        version = parse_network_json_msg(msg, tb);
+        if (version < 0) {
+            dawn_stats.msgs[DAWN_STATS_MSG_UNKNOWN].dropped++;
+            return -1;
+        }
+
+        method = blobmsg_data(tb[NETWORK_METHOD]);
+        dawn_log_debug("Network Method new: %s : %s\n", method, msg);
     }
 
-    if (strlen(method) < 2) {
+    stats = dawn_stats_msg_lookup(method);
+    dawn_stats.msgs[stats].received++;
+
+    if (!data_buf.head || blob_len(data_buf.head) <= 0 || strlen(method) < 2) {
+        dawn_stats.msgs[stats].dropped++;
         return -1;
     }
 
@@ -274,16 +395,25 @@ int handle_network_msg(char* msg) {
             entry.time = time(0);
             insert_to_array(entry, 0, false, false); // use 802.11k values  // TODO: Change 0 to false?
         }
+        else {
+            dawn_stats.msgs[stats].dropped++;
+        }
+    }
+    else if (strncmp(method, "delta-clients", 13) == 0) {
+        parse_to_clients_delta(data_buf.head);
+    }
+    else if (strncmp(method, "batch-probe", 11) == 0) {
+        handle_probe_batch(data_buf.head);
     }
     else if (strncmp(method, "clients", 5) == 0) {
         parse_to_clients(data_buf.head, 0, 0);
     }
     else if (strncmp(method, "deauth", 5) == 0) {
-        printf("METHOD DEAUTH\n");
+        dawn_log_debug("METHOD DEAUTH\n");
         handle_deauth_req(data_buf.head);
     }
     else if (strncmp(method, "setprobe", 5) == 0) {
-        printf("HANDLING SET PROBE!\n");
+        dawn_log_debug("HANDLING SET PROBE!\n");
         handle_set_probe(data_buf.head);
     }
     else if (strncmp(method, "addmac", 5) == 0) {
@@ -293,7 +423,7 @@ int handle_network_msg(char* msg) {
         parse_add_mac_to_file(data_buf.head);
     }
     else if (strncmp(method, "uci", 2) == 0) {
-        printf("HANDLING UCI!\n");
+        dawn_log_info("HANDLING UCI!\n");
         handle_uci_config(data_buf.head);
     }
     else if (strncmp(method, "beacon-report", 12) == 0) {
@@ -307,10 +437,62 @@ int handle_network_msg(char* msg) {
     }
     else
     {
-        printf("No method fonud for: %s\n", method);
+        dawn_stats.msgs[stats].dropped++;
+        dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_WARN, "No method fonud for: %s\n", method);
     }
 
-    return 0;
+    return version;
+}
+
+char* network_msg_format_json(struct blob_attr* msg, const char* method) {
+    char* data_str;
+    char* str;
+
+    data_str = blobmsg_format_json(msg, true);
+    if (!data_str) {
+        return NULL;
+    }
+
+    blob_buf_init(&network_send_buf, 0);
+    blobmsg_add_string(&network_send_buf, "method", method);
+    blobmsg_add_string(&network_send_buf, "data", data_str);
+    blobmsg_add_u32(&network_send_buf, "wire", NETWORK_WIRE_VERSION);
+
+    str = blobmsg_format_json(network_send_buf.head, true);
+    free(data_str);
+
+    return str;
+}
+
+char* network_msg_format_wire(struct blob_attr* msg, const char* method, int* len, int* padded_len) {
+    void* data;
+    char* out;
+    int envelope_len;
+
+    blob_buf_init(&network_send_buf, 0);
+    blobmsg_add_string(&network_send_buf, "method", method);
+    data = blobmsg_open_table(&network_send_buf, "data");
+    blob_put_raw(&network_send_buf, blob_data(msg), blob_len(msg));
+    blobmsg_close_table(&network_send_buf, data);
+
+    envelope_len = blob_raw_len(network_send_buf.head);
+    *len = NETWORK_WIRE_HEADER_LEN + envelope_len;
+    // round up to the cipher block so encryption never reads past the buffer
+    *padded_len = (*len + 0xf) & ~0xf;
+
+    out = calloc(1, *padded_len);
+    if (!out) {
+        dawn_log_error("network_msg_format_wire: not enough memory\n");
+        return NULL;
+    }
+
+    out[0] = NETWORK_WIRE_MAGIC;
+    out[1] = 'D';
+    out[2] = 'A';
+    out[3] = NETWORK_WIRE_VERSION;
+    memcpy(out + NETWORK_WIRE_HEADER_LEN, network_send_buf.head, envelope_len);
+
+    return out;
 }
 
 static uint8_t dump_rrm_data(void* data, int len, int type) //modify from examples/blobmsg-example.c in libubox
@@ -321,7 +503,7 @@ static uint8_t dump_rrm_data(void* data, int len, int type) //modify from exampl
         ret = *(uint32_t*)data;
         break;
     default:
-        fprintf(stderr, "wrong type of rrm array\n");
+        dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_WARN, "wrong type of rrm array\n");
     }
     return (uint8_t)ret;
 }
@@ -341,11 +523,11 @@ dump_rrm_table(struct blob_attr* head, int len) //modify from examples/blobmsg-e
 
 // TOOD: Refactor this!
 static void
-dump_client(struct blob_attr** tb, uint8_t client_addr[], const char* bssid_addr, uint32_t freq, uint8_t ht_supported,
+dump_client(struct blob_attr** tb, uint8_t client_addr[], const uint8_t bssid_addr[], uint32_t freq, uint8_t ht_supported,
     uint8_t vht_supported) {
     client client_entry;
 
-    hwaddr_aton(bssid_addr, client_entry.bssid_addr);
+    memcpy(client_entry.bssid_addr, bssid_addr, ETH_ALEN * sizeof(uint8_t));
     memcpy(client_entry.client_addr, client_addr, ETH_ALEN * sizeof(uint8_t));
     client_entry.freq = freq;
     client_entry.ht_supported = ht_supported;
@@ -405,11 +587,11 @@ dump_client(struct blob_attr** tb, uint8_t client_addr[], const char* bssid_addr
     }
 
     client_entry.time = time(0);
-    insert_client_to_array(client_entry);
+    insert_client_to_array(&client_entry);
 }
 
 static int
-dump_client_table(struct blob_attr* head, int len, const char* bssid_addr, uint32_t freq, uint8_t ht_supported,
+dump_client_table(struct blob_attr* head, int len, const uint8_t bssid_addr[], uint32_t freq, uint8_t ht_supported,
     uint8_t vht_supported) {
     struct blob_attr* attr;
     struct blobmsg_hdr* hdr;
@@ -435,6 +617,88 @@ dump_client_table(struct blob_attr* head, int len, const char* bssid_addr, uint3
     return station_count;
 }
 
+// Fill in an AP entry from the fields a "clients" message carries besides the clients
+static void parse_to_ap(struct blob_attr** tb, ap* ap_entry) {
+    hwaddr_aton(blobmsg_data(tb[CLIENT_TABLE_BSSID]), ap_entry->bssid_addr);
+    ap_entry->freq = blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]);
+
+    if (tb[CLIENT_TABLE_HT]) {
+        ap_entry->ht_support = blobmsg_get_u8(tb[CLIENT_TABLE_HT]);
+    }
+    else {
+        ap_entry->ht_support = false;
+    }
+
+    if (tb[CLIENT_TABLE_VHT]) {
+        ap_entry->vht_support = blobmsg_get_u8(tb[CLIENT_TABLE_VHT]);
+    }
+    else
+    {
+        ap_entry->vht_support = false;
+    }
+
+    if (tb[CLIENT_TABLE_CHAN_UTIL]) {
+        ap_entry->channel_utilization = blobmsg_get_u32(tb[CLIENT_TABLE_CHAN_UTIL]);
+    }
+    else // if this is not existing set to 0?  //TODO: Consider setting to a value that will not mislead eval_probe_metric(), eg dawn_metric.chan_util_val?
+    {
+        ap_entry->channel_utilization = 0;
+    }
+
+    if (tb[CLIENT_TABLE_SSID]) {
+        strcpy((char*)ap_entry->ssid, blobmsg_get_string(tb[CLIENT_TABLE_SSID]));
+    }
+
+    if (tb[CLIENT_TABLE_COL_DOMAIN]) {
+        ap_entry->collision_domain = blobmsg_get_u32(tb[CLIENT_TABLE_COL_DOMAIN]);
+    }
+    else {
+        ap_entry->collision_domain = -1;
+    }
+
+    if (tb[CLIENT_TABLE_BANDWIDTH]) {
+        ap_entry->bandwidth = blobmsg_get_u32(tb[CLIENT_TABLE_BANDWIDTH]);
+    }
+    else {
+        ap_entry->bandwidth = -1;
+    }
+
+    if (tb[CLIENT_TABLE_WEIGHT]) {
+        ap_entry->ap_weight = blobmsg_get_u32(tb[CLIENT_TABLE_WEIGHT]);
+    }
+    else {
+        ap_entry->ap_weight = 0;
+    }
+
+    if (tb[CLIENT_TABLE_NEIGHBOR]) {
+        strncpy(ap_entry->neighbor_report, blobmsg_get_string(tb[CLIENT_TABLE_NEIGHBOR]), NEIGHBOR_REPORT_LEN);
+    }
+    else {
+        ap_entry->neighbor_report[0] = '\0';
+    }
+
+    if (tb[CLIENT_TABLE_IFACE]) {
+        strncpy(ap_entry->iface, blobmsg_get_string(tb[CLIENT_TABLE_IFACE]), MAX_INTERFACE_NAME);
+    }
+    else {
+        ap_entry->iface[0] = '\0';
+    }
+
+    if (tb[CLIENT_TABLE_HOSTNAME]) {
+        strncpy(ap_entry->hostname, blobmsg_get_string(tb[CLIENT_TABLE_HOSTNAME]), HOST_NAME_MAX);
+    }
+    else {
+        ap_entry->hostname[0] = '\0';
+    }
+
+    if (tb[CLIENT_TABLE_SEQ]) {
+        ap_entry->sync_seq = blobmsg_get_u32(tb[CLIENT_TABLE_SEQ]);
+    }
+    else {
+        ap_entry->sync_seq = 0;
+    }
+}
+
 int parse_to_clients(struct blob_attr* msg, int do_kick, uint32_t id) {
     struct blob_attr* tb[__CLIENT_TABLE_MAX];
 
@@ -453,94 +717,107 @@ int parse_to_clients(struct blob_attr* msg, int do_kick, uint32_t id) {
     blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
 
     if (tb[CLIENT_TABLE] && tb[CLIENT_TABLE_BSSID] && tb[CLIENT_TABLE_FREQ]) {
+        time_t sync_time = time(0);
         int num_stations = 0;
+        ap ap_entry;
+        parse_to_ap(tb, &ap_entry);
         num_stations = dump_client_table(blobmsg_data(tb[CLIENT_TABLE]), blobmsg_data_len(tb[CLIENT_TABLE]),
-            blobmsg_data(tb[CLIENT_TABLE_BSSID]), blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]),
+            ap_entry.bssid_addr, blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]),
             blobmsg_get_u8(tb[CLIENT_TABLE_HT]), blobmsg_get_u8(tb[CLIENT_TABLE_VHT]));
-        ap ap_entry;
-        hwaddr_aton(blobmsg_data(tb[CLIENT_TABLE_BSSID]), ap_entry.bssid_addr);
-        ap_entry.freq = blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]);
+        ap_entry.station_count = num_stations;
 
-        if (tb[CLIENT_TABLE_HT]) {
-            ap_entry.ht_support = blobmsg_get_u8(tb[CLIENT_TABLE_HT]);
-        }
-        else {
-            ap_entry.ht_support = false;
+        // a full resync lists every client of the AP, so a missed removal shows up as a stale entry
+        if (tb[CLIENT_TABLE_FULL]) {
+            pthread_mutex_lock(&client_array_mutex);
+            client_array_remove_stale_bssid(ap_entry.bssid_addr, sync_time);
+            pthread_mutex_unlock(&client_array_mutex);
         }
 
-        if (tb[CLIENT_TABLE_VHT]) {
-            ap_entry.vht_support = blobmsg_get_u8(tb[CLIENT_TABLE_VHT]);
-        }
-        else
-        {
-            ap_entry.vht_support = false;
-        }
+        ap_entry.time = time(0);
+        insert_to_ap_array(&ap_entry);
 
-        if (tb[CLIENT_TABLE_CHAN_UTIL]) {
-            ap_entry.channel_utilization = blobmsg_get_u32(tb[CLIENT_TABLE_CHAN_UTIL]);
-        }
-        else // if this is not existing set to 0?  //TODO: Consider setting to a value that will not mislead eval_probe_metric(), eg dawn_metric.chan_util_val?
-        {
-            ap_entry.channel_utilization = 0;
+        if (do_kick && dawn_metric.kicking) {
+            update_iw_info(ap_entry.bssid_addr);
+            kick_clients(ap_entry.bssid_addr, id);
         }
+    }
+    return 0;
+}
 
-        if (tb[CLIENT_TABLE_SSID]) {
-            strcpy((char*)ap_entry.ssid, blobmsg_get_string(tb[CLIENT_TABLE_SSID]));
-        }
+int parse_local_clients(struct blob_attr* msg, ap* ap_entry, int do_kick, uint32_t id) {
+    struct blob_attr* tb[__CLIENT_TABLE_MAX];
 
-        if (tb[CLIENT_TABLE_COL_DOMAIN]) {
-            ap_entry.collision_domain = blobmsg_get_u32(tb[CLIENT_TABLE_COL_DOMAIN]);
-        }
-        else {
-            ap_entry.collision_domain = -1;
-        }
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
 
-        if (tb[CLIENT_TABLE_BANDWIDTH]) {
-            ap_entry.bandwidth = blobmsg_get_u32(tb[CLIENT_TABLE_BANDWIDTH]);
-        }
-        else {
-            ap_entry.bandwidth = -1;
-        }
+    if (!tb[CLIENT_TABLE] || !tb[CLIENT_TABLE_FREQ]) {
+        return -1;
+    }
 
-        ap_entry.station_count = num_stations;
+    ap_entry->freq = blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]);
+    ap_entry->station_count = dump_client_table(blobmsg_data(tb[CLIENT_TABLE]), blobmsg_data_len(tb[CLIENT_TABLE]),
+        ap_entry->bssid_addr, ap_entry->freq, ap_entry->ht_support, ap_entry->vht_support);
+    ap_entry->time = time(0);
+    insert_to_ap_array(ap_entry);
 
-        if (tb[CLIENT_TABLE_WEIGHT]) {
-            ap_entry.ap_weight = blobmsg_get_u32(tb[CLIENT_TABLE_WEIGHT]);
-        }
-        else {
-            ap_entry.ap_weight = 0;
-        }
+    if (do_kick && dawn_metric.kicking) {
+        update_iw_info(ap_entry->bssid_addr);
+        kick_clients(ap_entry->bssid_addr, id);
+    }
 
+    return 0;
+}
 
-        if (tb[CLIENT_TABLE_NEIGHBOR]) {
-            strncpy(ap_entry.neighbor_report, blobmsg_get_string(tb[CLIENT_TABLE_NEIGHBOR]), NEIGHBOR_REPORT_LEN);
-        }
-        else {
-            ap_entry.neighbor_report[0] = '\0';
-        }
+int parse_to_clients_delta(struct blob_attr* msg) {
+    struct blob_attr* tb[__CLIENT_TABLE_MAX];
+    struct blob_attr* attr;
+    int rem;
+    ap ap_entry;
 
-        if (tb[CLIENT_TABLE_IFACE]) {
-            strncpy(ap_entry.iface, blobmsg_get_string(tb[CLIENT_TABLE_IFACE]), MAX_INTERFACE_NAME);
-        }
-        else {
-            ap_entry.iface[0] = '\0';
-        }
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
 
-        if (tb[CLIENT_TABLE_HOSTNAME]) {
-            strncpy(ap_entry.hostname, blobmsg_get_string(tb[CLIENT_TABLE_HOSTNAME]), HOST_NAME_MAX);
-        }
-        else {
-            ap_entry.hostname[0] = '\0';
-        }
+    if (!tb[CLIENT_TABLE_BSSID] || !tb[CLIENT_TABLE_FREQ] || !tb[CLIENT_TABLE_NUM_STA] || !tb[CLIENT_TABLE_SEQ]) {
+        return -1;
+    }
 
-        ap_entry.time = time(0);
-        insert_to_ap_array(ap_entry);
+    parse_to_ap(tb, &ap_entry);
+    ap_entry.station_count = blobmsg_get_u32(tb[CLIENT_TABLE_NUM_STA]);
 
-        if (do_kick && dawn_metric.kicking) {
-            update_iw_info(ap_entry.bssid_addr);
-            kick_clients(ap_entry.bssid_addr, id);
+    // nothing can be asked for again, the sender's next full resync repairs what was missed
+    pthread_mutex_lock(&ap_array_mutex);
+    const ap* old_entry = ap_array_get_ap(ap_entry.bssid_addr);
+    if (old_entry != NULL && ap_entry.sync_seq != old_entry->sync_seq + 1) {
+        dawn_log_ratelimited(DAWN_LOG_CATEGORY, DAWN_LOG_INFO, "Client updates from " MACSTR " out of sequence (%u after %u)\n",
+                             MAC2STR(ap_entry.bssid_addr), ap_entry.sync_seq, old_entry->sync_seq);
+    }
+    pthread_mutex_unlock(&ap_array_mutex);
+
+    if (tb[CLIENT_TABLE]) {
+        dump_client_table(blobmsg_data(tb[CLIENT_TABLE]), blobmsg_data_len(tb[CLIENT_TABLE]),
+            ap_entry.bssid_addr, ap_entry.freq, ap_entry.ht_support, ap_entry.vht_support);
+    }
+
+    pthread_mutex_lock(&client_array_mutex);
+    if (tb[CLIENT_TABLE_REMOVED]) {
+        blobmsg_for_each_attr(attr, tb[CLIENT_TABLE_REMOVED], rem) {
+            client client_entry;
+
+            if (blobmsg_type(attr) != BLOBMSG_TYPE_STRING
+                || hwaddr_aton(blobmsg_data(attr), client_entry.client_addr)) {
+                continue;
+            }
+
+            memcpy(client_entry.bssid_addr, ap_entry.bssid_addr, ETH_ALEN);
+            client_array_delete(&client_entry);
         }
     }
+
+    // the clients that did not change are still associated
+    client_array_touch_bssid(ap_entry.bssid_addr, time(0));
+    pthread_mutex_unlock(&client_array_mutex);
+
+    ap_entry.time = time(0);
+    insert_to_ap_array(&ap_entry);
+
     return 0;
 }
 
@@ -595,6 +872,8 @@ enum {
     UCI_UPDATE_TCP_CON,
     UCI_UPDATE_CHAN_UTIL,
     UCI_UPDATE_BEACON_REPORTS,
+    UCI_PROBE_BATCH_WINDOW,
+    UCI_FULL_SYNC_INTERVAL,
     __UCI_TIMES_MAX,
 };
 
@@ -647,6 +926,8 @@ static const struct blobmsg_policy uci_times_policy[__UCI_TIMES_MAX] = {
         [UCI_UPDATE_TCP_CON] = {.name = "update_tcp_con", .type = BLOBMSG_TYPE_INT32},
         [UCI_UPDATE_CHAN_UTIL] = {.name = "update_chan_util", .type = BLOBMSG_TYPE_INT32},
         [UCI_UPDATE_BEACON_REPORTS] = {.name = "update_beacon_reports", .type = BLOBMSG_TYPE_INT32},
+        [UCI_PROBE_BATCH_WINDOW] = {.name = "probe_batch_window", .type = BLOBMSG_TYPE_INT32},
+        [UCI_FULL_SYNC_INTERVAL] = {.name = "full_sync_interval", .type = BLOBMSG_TYPE_INT32},
 };
 
 static int handle_uci_config(struct blob_attr* msg) {
@@ -781,8 +1062,20 @@ static int handle_uci_config(struct blob_attr* msg) {
     sprintf(cmd_buffer, "dawn.@times[0].update_beacon_reports=%d", blobmsg_get_u32(tb_times[UCI_UPDATE_BEACON_REPORTS]));
     uci_set_network(cmd_buffer);
 
+    // older peers do not send these
+    if (tb_times[UCI_PROBE_BATCH_WINDOW]) {
+        sprintf(cmd_buffer, "dawn.@times[0].probe_batch_window=%d", blobmsg_get_u32(tb_times[UCI_PROBE_BATCH_WINDOW]));
+        uci_set_network(cmd_buffer);
+    }
+
+    if (tb_times[UCI_FULL_SYNC_INTERVAL]) {
+        sprintf(cmd_buffer, "dawn.@times[0].full_sync_interval=%d", blobmsg_get_u32(tb_times[UCI_FULL_SYNC_INTERVAL]));
+        uci_set_network(cmd_buffer);
+    }
+
     uci_reset();
     dawn_metric = uci_get_dawn_metric();
+    dawn_metric_generation++;
     timeout_config = uci_get_time_config();
 
     return 0;
@@ -1,5 +1,9 @@
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <libubus.h>
+#include <unistd.h>
 
 #include "networksocket.h"
 #include "tcpsocket.h"
@@ -8,17 +12,24 @@
 #include "datastorage.h"
 #include "ubus.h"
 #include "msghandler.h"
+#include "crypto.h"
+#include "dawn_log.h"
+#include "dawn_stats.h"
+
+#define DAWN_LOG_CATEGORY DAWN_LOG_UBUS
 
 
 #define REQ_TYPE_PROBE 0
 #define REQ_TYPE_AUTH 1
 #define REQ_TYPE_ASSOC 2
 
+// Written by dump_latency, never a path chosen by the caller
+#define LATENCY_DUMP_FILE "/tmp/dawn_latency.hgrm"
+
 
 static struct ubus_context *ctx = NULL;
 
 static struct blob_buf b;
-static struct blob_buf b_send_network;
 static struct blob_buf b_probe;
 static struct blob_buf b_domain;
 static struct blob_buf b_notify;
@@ -26,6 +37,7 @@ static struct blob_buf b_clients;
 static struct blob_buf b_umdns;
 static struct blob_buf b_beacon;
 static struct blob_buf b_nr;
+static struct blob_buf b_sync;
 
 void update_clients(struct uloop_timeout *t);
 
@@ -83,10 +95,35 @@ struct uloop_timeout beacon_reports_timer = {
         .cb = update_beacon_reports
 };
 
+static int send_blob_attr_max_len(struct blob_attr *msg, char *method, size_t max_len);
+
+static void send_probe_batch(probe_entry *probes, int count);
+
+static void flush_probe_batch(struct uloop_timeout *t);
+
+static struct uloop_timeout probe_batch_timer = {
+        .cb = flush_probe_batch
+};
+
+// Probe updates waiting for probe_batch_timer, at most one per (BSSID, client).
+// Only touched from the uloop thread.
+#define PROBE_BATCH_MAX 32
+static probe_entry probe_batch[PROBE_BATCH_MAX];
+static int probe_batch_len = 0;
+
+struct probe_batch_stats_s probe_batch_stats;
+
 #define MAX_HOSTAPD_SOCKETS 10
 
 LIST_HEAD(hostapd_sock_list);
 
+// A client as the peers last heard about it
+struct client_digest {
+    uint8_t client_addr[ETH_ALEN];
+    uint32_t digest; // of the client's get_clients table
+    struct blob_attr *attr; // only valid while the message is being built
+};
+
 struct hostapd_sock_entry {
     struct list_head list;
 
@@ -112,6 +149,12 @@ struct hostapd_sock_entry {
     struct ubus_subscriber subscriber;
     struct ubus_event_handler wait_handler;
     bool subscribed;
+
+    // state of the client updates sent to the peers, see send_clients_via_network()
+    uint32_t sync_seq;
+    time_t last_full_sync;
+    struct client_digest *synced; // sorted by address, NULL forces a full resync
+    int synced_count;
 };
 
 struct hostapd_sock_entry* hostapd_sock_arr[MAX_HOSTAPD_SOCKETS];
@@ -192,7 +235,25 @@ static const struct blobmsg_policy rrm_array_policy[__RRM_MAX] = {
         [RRM_ARRAY] = {.name = "value", .type = BLOBMSG_TYPE_ARRAY},
 };
 
+enum {
+    SYNC_CLIENTS,
+    __SYNC_MAX,
+};
+
+static const struct blobmsg_policy sync_policy[__SYNC_MAX] = {
+        [SYNC_CLIENTS] = {.name = "clients", .type = BLOBMSG_TYPE_TABLE},
+};
+
 /* Function Definitions */
+static void send_clients_via_network(struct hostapd_sock_entry *entry, struct blob_attr *msg);
+
+static uint32_t blob_digest(const void *data, size_t len);
+
+static int client_digest_compare(const void *a, const void *b);
+
+static int client_digest_merge(const struct client_digest *current, int i, int count,
+                               const struct client_digest *synced, int j, int synced_count);
+
 static int hostapd_notify(struct ubus_context *ctx, struct ubus_object *obj,
                           struct ubus_request_data *req, const char *method,
                           struct blob_attr *msg);
@@ -216,10 +277,26 @@ static int get_network(struct ubus_context *ctx, struct ubus_object *obj,
                        struct ubus_request_data *req, const char *method,
                        struct blob_attr *msg);
 
+static int get_stats(struct ubus_context *ctx, struct ubus_object *obj,
+                     struct ubus_request_data *req, const char *method,
+                     struct blob_attr *msg);
+
+static int dump_latency(struct ubus_context *ctx, struct ubus_object *obj,
+                        struct ubus_request_data *req, const char *method,
+                        struct blob_attr *msg);
+
+static int decide_function_eval(probe_entry *prob_req, int req_type);
+
+static void blobmsg_add_histogram(struct blob_buf *buf, const char *name, const struct dawn_histogram *h);
+
+static void blobmsg_add_rate(struct blob_buf *buf, const char *name, struct dawn_rate *r);
+
 static void ubus_add_oject();
 
 static void respond_to_notify(uint32_t id);
 
+static void denied_req_expired(const auth_entry* entry);
+
 //static int handle_uci_config(struct blob_attr *msg);
 
 void subscribe_to_new_interfaces(const char *hostapd_sock_path);
@@ -249,7 +326,16 @@ void blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const uint8_t *
     blobmsg_add_string_buffer(buf);
 }
 
+// Caller must hold probe_array_mutex
 static int decide_function(probe_entry *prob_req, int req_type) {
+    uint64_t start = dawn_stats_now_us();
+    int allow = decide_function_eval(prob_req, req_type);
+
+    dawn_histogram_add_since(&dawn_stats.decision, start);
+    return allow;
+}
+
+static int decide_function_eval(probe_entry *prob_req, int req_type) {
     if (mac_in_maclist(prob_req->client_addr)) {
         return 1;
     }
@@ -322,17 +408,22 @@ int parse_to_beacon_rep(struct blob_attr *msg, probe_entry *beacon_rep) {
     ap check_null = {.bssid_addr = {0, 0, 0, 0, 0, 0}};
     if(mac_is_equal(check_null.bssid_addr,beacon_rep->bssid_addr))
     {
-        fprintf(stderr, "Received NULL MAC! Client is strange!\n");
+        dawn_log_warn("Received NULL MAC! Client is strange!\n");
         return -1;
     }
 
-    ap ap_entry_rep = ap_array_get_ap(beacon_rep->bssid_addr);
+    const ap_snapshot* aps = ap_snapshot_get();
+    const ap* ap_entry_rep = ap_snapshot_get_ap(aps, beacon_rep->bssid_addr);
 
     // no client from network!!
-    if (!mac_is_equal(ap_entry_rep.bssid_addr, beacon_rep->bssid_addr)) {
+    if (ap_entry_rep == NULL) {
+        ap_snapshot_put(aps);
         return -1; //TODO: Check this
     }
 
+    uint32_t ap_freq = ap_entry_rep->freq;
+    ap_snapshot_put(aps);
+
     if (hwaddr_aton(blobmsg_data(tb[BEACON_REP_ADDR]), beacon_rep->client_addr))
         return UBUS_STATUS_INVALID_ARGUMENT;
 
@@ -343,20 +434,20 @@ int parse_to_beacon_rep(struct blob_attr *msg, probe_entry *beacon_rep) {
 
 
     // HACKY WORKAROUND!
-    printf("Try update RCPI and RSNI for beacon report!\n");
+    dawn_log_debug("Try update RCPI and RSNI for beacon report!\n");
     if(!probe_array_update_rcpi_rsni(beacon_rep->bssid_addr, beacon_rep->client_addr, rcpi, rsni, true))
     {
-        printf("Beacon: No Probe Entry Existing!\n");
+        dawn_log_debug("Beacon: No Probe Entry Existing!\n");
         beacon_rep->counter = dawn_metric.min_probe_count;
         hwaddr_aton(blobmsg_data(tb[BEACON_REP_ADDR]), beacon_rep->target_addr);  // TODO: Should this be ->bssid_addr?
         beacon_rep->signal = 0;
-        beacon_rep->freq = ap_entry_rep.freq;
+        beacon_rep->freq = ap_freq;
         beacon_rep->rcpi = rcpi;
         beacon_rep->rsni = rsni;
 
         beacon_rep->ht_capabilities = false; // that is very problematic!!!
         beacon_rep->vht_capabilities = false; // that is very problematic!!!
-        printf("Inserting to array!\n");
+        dawn_log_debug("Inserting to array!\n");
         beacon_rep->time = time(0);
         insert_to_array(*beacon_rep, false, false, true);
         ubus_send_probe_via_network(*beacon_rep);
@@ -366,25 +457,28 @@ int parse_to_beacon_rep(struct blob_attr *msg, probe_entry *beacon_rep) {
 
 int handle_auth_req(struct blob_attr* msg) {
 
-    print_probe_array();
     auth_entry auth_req;
     parse_to_auth_req(msg, &auth_req);
+    dawn_rate_inc(&dawn_stats.events[DAWN_STATS_EVENT_AUTH]);
 
-    printf("Auth entry: ");
-    print_auth_entry(auth_req);
+    if (dawn_log_debug_enabled()) {
+        print_probe_array();
+        dawn_log_debug("Auth entry: ");
+        print_auth_entry(auth_req);
+    }
 
     if (mac_in_maclist(auth_req.client_addr)) {
         return WLAN_STATUS_SUCCESS;
     }
 
-    probe_entry tmp = probe_array_get_entry(auth_req.bssid_addr, auth_req.client_addr);
-
-    printf("Entry found\n");
-    print_probe_entry(tmp);
+    pthread_mutex_lock(&probe_array_mutex);
+    probe_entry* tmp = probe_array_get_entry(auth_req.bssid_addr, auth_req.client_addr);
 
     // block if entry was not already found in probe database
-    if (!(mac_is_equal(tmp.bssid_addr, auth_req.bssid_addr) && mac_is_equal(tmp.client_addr, auth_req.client_addr))) {
-        printf("Deny authentication!\n");
+    if (tmp == NULL) {
+        pthread_mutex_unlock(&probe_array_mutex);
+        dawn_log_info("Deny authentication!\n");
+        dawn_stats.denied[DAWN_STATS_EVENT_AUTH]++;
 
         if (dawn_metric.use_driver_recog) {
             auth_req.time = time(0);
@@ -393,8 +487,17 @@ int handle_auth_req(struct blob_attr* msg) {
         return dawn_metric.deny_auth_reason;
     }
 
-    if (!decide_function(&tmp, REQ_TYPE_AUTH)) {
-        printf("Deny authentication\n");
+    if (dawn_log_debug_enabled()) {
+        dawn_log_debug("Entry found\n");
+        print_probe_entry(tmp);
+    }
+
+    int allow = decide_function(tmp, REQ_TYPE_AUTH);
+    pthread_mutex_unlock(&probe_array_mutex);
+
+    if (!allow) {
+        dawn_log_info("Deny authentication\n");
+        dawn_stats.denied[DAWN_STATS_EVENT_AUTH]++;
         if (dawn_metric.use_driver_recog) {
             auth_req.time = time(0);
             insert_to_denied_req_array(auth_req, 1);
@@ -403,30 +506,34 @@ int handle_auth_req(struct blob_attr* msg) {
     }
 
     // maybe send here that the client is connected?
-    printf("Allow authentication!\n");
+    dawn_log_debug("Allow authentication!\n");
     return WLAN_STATUS_SUCCESS;
 }
 
 static int handle_assoc_req(struct blob_attr *msg) {
 
-    print_probe_array();
     auth_entry auth_req;
     parse_to_assoc_req(msg, &auth_req);
-    printf("Association entry: ");
-    print_auth_entry(auth_req);
+    dawn_rate_inc(&dawn_stats.events[DAWN_STATS_EVENT_ASSOC]);
+
+    if (dawn_log_debug_enabled()) {
+        print_probe_array();
+        dawn_log_debug("Association entry: ");
+        print_auth_entry(auth_req);
+    }
 
     if (mac_in_maclist(auth_req.client_addr)) {
         return WLAN_STATUS_SUCCESS;
     }
 
-    probe_entry tmp = probe_array_get_entry(auth_req.bssid_addr, auth_req.client_addr);
-
-    printf("Entry found\n");
-    print_probe_entry(tmp);
+    pthread_mutex_lock(&probe_array_mutex);
+    probe_entry* tmp = probe_array_get_entry(auth_req.bssid_addr, auth_req.client_addr);
 
     // block if entry was not already found in probe database
-    if (!(mac_is_equal(tmp.bssid_addr, auth_req.bssid_addr) && mac_is_equal(tmp.client_addr, auth_req.client_addr))) {
-        printf("Deny associtation!\n");
+    if (tmp == NULL) {
+        pthread_mutex_unlock(&probe_array_mutex);
+        dawn_log_info("Deny associtation!\n");
+        dawn_stats.denied[DAWN_STATS_EVENT_ASSOC]++;
         if (dawn_metric.use_driver_recog) {
             auth_req.time = time(0);
             insert_to_denied_req_array(auth_req, 1);
@@ -434,8 +541,17 @@ static int handle_assoc_req(struct blob_attr *msg) {
         return dawn_metric.deny_assoc_reason;
     }
 
-    if (!decide_function(&tmp, REQ_TYPE_ASSOC)) {
-        printf("Deny association\n");
+    if (dawn_log_debug_enabled()) {
+        dawn_log_debug("Entry found\n");
+        print_probe_entry(tmp);
+    }
+
+    int allow = decide_function(tmp, REQ_TYPE_ASSOC);
+    pthread_mutex_unlock(&probe_array_mutex);
+
+    if (!allow) {
+        dawn_log_info("Deny association\n");
+        dawn_stats.denied[DAWN_STATS_EVENT_ASSOC]++;
         if (dawn_metric.use_driver_recog) {
             auth_req.time = time(0);
             insert_to_denied_req_array(auth_req, 1);
@@ -443,7 +559,7 @@ static int handle_assoc_req(struct blob_attr *msg) {
         return dawn_metric.deny_assoc_reason;
     }
 
-    printf("Allow association!\n");
+    dawn_log_debug("Allow association!\n");
     return WLAN_STATUS_SUCCESS;
 }
 
@@ -451,6 +567,8 @@ static int handle_probe_req(struct blob_attr *msg) {
     probe_entry prob_req;
     probe_entry tmp_prob_req;
 
+    dawn_rate_inc(&dawn_stats.events[DAWN_STATS_EVENT_PROBE]);
+
     if (parse_to_probe_req(msg, &prob_req) == 0) {
         prob_req.time = time(0);
         tmp_prob_req = insert_to_array(prob_req, 1, true, false); // TODO: Chnage 1 to true?
@@ -458,7 +576,12 @@ static int handle_probe_req(struct blob_attr *msg) {
         //send_blob_attr_via_network(msg, "probe");
     }
 
-    if (!decide_function(&tmp_prob_req, REQ_TYPE_PROBE)) {
+    pthread_mutex_lock(&probe_array_mutex);
+    int allow = decide_function(&tmp_prob_req, REQ_TYPE_PROBE);
+    pthread_mutex_unlock(&probe_array_mutex);
+
+    if (!allow) {
+        dawn_stats.denied[DAWN_STATS_EVENT_PROBE]++;
         return WLAN_STATUS_AP_UNABLE_TO_HANDLE_NEW_STA; // no reason needed...
     }
     return WLAN_STATUS_SUCCESS;
@@ -468,9 +591,9 @@ static int handle_beacon_rep(struct blob_attr *msg) {
     probe_entry beacon_rep;
 
     if (parse_to_beacon_rep(msg, &beacon_rep) == 0) {
-        printf("Inserting beacon Report!\n");
+        dawn_log_debug("Inserting beacon Report!\n");
         // insert_to_array(beacon_rep, 1);
-        printf("Sending via network!\n");
+        dawn_log_debug("Sending via network!\n");
         // send_blob_attr_via_network(msg, "beacon-report");
     }
     return 0;
@@ -478,43 +601,58 @@ static int handle_beacon_rep(struct blob_attr *msg) {
 
 
 int send_blob_attr_via_network(struct blob_attr *msg, char *method) {
+    return send_blob_attr_max_len(msg, method, SIZE_MAX);
+}
+
+// Returns 1 without sending if the JSON message is longer than max_len, TCP has no limit
+static int send_blob_attr_max_len(struct blob_attr *msg, char *method, size_t max_len) {
 
     if (!msg) {
         return -1;
     }
 
-    char *data_str;
-    char *str;
-    data_str = blobmsg_format_json(msg, true);
-    blob_buf_init(&b_send_network, 0);
-    blobmsg_add_string(&b_send_network, "method", method);
-    blobmsg_add_string(&b_send_network, "data", data_str);
+    // tcp peers negotiate the binary envelope, broadcast and multicast stay JSON
+    if (network_config.network_option == 2) {
+        dawn_stats.msgs[dawn_stats_msg_lookup(method)].sent++;
+        send_tcp(msg, method);
+        return 0;
+    }
 
-    str = blobmsg_format_json(b_send_network.head, true);
+    char *str = network_msg_format_json(msg, method);
+    if (!str) {
+        return -1;
+    }
 
-    if (network_config.network_option == 2) {
-        send_tcp(str);
+    if (strlen(str) > max_len) {
+        free(str);
+        return 1;
+    }
+
+    dawn_stats.msgs[dawn_stats_msg_lookup(method)].sent++;
+
+    if (network_config.use_symm_enc) {
+        send_string_enc(str);
     } else {
-        if (network_config.use_symm_enc) {
-            send_string_enc(str);
-        } else {
-            send_string(str);
-        }
+        send_string(str);
     }
 
-    free(data_str);
     free(str);
 
     return 0;
 }
 
+// hostapd waits for the reply, so the time until return is recorded per method
 static int hostapd_notify(struct ubus_context *ctx, struct ubus_object *obj,
                           struct ubus_request_data *req, const char *method,
                           struct blob_attr *msg) {
-    char *str;
-    str = blobmsg_format_json(msg, true);
-    printf("Method new: %s : %s\n", method, str);
-    free(str);
+    uint64_t start = dawn_stats_now_us();
+    int notify, ret;
+
+    if (dawn_log_debug_enabled()) {
+        char *str = blobmsg_format_json(msg, true);
+        dawn_log_debug("Method new: %s : %s\n", method, str);
+        free(str);
+    }
 
     struct hostapd_sock_entry *entry;
     struct ubus_subscriber *subscriber;
@@ -532,18 +670,27 @@ static int hostapd_notify(struct ubus_context *ctx, struct ubus_object *obj,
     blobmsg_add_string(&b_notify, "ssid", entry->ssid);
 
     if (strncmp(method, "probe", 5) == 0) {
-        return handle_probe_req(b_notify.head);
+        notify = DAWN_STATS_NOTIFY_PROBE;
+        ret = handle_probe_req(b_notify.head);
     } else if (strncmp(method, "auth", 4) == 0) {
-        return handle_auth_req(b_notify.head);
+        notify = DAWN_STATS_NOTIFY_AUTH;
+        ret = handle_auth_req(b_notify.head);
     } else if (strncmp(method, "assoc", 5) == 0) {
-        return handle_assoc_req(b_notify.head);
+        notify = DAWN_STATS_NOTIFY_ASSOC;
+        ret = handle_assoc_req(b_notify.head);
     } else if (strncmp(method, "deauth", 6) == 0) {
+        notify = DAWN_STATS_NOTIFY_DEAUTH;
         send_blob_attr_via_network(b_notify.head, "deauth");
-        return handle_deauth_req(b_notify.head);
+        ret = handle_deauth_req(b_notify.head);
     } else if (strncmp(method, "beacon-report", 12) == 0) {
-        return handle_beacon_rep(b_notify.head);
+        notify = DAWN_STATS_NOTIFY_BEACON_REPORT;
+        ret = handle_beacon_rep(b_notify.head);
+    } else {
+        return 0;
     }
-    return 0;
+
+    dawn_stats_notify_done(notify, start);
+    return ret;
 }
 
 int dawn_init_ubus(const char *ubus_socket, const char *hostapd_dir) {
@@ -552,16 +699,20 @@ int dawn_init_ubus(const char *ubus_socket, const char *hostapd_dir) {
 
     ctx = ubus_connect(ubus_socket);
     if (!ctx) {
-        fprintf(stderr, "Failed to connect to ubus\n");
+        dawn_log_error("Failed to connect to ubus\n");
         return -1;
     } else {
-        printf("Connected to ubus\n");
+        dawn_log_info("Connected to ubus\n");
     }
 
     ubus_add_uloop(ctx);
 
+    // broadcast and multicast messages are received on their own thread and handled here
+    receive_queue_add_uloop();
+
     // set dawn metric
     dawn_metric = uci_get_dawn_metric();
+    dawn_metric_generation++;
 
     uloop_timeout_add(&hostapd_timer);  // callback = update_hostapd_sockets
 
@@ -597,18 +748,131 @@ int dawn_init_ubus(const char *ubus_socket, const char *hostapd_dir) {
     return 0;
 }
 
+static uint32_t blob_digest(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t h = 2166136261U; // FNV-1a
+
+    while (len--) {
+        h ^= *p++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static int client_digest_compare(const void *a, const void *b) {
+    return memcmp(((const struct client_digest *) a)->client_addr,
+                  ((const struct client_digest *) b)->client_addr, ETH_ALEN);
+}
+
+// Position of the next client in the merge of the current and the synced client list:
+// < 0 only in current (added), 0 in both, > 0 only in synced (removed).
+static int client_digest_merge(const struct client_digest *current, int i, int count,
+                               const struct client_digest *synced, int j, int synced_count) {
+    if (i == count)
+        return 1;
+    if (j == synced_count)
+        return -1;
+    return client_digest_compare(&current[i], &synced[j]);
+}
+
+// Send the full client table every full_sync_interval seconds and only the changes in between.
+static void send_clients_via_network(struct hostapd_sock_entry *entry, struct blob_attr *msg) {
+    struct blob_attr *tb[__SYNC_MAX];
+    struct blob_attr *cur;
+    struct client_digest *current;
+    int count = 0, rem;
+    time_t now = time(0);
+
+    blobmsg_parse(sync_policy, __SYNC_MAX, tb, blob_data(msg), blob_len(msg));
+
+    blobmsg_for_each_attr(cur, tb[SYNC_CLIENTS], rem)
+        count++;
+
+    current = calloc(count + 1, sizeof(*current));
+    count = 0;
+    if (current != NULL) {
+        blobmsg_for_each_attr(cur, tb[SYNC_CLIENTS], rem) {
+            if (hwaddr_aton(blobmsg_name(cur), current[count].client_addr))
+                continue;
+
+            current[count].digest = blob_digest(blobmsg_data(cur), blobmsg_data_len(cur));
+            current[count].attr = cur;
+            count++;
+        }
+        qsort(current, count, sizeof(*current), client_digest_compare);
+    }
+
+    entry->sync_seq++;
+    blob_buf_init(&b_sync, 0);
+
+    if (current == NULL || entry->synced == NULL || now - entry->last_full_sync >= timeout_config.full_sync_interval) {
+        blobmsg_for_each_attr(cur, msg, rem) {
+            blobmsg_add_blob(&b_sync, cur);
+        }
+        blobmsg_add_u32(&b_sync, "seq", entry->sync_seq);
+        blobmsg_add_u8(&b_sync, "full", 1);
+
+        send_blob_attr_via_network(b_sync.head, "clients");
+        entry->last_full_sync = now;
+    } else {
+        int i, j, changed = 0, removed = 0;
+
+        // the AP summary goes out every time, it also keeps the unchanged clients alive on the peers
+        blobmsg_for_each_attr(cur, msg, rem) {
+            if (strcmp(blobmsg_name(cur), "clients") && strcmp(blobmsg_name(cur), "num_sta"))
+                blobmsg_add_blob(&b_sync, cur);
+        }
+        blobmsg_add_u32(&b_sync, "seq", entry->sync_seq);
+        blobmsg_add_u32(&b_sync, "num_sta", count);
+
+        void *clients = blobmsg_open_table(&b_sync, "clients");
+        for (i = 0, j = 0; i < count || j < entry->synced_count;) {
+            int cmp = client_digest_merge(current, i, count, entry->synced, j, entry->synced_count);
+
+            if (cmp < 0 || (cmp == 0 && current[i].digest != entry->synced[j].digest)) {
+                blobmsg_add_blob(&b_sync, current[i].attr);
+                changed++;
+            }
+            if (cmp <= 0)
+                i++;
+            if (cmp >= 0)
+                j++;
+        }
+        blobmsg_close_table(&b_sync, clients);
+
+        void *gone = blobmsg_open_array(&b_sync, "removed");
+        for (i = 0, j = 0; i < count || j < entry->synced_count;) {
+            int cmp = client_digest_merge(current, i, count, entry->synced, j, entry->synced_count);
+
+            if (cmp > 0) {
+                blobmsg_add_macaddr(&b_sync, NULL, entry->synced[j].client_addr);
+                removed++;
+            }
+            if (cmp <= 0)
+                i++;
+            if (cmp >= 0)
+                j++;
+        }
+        blobmsg_close_array(&b_sync, gone);
+
+        dawn_log_debug("Client delta for %s: %d changed, %d removed, %d unchanged\n",
+               entry->iface_name, changed, removed, count - changed);
+        send_blob_attr_via_network(b_sync.head, "delta-clients");
+    }
+
+    free(entry->synced);
+    entry->synced = current;
+    entry->synced_count = count;
+}
+
 static void ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_attr *msg) {
     struct hostapd_sock_entry *sub, *entry = NULL;
+    ap ap_entry;
 
     if (!msg)
         return;
 
-    char *data_str = blobmsg_format_json(msg, 1);
-    blob_buf_init(&b_domain, 0);
-    blobmsg_add_json_from_string(&b_domain, data_str);
-    blobmsg_add_u32(&b_domain, "collision_domain", network_config.collision_domain);
-    blobmsg_add_u32(&b_domain, "bandwidth", network_config.bandwidth);
-
     list_for_each_entry(sub, &hostapd_sock_list, list)
     {
         if (sub->id == req->peer) {
@@ -617,40 +881,72 @@ static void ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_
     }
 
     if (entry == NULL) {
-        fprintf(stderr, "Failed to find interface!\n");
-        free(data_str);
+        dawn_log_warn("Failed to find interface!\n");
         return;
     }
 
     if (!entry->subscribed) {
-        fprintf(stderr, "Interface %s is not subscribed!\n", entry->iface_name);
-        free(data_str);
+        dawn_log_warn("Interface %s is not subscribed!\n", entry->iface_name);
         return;
     }
 
-    blobmsg_add_macaddr(&b_domain, "bssid", entry->bssid_addr);
-    blobmsg_add_string(&b_domain, "ssid", entry->ssid);
-    blobmsg_add_u8(&b_domain, "ht_supported", entry->ht_support);
-    blobmsg_add_u8(&b_domain, "vht_supported", entry->vht_support);
+    // with tcp there is nobody to tell until a connection is up
+    if (network_config.network_option != 2 || tcp_connection_count() > 0) {
+        struct blob_attr *cur; int rem;
+        blob_buf_init(&b_domain, 0);
+        blobmsg_for_each_attr(cur, msg, rem){
+            blobmsg_add_blob(&b_domain, cur);
+        }
+        blobmsg_add_u32(&b_domain, "collision_domain", network_config.collision_domain);
+        blobmsg_add_u32(&b_domain, "bandwidth", network_config.bandwidth);
 
-    blobmsg_add_u32(&b_domain, "ap_weight", dawn_metric.ap_weight);
+        blobmsg_add_macaddr(&b_domain, "bssid", entry->bssid_addr);
+        blobmsg_add_string(&b_domain, "ssid", entry->ssid);
+        blobmsg_add_u8(&b_domain, "ht_supported", entry->ht_support);
+        blobmsg_add_u8(&b_domain, "vht_supported", entry->vht_support);
 
-    //int channel_util = get_channel_utilization(entry->iface_name, &entry->last_channel_time, &entry->last_channel_time_busy);
-    blobmsg_add_u32(&b_domain, "channel_utilization", entry->chan_util_average);
+        blobmsg_add_u32(&b_domain, "ap_weight", dawn_metric.ap_weight);
 
-    blobmsg_add_string(&b_domain, "neighbor_report", entry->neighbor_report);
+        //int channel_util = get_channel_utilization(entry->iface_name, &entry->last_channel_time, &entry->last_channel_time_busy);
+        blobmsg_add_u32(&b_domain, "channel_utilization", entry->chan_util_average);
 
-    blobmsg_add_string(&b_domain, "iface", entry->iface_name);
-    blobmsg_add_string(&b_domain, "hostname", entry->hostname);
+        blobmsg_add_string(&b_domain, "neighbor_report", entry->neighbor_report);
 
-    send_blob_attr_via_network(b_domain.head, "clients");
-    // TODO: Have we just bit-packed data to send to something locally to unpack it again?  Performance / scalability?
-    parse_to_clients(b_domain.head, 1, req->peer);
+        blobmsg_add_string(&b_domain, "iface", entry->iface_name);
+        blobmsg_add_string(&b_domain, "hostname", entry->hostname);
 
-    print_client_array();
-    print_ap_array();
+        if (timeout_config.full_sync_interval > 0) {
+            send_clients_via_network(entry, b_domain.head);
+        } else {
+            send_blob_attr_via_network(b_domain.head, "clients");
+        }
+    } else {
+        // whoever connects first needs the full client table
+        free(entry->synced);
+        entry->synced = NULL;
+        entry->synced_count = 0;
+    }
 
-    free(data_str);
+    // the local tables are filled straight from hostapd's reply
+    memset(&ap_entry, 0, sizeof(ap_entry));
+    memcpy(ap_entry.bssid_addr, entry->bssid_addr, ETH_ALEN);
+    strncpy((char *) ap_entry.ssid, entry->ssid, SSID_MAX_LEN);
+    ap_entry.ht_support = entry->ht_support;
+    ap_entry.vht_support = entry->vht_support;
+    ap_entry.channel_utilization = entry->chan_util_average;
+    ap_entry.collision_domain = network_config.collision_domain;
+    ap_entry.bandwidth = network_config.bandwidth;
+    ap_entry.ap_weight = dawn_metric.ap_weight;
+    strncpy(ap_entry.neighbor_report, entry->neighbor_report, NEIGHBOR_REPORT_LEN);
+    strncpy(ap_entry.iface, entry->iface_name, MAX_INTERFACE_NAME);
+    strncpy(ap_entry.hostname, entry->hostname, HOST_NAME_MAX);
+
+    parse_local_clients(msg, &ap_entry, 1, req->peer);
+
+    if (dawn_log_debug_enabled()) {
+        print_client_array();
+        print_ap_array();
+    }
 }
 
 static int ubus_get_clients() {
@@ -696,7 +992,7 @@ static void ubus_get_rrm_cb(struct ubus_request *req, int type, struct blob_attr
          {
             char* neighborreport = blobmsg_get_string(blobmsg_data(attr));
             strcpy(entry->neighbor_report,neighborreport);
-            printf("Copied Neighborreport: %s,\n", entry->neighbor_report);
+            dawn_log_debug("Copied Neighborreport: %s,\n", entry->neighbor_report);
          }
          i++;
      }
@@ -751,7 +1047,7 @@ void update_channel_utilization(struct uloop_timeout *t) {
 
 void ubus_send_beacon_report(uint8_t client[], int id)
 {
-    printf("Crafting Beacon Report\n");
+    dawn_log_debug("Crafting Beacon Report\n");
     int timeout = 1;
     blob_buf_init(&b_beacon, 0);
     blobmsg_add_macaddr(&b_beacon, "addr", client);
@@ -759,10 +1055,10 @@ void ubus_send_beacon_report(uint8_t client[], int id)
     blobmsg_add_u32(&b_beacon, "channel", dawn_metric.scan_channel);
     blobmsg_add_u32(&b_beacon, "duration", dawn_metric.duration);
     blobmsg_add_u32(&b_beacon, "mode", dawn_metric.mode);
-    printf("Adding string\n");
+    dawn_log_debug("Adding string\n");
     blobmsg_add_string(&b_beacon, "ssid", "");
 
-    printf("Invoking beacon report!\n");
+    dawn_log_debug("Invoking beacon report!\n");
     ubus_invoke(ctx, id, "rrm_beacon_req", b_beacon.head, NULL, NULL, timeout * 1000);
 }
 
@@ -771,12 +1067,12 @@ void update_beacon_reports(struct uloop_timeout *t) {
     {
         return;
     }
-    printf("Sending beacon report!\n");
+    dawn_log_debug("Sending beacon report!\n");
     struct hostapd_sock_entry *sub;
     list_for_each_entry(sub, &hostapd_sock_list, list)
     {
         if (sub->subscribed) {
-            printf("Sending beacon report Sub!\n");
+            dawn_log_debug("Sending beacon report Sub!\n");
             send_beacon_reports(sub->bssid_addr, sub->id);
         }
     }
@@ -864,7 +1160,7 @@ int wnm_disassoc_imminent(uint32_t id, const uint8_t *client_addr, char *dest_ap
     if (dest_ap != NULL)
     {
         blobmsg_add_string(&b, NULL, dest_ap);
-        printf("BSS TRANSITION TO %s\n", dest_ap);
+        dawn_log_info("BSS TRANSITION TO %s\n", dest_ap);
     }
 
     blobmsg_close_array(&b, nbs);
@@ -902,10 +1198,10 @@ static void ubus_umdns_cb(struct ubus_request *req, int type, struct blob_attr *
         struct blob_attr *tb_dawn[__DAWN_UMDNS_MAX];
         blobmsg_parse(dawn_umdns_policy, __DAWN_UMDNS_MAX, tb_dawn, blobmsg_data(attr), blobmsg_len(attr));
 
-        printf("Hostname: %s\n", hdr->name);
+        dawn_log_debug("Hostname: %s\n", hdr->name);
         if (tb_dawn[DAWN_UMDNS_IPV4] && tb_dawn[DAWN_UMDNS_PORT]) {
-            printf("IPV4: %s\n", blobmsg_get_string(tb_dawn[DAWN_UMDNS_IPV4]));
-            printf("Port: %d\n", blobmsg_get_u32(tb_dawn[DAWN_UMDNS_PORT]));
+            dawn_log_debug("IPV4: %s\n", blobmsg_get_string(tb_dawn[DAWN_UMDNS_IPV4]));
+            dawn_log_debug("Port: %d\n", blobmsg_get_u32(tb_dawn[DAWN_UMDNS_PORT]));
         } else {
             return;
         }
@@ -916,7 +1212,7 @@ static void ubus_umdns_cb(struct ubus_request *req, int type, struct blob_attr *
 int ubus_call_umdns() {
     u_int32_t id;
     if (ubus_lookup_id(ctx, "umdns", &id)) {
-        fprintf(stderr, "Failed to look up test object for %s\n", "umdns");
+        dawn_log_warn("Failed to look up test object for %s\n", "umdns");
         return -1;
     }
 
@@ -929,29 +1225,89 @@ int ubus_call_umdns() {
 }
 
 //TODO: ADD STUFF HERE!!!!
-int ubus_send_probe_via_network(struct probe_entry_s probe_entry) {
-    blob_buf_init(&b_probe, 0);
-    blobmsg_add_macaddr(&b_probe, "bssid", probe_entry.bssid_addr);
-    blobmsg_add_macaddr(&b_probe, "address", probe_entry.client_addr);
-    blobmsg_add_macaddr(&b_probe, "target", probe_entry.target_addr);
-    blobmsg_add_u32(&b_probe, "signal", probe_entry.signal);
-    blobmsg_add_u32(&b_probe, "freq", probe_entry.freq);
+static void blobmsg_add_probe(struct blob_buf *buf, const probe_entry *probe) {
+    blobmsg_add_macaddr(buf, "bssid", probe->bssid_addr);
+    blobmsg_add_macaddr(buf, "address", probe->client_addr);
+    blobmsg_add_macaddr(buf, "target", probe->target_addr);
+    blobmsg_add_u32(buf, "signal", probe->signal);
+    blobmsg_add_u32(buf, "freq", probe->freq);
 
-    blobmsg_add_u32(&b_probe, "rcpi", probe_entry.rcpi);
-    blobmsg_add_u32(&b_probe, "rsni", probe_entry.rsni);
+    blobmsg_add_u32(buf, "rcpi", probe->rcpi);
+    blobmsg_add_u32(buf, "rsni", probe->rsni);
 
-    if (probe_entry.ht_capabilities)
+    if (probe->ht_capabilities)
     {
-        void *ht_cap = blobmsg_open_table(&b, "ht_capabilities");
-        blobmsg_close_table(&b, ht_cap);
+        void *ht_cap = blobmsg_open_table(buf, "ht_capabilities");
+        blobmsg_close_table(buf, ht_cap);
     }
 
-    if (probe_entry.vht_capabilities) {
-        void *vht_cap = blobmsg_open_table(&b, "vht_capabilities");
-        blobmsg_close_table(&b, vht_cap);
+    if (probe->vht_capabilities) {
+        void *vht_cap = blobmsg_open_table(buf, "vht_capabilities");
+        blobmsg_close_table(buf, vht_cap);
     }
+}
 
-    send_blob_attr_via_network(b_probe.head, "probe");
+// A batch has to fit into one datagram of the receivers, else it is sent in halves
+static void send_probe_batch(probe_entry *probes, int count) {
+    blob_buf_init(&b_probe, 0);
+    void *array = blobmsg_open_array(&b_probe, "probes");
+    for (int i = 0; i < count; i++) {
+        void *probe = blobmsg_open_table(&b_probe, NULL);
+        blobmsg_add_probe(&b_probe, &probes[i]);
+        blobmsg_close_table(&b_probe, probe);
+    }
+    blobmsg_close_array(&b_probe, array);
+
+    if (send_blob_attr_max_len(b_probe.head, "batch-probe", count > 1 ? send_string_max_len() : SIZE_MAX) == 1) {
+        send_probe_batch(probes, count / 2);
+        send_probe_batch(probes + count / 2, count - count / 2);
+        return;
+    }
+
+    probe_batch_stats.batches++;
+}
+
+static void flush_probe_batch(struct uloop_timeout *t) {
+    if (probe_batch_len == 0)
+        return;
+
+    send_probe_batch(probe_batch, probe_batch_len);
+
+    probe_batch_stats.sent += probe_batch_len;
+    dawn_log_debug("Sent %d batched probes (%" PRIu64 " queued, %" PRIu64 " coalesced so far)\n",
+           probe_batch_len, probe_batch_stats.queued, probe_batch_stats.coalesced);
+
+    probe_batch_len = 0;
+}
+
+int ubus_send_probe_via_network(struct probe_entry_s probe_entry) {
+    if (timeout_config.probe_batch_window <= 0) {
+        blob_buf_init(&b_probe, 0);
+        blobmsg_add_probe(&b_probe, &probe_entry);
+        send_blob_attr_via_network(b_probe.head, "probe");
+        return 0;
+    }
+
+    probe_batch_stats.queued++;
+
+    // a newer update for the same client and AP replaces the pending one
+    for (int i = 0; i < probe_batch_len; i++) {
+        if (mac_is_equal(probe_batch[i].bssid_addr, probe_entry.bssid_addr)
+            && mac_is_equal(probe_batch[i].client_addr, probe_entry.client_addr)) {
+            probe_batch[i] = probe_entry;
+            probe_batch_stats.coalesced++;
+            return 0;
+        }
+    }
+
+    probe_batch[probe_batch_len++] = probe_entry;
+
+    if (probe_batch_len == PROBE_BATCH_MAX) {
+        uloop_timeout_cancel(&probe_batch_timer);
+        flush_probe_batch(&probe_batch_timer);
+    } else if (probe_batch_len == 1) {
+        uloop_timeout_set(&probe_batch_timer, timeout_config.probe_batch_window);
+    }
 
     return 0;
 }
@@ -979,6 +1335,8 @@ static const struct ubus_method dawn_methods[] = {
         UBUS_METHOD("add_mac", add_mac, add_del_policy),
         UBUS_METHOD_NOARG("get_hearing_map", get_hearing_map),
         UBUS_METHOD_NOARG("get_network", get_network),
+        UBUS_METHOD_NOARG("get_stats", get_stats),
+        UBUS_METHOD_NOARG("dump_latency", dump_latency),
         UBUS_METHOD_NOARG("reload_config", reload_config)
 };
 
@@ -996,7 +1354,7 @@ int parse_add_mac_to_file(struct blob_attr *msg) {
     struct blob_attr *tb[__ADD_DEL_MAC_MAX];
     struct blob_attr *attr;
 
-    printf("Parsing MAC!\n");
+    dawn_log_debug("Parsing MAC!\n");
 
     blobmsg_parse(add_del_policy, __ADD_DEL_MAC_MAX, tb, blob_data(msg), blob_len(msg));
 
@@ -1004,11 +1362,11 @@ int parse_add_mac_to_file(struct blob_attr *msg) {
         return UBUS_STATUS_INVALID_ARGUMENT;
 
     int len = blobmsg_data_len(tb[MAC_ADDR]);
-    printf("Length of array maclist: %d\n", len);
+    dawn_log_debug("Length of array maclist: %d\n", len);
 
     __blob_for_each_attr(attr, blobmsg_data(tb[MAC_ADDR]), len)
     {
-        printf("Iteration through MAC-list\n");
+        dawn_log_debug("Iteration through MAC-list\n");
         uint8_t addr[ETH_ALEN];
         hwaddr_aton(blobmsg_data(attr), addr);
 
@@ -1046,8 +1404,24 @@ static int reload_config(struct ubus_context *ctx, struct ubus_object *obj,
     int ret;
     blob_buf_init(&b, 0);
     uci_reset();
+    uci_get_dawn_log();
+
+    // keys are replaced at runtime, the other network options need a restart
+    struct network_config_s net_config = uci_get_dawn_network();
+    int keys_rejected = gcrypt_set_keys(net_config.key_id, net_config.shared_key, net_config.iv,
+                                        net_config.next_key_id, net_config.next_shared_key);
+    if (!keys_rejected) {
+        memcpy(network_config.shared_key, net_config.shared_key, MAX_KEY_LENGTH);
+        memcpy(network_config.iv, net_config.iv, MAX_KEY_LENGTH);
+        network_config.key_id = net_config.key_id;
+        memcpy(network_config.next_shared_key, net_config.next_shared_key, MAX_KEY_LENGTH);
+        network_config.next_key_id = net_config.next_key_id;
+    }
+
     dawn_metric = uci_get_dawn_metric();
+    dawn_metric_generation++;
     timeout_config = uci_get_time_config();
+    storage_config = uci_get_dawn_storage();
     uci_get_dawn_hostapd_dir();
     uci_get_dawn_sort_order();
 
@@ -1055,9 +1429,14 @@ static int reload_config(struct ubus_context *ctx, struct ubus_object *obj,
         uloop_timeout_add(&beacon_reports_timer); // callback = update_beacon_reports
 
     uci_send_via_network();
+
+    // the rest of the configuration is applied, the old keys stay active
+    if (keys_rejected)
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
     ret = ubus_send_reply(ctx, req, b.head);
     if (ret)
-        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+        dawn_log_error("Failed to send reply: %s\n", ubus_strerror(ret));
     return 0;
 }
 
@@ -1069,7 +1448,7 @@ static int get_hearing_map(struct ubus_context *ctx, struct ubus_object *obj,
     build_hearing_map_sort_client(&b);
     ret = ubus_send_reply(ctx, req, b.head);
     if (ret)
-        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+        dawn_log_error("Failed to send reply: %s\n", ubus_strerror(ret));
     return 0;
 }
 
@@ -1082,7 +1461,52 @@ static int get_network(struct ubus_context *ctx, struct ubus_object *obj,
     build_network_overview(&b);
     ret = ubus_send_reply(ctx, req, b.head);
     if (ret)
-        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+        dawn_log_error("Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_stats(struct ubus_context *ctx, struct ubus_object *obj,
+                     struct ubus_request_data *req, const char *method,
+                     struct blob_attr *msg) {
+    int ret;
+
+    build_stats(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        dawn_log_error("Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+// Write the hostapd_notify() latencies in the HdrHistogram text format, e.g. for its plotter.
+// The file is in /tmp, so a symlink planted there must not redirect the write.
+static int dump_latency(struct ubus_context *ctx, struct ubus_object *obj,
+                        struct ubus_request_data *req, const char *method,
+                        struct blob_attr *msg) {
+    FILE *f;
+    int fd;
+    int ret;
+
+    fd = open(LATENCY_DUMP_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    if (fd < 0 || !(f = fdopen(fd, "w"))) {
+        dawn_log_error("Failed to open %s: %s\n", LATENCY_DUMP_FILE, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return UBUS_STATUS_UNKNOWN_ERROR;
+    }
+
+    for (int i = 0; i < __DAWN_STATS_NOTIFY_MAX; i++) {
+        fprintf(f, "# %" PRIu64 " of %" PRIu64 " %s notifications over the budget of %d us\n",
+                dawn_stats.notify_over_budget[i], dawn_stats.notify[i].count, dawn_stats_notify_name(i),
+                DAWN_NOTIFY_BUDGET_US);
+        dawn_histogram_write(f, dawn_stats_notify_name(i), &dawn_stats.notify[i]);
+    }
+    fclose(f);
+
+    blob_buf_init(&b, 0);
+    blobmsg_add_string(&b, "file", LATENCY_DUMP_FILE);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        dawn_log_error("Failed to send reply: %s\n", ubus_strerror(ret));
     return 0;
 }
 
@@ -1091,7 +1515,7 @@ static void ubus_add_oject() {
 
     ret = ubus_add_object(ctx, &dawn_object);
     if (ret)
-        fprintf(stderr, "Failed to add object: %s\n", ubus_strerror(ret));
+        dawn_log_error("Failed to add object: %s\n", ubus_strerror(ret));
 }
 
 static void respond_to_notify(uint32_t id) {
@@ -1106,7 +1530,7 @@ static void respond_to_notify(uint32_t id) {
     int timeout = 1;
     ret = ubus_invoke(ctx, id, "notify_response", b.head, NULL, NULL, timeout * 1000);
     if (ret)
-        fprintf(stderr, "Failed to invoke: %s\n", ubus_strerror(ret));
+        dawn_log_error("Failed to invoke: %s\n", ubus_strerror(ret));
 }
 
 static void enable_rrm(uint32_t id) {
@@ -1120,17 +1544,17 @@ static void enable_rrm(uint32_t id) {
     int timeout = 1;
     ret = ubus_invoke(ctx, id, "bss_mgmt_enable", b.head, NULL, NULL, timeout * 1000);
     if (ret)
-        fprintf(stderr, "Failed to invoke: %s\n", ubus_strerror(ret));
+        dawn_log_error("Failed to invoke: %s\n", ubus_strerror(ret));
 }
 
 static void hostapd_handle_remove(struct ubus_context *ctx,
                                   struct ubus_subscriber *s, uint32_t id) {
-    fprintf(stdout, "Object %08x went away\n", id);
+    dawn_log_info("Object %08x went away\n", id);
     struct hostapd_sock_entry *hostapd_sock = container_of(s,
     struct hostapd_sock_entry, subscriber);
 
     if (hostapd_sock->id != id) {
-        printf("ID is not the same!\n");
+        dawn_log_debug("ID is not the same!\n");
         return;
     }
 
@@ -1148,19 +1572,24 @@ bool subscribe(struct hostapd_sock_entry *hostapd_entry) {
     sprintf(subscribe_name, "hostapd.%s", hostapd_entry->iface_name);
 
     if (ubus_lookup_id(ctx, subscribe_name, &hostapd_entry->id)) {
-        fprintf(stdout, "Failed to lookup ID!");
+        dawn_log_error("Failed to lookup ID!\n");
         subscription_wait(&hostapd_entry->wait_handler);
         return false;
     }
 
     if (ubus_subscribe(ctx, &hostapd_entry->subscriber, hostapd_entry->id)) {
-        fprintf(stdout, "Failed to register subscriber!");
+        dawn_log_error("Failed to register subscriber!\n");
         subscription_wait(&hostapd_entry->wait_handler);
         return false;
     }
 
     hostapd_entry->subscribed = true;
 
+    // hostapd may have restarted, so start the client updates over
+    free(hostapd_entry->synced);
+    hostapd_entry->synced = NULL;
+    hostapd_entry->synced_count = 0;
+
     get_bssid(hostapd_entry->iface_name, hostapd_entry->bssid_addr);
     get_ssid(hostapd_entry->iface_name, hostapd_entry->ssid, (SSID_MAX_LEN) * sizeof(char));
 
@@ -1171,7 +1600,7 @@ bool subscribe(struct hostapd_sock_entry *hostapd_entry) {
     enable_rrm(hostapd_entry->id);
     ubus_get_rrm();
 
-    printf("Subscribed to: %s\n", hostapd_entry->iface_name);
+    dawn_log_info("Subscribed to: %s\n", hostapd_entry->iface_name);
 
     return true;
 }
@@ -1224,7 +1653,7 @@ bool subscriber_to_interface(const char *ifname) {
     hostapd_entry->subscribed = false;
 
     if (ubus_register_subscriber(ctx, &hostapd_entry->subscriber)) {
-        fprintf(stderr, "Failed to register subscriber!");
+        dawn_log_error("Failed to register subscriber!\n");
         return false;
     }
 
@@ -1244,7 +1673,7 @@ void subscribe_to_new_interfaces(const char *hostapd_sock_path) {
 
     dirp = opendir(hostapd_sock_path);  // error handling?
     if (!dirp) {
-        fprintf(stderr, "[SUBSCRIBING] No hostapd sockets!\n");
+        dawn_log_warn("[SUBSCRIBING] No hostapd sockets!\n");
         return;
     }
     while ((entry = readdir(dirp)) != NULL) {
@@ -1320,6 +1749,8 @@ int uci_send_via_network()
     blobmsg_add_u32(&b, "update_tcp_con", timeout_config.update_tcp_con);
     blobmsg_add_u32(&b, "update_chan_util", timeout_config.update_chan_util);
     blobmsg_add_u32(&b, "update_beacon_reports", timeout_config.update_beacon_reports);
+    blobmsg_add_u32(&b, "probe_batch_window", timeout_config.probe_batch_window);
+    blobmsg_add_u32(&b, "full_sync_interval", timeout_config.full_sync_interval);
     blobmsg_close_table(&b, times);
 
     send_blob_attr_via_network(b.head, "uci");
@@ -1327,125 +1758,121 @@ int uci_send_via_network()
     return 0;
 }
 int build_hearing_map_sort_client(struct blob_buf *b) {
-    print_probe_array();
+    if (dawn_log_debug_enabled())
+        print_probe_array();
     pthread_mutex_lock(&probe_array_mutex);
+    pthread_mutex_lock(&ap_array_mutex);
 
-    void *client_list, *ap_list, *ssid_list;
+    void *ap_list, *ssid_list;
     char ap_mac_buf[20];
     char client_mac_buf[20];
 
     blob_buf_init(b, 0);
-    int m;
-    for (m = 0; m <= ap_entry_last; m++) {
-        if (m > 0) {
-            if (strcmp((char *) ap_array[m].ssid, (char *) ap_array[m - 1].ssid) == 0) {
-                continue;
-            }
-        }
-        ssid_list = blobmsg_open_table(b, (char *) ap_array[m].ssid);
+    ap* m;
+    list_for_each_entry(m, &ap_entry_list, list) {
+        if (m->list.prev != &ap_entry_list) {
+            ap* prev = list_entry(m->list.prev, ap, list);
 
-        int i;
-        for (i = 0; i <= probe_entry_last; i++) {
-            /*if(!mac_is_equal(ap_array[m].bssid_addr, probe_array[i].bssid_addr))
-            {
-                continue;
-            }*/
-
-            ap ap_entry_i = ap_array_get_ap(probe_array[i].bssid_addr);
-
-            if (!mac_is_equal(ap_entry_i.bssid_addr, probe_array[i].bssid_addr)) {
+            if (strcmp((char *) m->ssid, (char *) prev->ssid) == 0) {
                 continue;
             }
+        }
+        ssid_list = blobmsg_open_table(b, (char *) m->ssid);
 
-            if (strcmp((char *) ap_entry_i.ssid, (char *) ap_array[m].ssid) != 0) {
-                continue;
-            }
+        probe_client* pc;
+        list_for_each_entry(pc, &probe_client_list, list) {
+            void* client_list = NULL;
 
-            int k;
-            sprintf(client_mac_buf, MACSTR, MAC2STR(probe_array[i].client_addr));
-            client_list = blobmsg_open_table(b, client_mac_buf);
-            for (k = i; k <= probe_entry_last; k++) {
-                ap ap_entry = ap_array_get_ap(probe_array[k].bssid_addr);
+            for (probe_entry* k = pc->probes; k != NULL; k = k->next_client_probe) {
+                ap* ap_entry = ap_array_get_ap(k->bssid_addr);
 
-                if (!mac_is_equal(ap_entry.bssid_addr, probe_array[k].bssid_addr)) {
+                if (ap_entry == NULL) {
                     continue;
                 }
 
-                if (strcmp((char *) ap_entry.ssid, (char *) ap_array[m].ssid) != 0) {
+                if (strcmp((char *) ap_entry->ssid, (char *) m->ssid) != 0) {
                     continue;
                 }
 
-                if (!mac_is_equal(probe_array[k].client_addr, probe_array[i].client_addr)) {
-                    i = k - 1;
-                    break;
-                } else if (k == probe_entry_last) {
-                    i = k;
+                if (client_list == NULL) {
+                    sprintf(client_mac_buf, MACSTR, MAC2STR(pc->client_addr));
+                    client_list = blobmsg_open_table(b, client_mac_buf);
                 }
 
-                sprintf(ap_mac_buf, MACSTR, MAC2STR(probe_array[k].bssid_addr));
+                sprintf(ap_mac_buf, MACSTR, MAC2STR(k->bssid_addr));
                 ap_list = blobmsg_open_table(b, ap_mac_buf);
-                blobmsg_add_u32(b, "signal", probe_array[k].signal);
-                blobmsg_add_u32(b, "rcpi", probe_array[k].rcpi);
-                blobmsg_add_u32(b, "rsni", probe_array[k].rsni);
-                blobmsg_add_u32(b, "freq", probe_array[k].freq);
-                blobmsg_add_u8(b, "ht_capabilities", probe_array[k].ht_capabilities);
-                blobmsg_add_u8(b, "vht_capabilities", probe_array[k].vht_capabilities);
+                blobmsg_add_u32(b, "signal", k->signal);
+                blobmsg_add_u32(b, "rcpi", k->rcpi);
+                blobmsg_add_u32(b, "rsni", k->rsni);
+                blobmsg_add_u32(b, "freq", k->freq);
+                blobmsg_add_u8(b, "ht_capabilities", k->ht_capabilities);
+                blobmsg_add_u8(b, "vht_capabilities", k->vht_capabilities);
 
 
                 // check if ap entry is available
-                blobmsg_add_u32(b, "channel_utilization", ap_entry.channel_utilization);
-                blobmsg_add_u32(b, "num_sta", ap_entry.station_count);
-                blobmsg_add_u8(b, "ht_support", ap_entry.ht_support);
-                blobmsg_add_u8(b, "vht_support", ap_entry.vht_support);
+                blobmsg_add_u32(b, "channel_utilization", ap_entry->channel_utilization);
+                blobmsg_add_u32(b, "num_sta", ap_entry->station_count);
+                blobmsg_add_u8(b, "ht_support", ap_entry->ht_support);
+                blobmsg_add_u8(b, "vht_support", ap_entry->vht_support);
 
-                blobmsg_add_u32(b, "score", eval_probe_metric(probe_array[k]));
+                blobmsg_add_u32(b, "score", eval_probe_metric(k));
                 blobmsg_close_table(b, ap_list);
             }
-            blobmsg_close_table(b, client_list);
+
+            if (client_list != NULL) {
+                blobmsg_close_table(b, client_list);
+            }
         }
         blobmsg_close_table(b, ssid_list);
     }
+    pthread_mutex_unlock(&ap_array_mutex);
     pthread_mutex_unlock(&probe_array_mutex);
     return 0;
 }
 
 int build_network_overview(struct blob_buf *b) {
-    void *client_list, *ap_list, *ssid_list;
+    void *client_list, *ap_list, *ssid_list = NULL;
     char ap_mac_buf[20];
     char client_mac_buf[20];
     struct hostapd_sock_entry *sub;
 
+    pthread_mutex_lock(&client_array_mutex);
+    pthread_mutex_lock(&probe_array_mutex);
+    pthread_mutex_lock(&ap_array_mutex);
+
     blob_buf_init(b, 0);
-    int m;
-    for (m = 0; m <= ap_entry_last; m++) {
+    ap* m;
+    list_for_each_entry(m, &ap_entry_list, list) {
         bool add_ssid = false;
         bool close_ssid = false;
 
-        if (m == 0 || strcmp((char *) ap_array[m].ssid, (char *) ap_array[m - 1].ssid) != 0) {
+        if (m->list.prev == &ap_entry_list ||
+            strcmp((char *) m->ssid, (char *) list_entry(m->list.prev, ap, list)->ssid) != 0) {
             add_ssid = true;
         }
 
-        if (m >= ap_entry_last || strcmp((char *) ap_array[m].ssid, (char *) ap_array[m + 1].ssid) != 0) {
+        if (m->list.next == &ap_entry_list ||
+            strcmp((char *) m->ssid, (char *) list_entry(m->list.next, ap, list)->ssid) != 0) {
             close_ssid = true;
         }
 
         if(add_ssid)
         {
-            ssid_list = blobmsg_open_table(b, (char *) ap_array[m].ssid);
+            ssid_list = blobmsg_open_table(b, (char *) m->ssid);
         }
-        sprintf(ap_mac_buf, MACSTR, MAC2STR(ap_array[m].bssid_addr));
+        sprintf(ap_mac_buf, MACSTR, MAC2STR(m->bssid_addr));
         ap_list = blobmsg_open_table(b, ap_mac_buf);
 
-        blobmsg_add_u32(b, "freq", ap_array[m].freq);
-        blobmsg_add_u32(b, "channel_utilization", ap_array[m].channel_utilization);
-        blobmsg_add_u32(b, "num_sta", ap_array[m].station_count);
-        blobmsg_add_u8(b, "ht_support", ap_array[m].ht_support);
-        blobmsg_add_u8(b, "vht_support", ap_array[m].vht_support);
+        blobmsg_add_u32(b, "freq", m->freq);
+        blobmsg_add_u32(b, "channel_utilization", m->channel_utilization);
+        blobmsg_add_u32(b, "num_sta", m->station_count);
+        blobmsg_add_u8(b, "ht_support", m->ht_support);
+        blobmsg_add_u8(b, "vht_support", m->vht_support);
 
         bool local_ap = false;
         list_for_each_entry(sub, &hostapd_sock_list, list)
         {
-            if (mac_is_equal(ap_array[m].bssid_addr, sub->bssid_addr)) {
+            if (mac_is_equal(m->bssid_addr, sub->bssid_addr)) {
                 local_ap = true;
             }
         }
@@ -1453,45 +1880,40 @@ int build_network_overview(struct blob_buf *b) {
 
         char *nr;
         nr = blobmsg_alloc_string_buffer(b, "neighbor_report", NEIGHBOR_REPORT_LEN);
-        sprintf(nr, "%s", ap_array[m].neighbor_report); // TODO: Why not strcpy()
+        sprintf(nr, "%s", m->neighbor_report); // TODO: Why not strcpy()
         blobmsg_add_string_buffer(b);
 
         char *iface;
         iface = blobmsg_alloc_string_buffer(b, "iface", MAX_INTERFACE_NAME);
-        sprintf(iface, "%s", ap_array[m].iface);
+        sprintf(iface, "%s", m->iface);
         blobmsg_add_string_buffer(b);
 
         char *hostname;
         hostname = blobmsg_alloc_string_buffer(b, "hostname", HOST_NAME_MAX);
-        sprintf(hostname, "%s", ap_array[m].hostname);
+        sprintf(hostname, "%s", m->hostname);
         blobmsg_add_string_buffer(b);
 
-        int k;
-        for (k = 0; k <= client_entry_last; k++) {
-
-            if (mac_is_equal(ap_array[m].bssid_addr, client_array[k].bssid_addr)) {
-                sprintf(client_mac_buf, MACSTR, MAC2STR(client_array[k].client_addr));
+        client_bssid* cb = client_array_get_bssid(m->bssid_addr);
+        if (cb != NULL) {
+            client* k;
+            list_for_each_entry(k, &cb->clients, bssid_list) {
+                sprintf(client_mac_buf, MACSTR, MAC2STR(k->client_addr));
                 client_list = blobmsg_open_table(b, client_mac_buf);
 
-                if(strlen(client_array[k].signature) != 0)
+                if(strlen(k->signature) != 0)
                 {
                     char *s;
                     s = blobmsg_alloc_string_buffer(b, "signature", 1024);
-                    sprintf(s, "%s", client_array[k].signature);
+                    sprintf(s, "%s", k->signature);
                     blobmsg_add_string_buffer(b);
                 }
-                blobmsg_add_u8(b, "ht", client_array[k].ht);
-                blobmsg_add_u8(b, "vht", client_array[k].vht);
-                blobmsg_add_u32(b, "collision_count", ap_get_collision_count(ap_array[m].collision_domain));
+                blobmsg_add_u8(b, "ht", k->ht);
+                blobmsg_add_u8(b, "vht", k->vht);
+                blobmsg_add_u32(b, "collision_count", ap_get_collision_count(m->collision_domain));
 
-                int n;
-                for(n = 0; n <= probe_entry_last; n++)
-                {
-                    if (mac_is_equal(client_array[k].client_addr, probe_array[n].client_addr) &&
-                            mac_is_equal(client_array[k].bssid_addr, probe_array[n].bssid_addr)) {
-                        blobmsg_add_u32(b, "signal", probe_array[n].signal);
-                        break;
-                    }
+                probe_entry* probe = probe_array_get_entry(k->bssid_addr, k->client_addr);
+                if (probe != NULL) {
+                    blobmsg_add_u32(b, "signal", probe->signal);
                 }
                 blobmsg_close_table(b, client_list);
             }
@@ -1502,29 +1924,162 @@ int build_network_overview(struct blob_buf *b) {
             blobmsg_close_table(b, ssid_list);
         }
     }
+
+    pthread_mutex_unlock(&ap_array_mutex);
+    pthread_mutex_unlock(&probe_array_mutex);
+    pthread_mutex_unlock(&client_array_mutex);
+    return 0;
+}
+
+static void blobmsg_add_histogram(struct blob_buf *buf, const char *name, const struct dawn_histogram *h) {
+    void *table = blobmsg_open_table(buf, name);
+    void *buckets;
+    char limit[24];
+
+    blobmsg_add_u64(buf, "count", h->count);
+    blobmsg_add_u64(buf, "avg_us", h->count ? h->sum_us / h->count : 0);
+    blobmsg_add_u64(buf, "max_us", h->max_us);
+    blobmsg_add_u64(buf, "p50_us", dawn_histogram_percentile(h, 50));
+    blobmsg_add_u64(buf, "p90_us", dawn_histogram_percentile(h, 90));
+    blobmsg_add_u64(buf, "p99_us", dawn_histogram_percentile(h, 99));
+    blobmsg_add_u64(buf, "p999_us", dawn_histogram_percentile(h, 99.9));
+
+    // only the buckets with samples, named after their upper bound in microseconds
+    buckets = blobmsg_open_table(buf, "buckets");
+    for (int i = 0; i < DAWN_HISTOGRAM_BUCKETS; i++) {
+        if (!h->buckets[i])
+            continue;
+
+        if (dawn_histogram_bucket_limit(i))
+            sprintf(limit, "%" PRIu64, dawn_histogram_bucket_limit(i));
+        else
+            strcpy(limit, "inf");
+        blobmsg_add_u64(buf, limit, h->buckets[i]);
+    }
+    blobmsg_close_table(buf, buckets);
+
+    blobmsg_close_table(buf, table);
+}
+
+static void blobmsg_add_rate(struct blob_buf *buf, const char *name, struct dawn_rate *r) {
+    void *table = blobmsg_open_table(buf, name);
+
+    blobmsg_add_u64(buf, "total", r->total);
+    blobmsg_add_double(buf, "per_sec", dawn_rate_get(r));
+    blobmsg_close_table(buf, table);
+}
+
+int build_stats(struct blob_buf *b) {
+    int count[__DAWN_STATS_TABLE_MAX];
+    int limit[__DAWN_STATS_TABLE_MAX];
+    void *table, *entry;
+
+    pthread_mutex_lock(&client_array_mutex);
+    pthread_mutex_lock(&probe_array_mutex);
+    pthread_mutex_lock(&ap_array_mutex);
+    count[DAWN_STATS_TABLE_PROBE] = probe_entry_count;
+    count[DAWN_STATS_TABLE_CLIENT] = client_entry_count;
+    count[DAWN_STATS_TABLE_AP] = ap_entry_count;
+    pthread_mutex_unlock(&ap_array_mutex);
+    pthread_mutex_unlock(&probe_array_mutex);
+    pthread_mutex_unlock(&client_array_mutex);
+
+    pthread_mutex_lock(&denied_array_mutex);
+    count[DAWN_STATS_TABLE_DENIED_REQ] = denied_req_last + 1;
+    pthread_mutex_unlock(&denied_array_mutex);
+
+    limit[DAWN_STATS_TABLE_PROBE] = storage_limit(storage_config.probe_limit, PROBE_ARRAY_LEN);
+    limit[DAWN_STATS_TABLE_CLIENT] = storage_limit(storage_config.client_limit, ARRAY_CLIENT_LEN);
+    limit[DAWN_STATS_TABLE_AP] = storage_limit(storage_config.ap_limit, ARRAY_AP_LEN);
+    limit[DAWN_STATS_TABLE_DENIED_REQ] = storage_limit(storage_config.denied_req_limit, DENY_REQ_ARRAY_LEN);
+
+    blob_buf_init(b, 0);
+    blobmsg_add_u32(b, "uptime", time(0) - dawn_stats.start);
+
+    table = blobmsg_open_table(b, "events");
+    for (int i = 0; i < __DAWN_STATS_EVENT_MAX; i++) {
+        entry = blobmsg_open_table(b, dawn_stats_event_name(i));
+        blobmsg_add_rate(b, "requests", &dawn_stats.events[i]);
+        blobmsg_add_u64(b, "denied", dawn_stats.denied[i]);
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_table(b, table);
+    blobmsg_add_histogram(b, "decision", &dawn_stats.decision);
+
+    table = blobmsg_open_table(b, "notify");
+    blobmsg_add_u32(b, "budget_us", DAWN_NOTIFY_BUDGET_US);
+    for (int i = 0; i < __DAWN_STATS_NOTIFY_MAX; i++) {
+        entry = blobmsg_open_table(b, dawn_stats_notify_name(i));
+        blobmsg_add_histogram(b, "latency", &dawn_stats.notify[i]);
+        blobmsg_add_u64(b, "over_budget", dawn_stats.notify_over_budget[i]);
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_table(b, table);
+
+    table = blobmsg_open_table(b, "tables");
+    for (int i = 0; i < __DAWN_STATS_TABLE_MAX; i++) {
+        entry = blobmsg_open_table(b, dawn_stats_table_name(i));
+        blobmsg_add_u32(b, "entries", count[i]);
+        blobmsg_add_u32(b, "limit", limit[i]);
+        blobmsg_add_u64(b, "evictions", dawn_stats.evictions[i]);
+        blobmsg_add_u64(b, "expired", dawn_stats.expired[i]);
+        blobmsg_add_histogram(b, "sweep", &dawn_stats.sweep[i]);
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_table(b, table);
+
+    table = blobmsg_open_table(b, "messages");
+    for (int i = 0; i < __DAWN_STATS_MSG_MAX; i++) {
+        entry = blobmsg_open_table(b, dawn_stats_msg_name(i));
+        blobmsg_add_u64(b, "sent", dawn_stats.msgs[i].sent);
+        blobmsg_add_u64(b, "received", dawn_stats.msgs[i].received);
+        blobmsg_add_u64(b, "dropped", dawn_stats.msgs[i].dropped);
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_table(b, table);
+
+    table = blobmsg_open_table(b, "receive_queue");
+    blobmsg_add_u64(b, "received", recv_queue_stats.received);
+    blobmsg_add_u64(b, "dropped", recv_queue_stats.dropped);
+    blobmsg_add_u64(b, "processed", recv_queue_stats.processed);
+    blobmsg_add_u32(b, "high_watermark", recv_queue_stats.high_watermark);
+    blobmsg_close_table(b, table);
+
+    table = blobmsg_open_table(b, "probe_batch");
+    blobmsg_add_u64(b, "queued", probe_batch_stats.queued);
+    blobmsg_add_u64(b, "coalesced", probe_batch_stats.coalesced);
+    blobmsg_add_u64(b, "batches", probe_batch_stats.batches);
+    blobmsg_add_u64(b, "sent", probe_batch_stats.sent);
+    blobmsg_close_table(b, table);
+
+    tcp_add_stats(b);
+
+    blobmsg_add_histogram(b, "encrypt", &dawn_stats.encrypt);
+    blobmsg_add_histogram(b, "decrypt", &dawn_stats.decrypt);
+
     return 0;
 }
 
 int ap_get_nr(struct blob_buf *b_local, uint8_t own_bssid_addr[]) {
 
     pthread_mutex_lock(&ap_array_mutex);
-    int i;
+    ap* i;
 
     void* nbs = blobmsg_open_array(b_local, "list");
 
-    for (i = 0; i <= ap_entry_last; i++) {
-        if (mac_is_equal(own_bssid_addr, ap_array[i].bssid_addr)) {
+    list_for_each_entry(i, &ap_entry_list, list) {
+        if (mac_is_equal(own_bssid_addr, i->bssid_addr)) {
             continue; //TODO: Skip own entry?!
         }
 
         void* nr_entry = blobmsg_open_array(b_local, NULL);
 
         char mac_buf[20];
-        sprintf(mac_buf, MACSTRLOWER, MAC2STR(ap_array[i].bssid_addr));
+        sprintf(mac_buf, MACSTRLOWER, MAC2STR(i->bssid_addr));
         blobmsg_add_string(b_local, NULL, mac_buf);
 
-        blobmsg_add_string(b_local, NULL, (char *) ap_array[i].ssid);
-        blobmsg_add_string(b_local, NULL, ap_array[i].neighbor_report);
+        blobmsg_add_string(b_local, NULL, (char *) i->ssid);
+        blobmsg_add_string(b_local, NULL, i->neighbor_report);
         blobmsg_close_array(b_local, nr_entry);
 
     }
@@ -1549,9 +2104,11 @@ void uloop_add_data_cbs() {
 // Or not needed as test harness not threaded?
 void remove_probe_array_cb(struct uloop_timeout* t) {
     pthread_mutex_lock(&probe_array_mutex);
-    printf("[Thread] : Removing old probe entries!\n");
+    dawn_log_debug("[Thread] : Removing old probe entries!\n");
+    uint64_t start = dawn_stats_now_us();
     remove_old_probe_entries(time(0), timeout_config.remove_probe);
-    printf("[Thread] : Removing old entries finished!\n");
+    dawn_histogram_add_since(&dawn_stats.sweep[DAWN_STATS_TABLE_PROBE], start);
+    dawn_log_debug("[Thread] : Removing old entries finished!\n");
     pthread_mutex_unlock(&probe_array_mutex);
     uloop_timeout_set(&probe_timeout, timeout_config.remove_probe * 1000);
 }
@@ -1560,8 +2117,10 @@ void remove_probe_array_cb(struct uloop_timeout* t) {
 // Or not needed as test harness not threaded?
 void remove_client_array_cb(struct uloop_timeout* t) {
     pthread_mutex_lock(&client_array_mutex);
-    printf("[Thread] : Removing old client entries!\n");
+    dawn_log_debug("[Thread] : Removing old client entries!\n");
+    uint64_t start = dawn_stats_now_us();
     remove_old_client_entries(time(0), timeout_config.update_client);
+    dawn_histogram_add_since(&dawn_stats.sweep[DAWN_STATS_TABLE_CLIENT], start);
     pthread_mutex_unlock(&client_array_mutex);
     uloop_timeout_set(&client_timeout, timeout_config.update_client * 1000);
 }
@@ -1570,47 +2129,42 @@ void remove_client_array_cb(struct uloop_timeout* t) {
 // Or not needed as test harness not threaded?
 void remove_ap_array_cb(struct uloop_timeout* t) {
     pthread_mutex_lock(&ap_array_mutex);
-    printf("[ULOOP] : Removing old ap entries!\n");
+    dawn_log_debug("[ULOOP] : Removing old ap entries!\n");
+    uint64_t start = dawn_stats_now_us();
     remove_old_ap_entries(time(0), timeout_config.remove_ap);
+    dawn_histogram_add_since(&dawn_stats.sweep[DAWN_STATS_TABLE_AP], start);
     pthread_mutex_unlock(&ap_array_mutex);
     uloop_timeout_set(&ap_timeout, timeout_config.remove_ap * 1000);
 }
 
 // TODO: Move mutex handling to (new) remove_??? function to make test harness simpler?
 // Or not needed as test harness not threaded?
+static void denied_req_expired(const auth_entry* entry) {
+    uint8_t client_addr[ETH_ALEN];
+    memcpy(client_addr, entry->client_addr, ETH_ALEN);
+
+    // client is not connected for a given time threshold!
+    if (!is_connected_somehwere(client_addr)) {
+        dawn_log_info("Client has probably a bad driver!\n");
+
+        // problem that somehow station will land into this list
+        // maybe delete again?
+        if (insert_to_maclist(client_addr) == 0) {
+            send_add_mac(client_addr);
+            // TODO: File can grow arbitarily large.  Resource consumption risk.
+            // TODO: Consolidate use of file across source: shared resource for name, single point of access?
+            write_mac_to_file("/tmp/dawn_mac_list", client_addr);
+        }
+    }
+}
+
 void denied_req_array_cb(struct uloop_timeout* t) {
     pthread_mutex_lock(&denied_array_mutex);
-    printf("[ULOOP] : Processing denied authentication!\n");
+    dawn_log_debug("[ULOOP] : Processing denied authentication!\n");
 
-    time_t current_time = time(0);
-
-    int i = 0;
-    while (i <= denied_req_last) {
-        // check counter
-
-        //check timer
-        if (denied_req_array[i].time < current_time - timeout_config.denied_req_threshold) {
-
-            // client is not connected for a given time threshold!
-            if (!is_connected_somehwere(denied_req_array[i].client_addr)) {
-                printf("Client has probably a bad driver!\n");
-
-                // problem that somehow station will land into this list
-                // maybe delete again?
-                if (insert_to_maclist(denied_req_array[i].client_addr) == 0) {
-                    send_add_mac(denied_req_array[i].client_addr);
-                    // TODO: File can grow arbitarily large.  Resource consumption risk.
-                    // TODO: Consolidate use of file across source: shared resource for name, single point of access?
-                    write_mac_to_file("/tmp/dawn_mac_list", denied_req_array[i].client_addr);
-                }
-            }
-            denied_req_array_delete(denied_req_array[i]);
-        }
-        else
-        {
-            i++;
-        }
-    }
+    uint64_t start = dawn_stats_now_us();
+    remove_old_denied_req_entries(time(0), timeout_config.denied_req_threshold, denied_req_expired);
+    dawn_histogram_add_since(&dawn_stats.sweep[DAWN_STATS_TABLE_DENIED_REQ], start);
     pthread_mutex_unlock(&denied_array_mutex);
     uloop_timeout_set(&denied_req_timeout, timeout_config.denied_req_threshold * 1000);
 }